@@ -0,0 +1,64 @@
+// Recompiles ROMs ahead of time into one C++ file, see pot8to_aot.cpp.
+//   aot_linux build/output/aot_programs.cpp roms/*.ch8
+// Hosts built with -DPOT8TO_AOT and the output directory on the include
+// path pick the code up.
+#include "platform.h"
+#include "platform_linux.cpp"
+#include "pot8to.cpp"
+#include "pot8to_aot.cpp"
+#include <stdio.h>
+#include <string.h>
+#include <string>
+
+int main(int argc, char **argv) {
+  if (argc < 3) {
+    fprintf(stderr, "usage: %s <out.cpp> <rom.ch8>...\n", argv[0]);
+    return 1;
+  }
+
+  std::string out = "// Generated by aot_linux, do not edit.\n"
+                    "#include \"pot8to_aot.cpp\"\n\n"
+                    "#ifdef POT8TO_PROFILE\n"
+                    "#error \"Recompiled blocks don't count for the profiler\"\n"
+                    "#endif\n"
+                    "#ifdef POT8TO_GUARD\n"
+                    "#error \"Recompiled blocks don't check for faults\"\n"
+                    "#endif\n"
+                    "#ifdef POT8TO_TRACE\n"
+                    "#error \"Recompiled blocks don't record a trace\"\n"
+                    "#endif\n\n"
+                    "namespace Pot8to {\n\n";
+  std::string table;
+  size_t count = 0;
+  for (int i = 2; i < argc; i++) {
+    Platform::Program rom = Platform::load_program(argv[i]);
+    if (rom.size == 0) {
+      return 1;
+    }
+    const char *name = strrchr(argv[i], '/');
+    name = name != NULL ? name + 1 : argv[i];
+    Pot8to::AotStats stats;
+    Pot8to::aot_translate(rom, name, count, out, stats);
+    char entry[512];
+    snprintf(entry, sizeof(entry),
+             "    {\"%s\", aot_rom_%zu, sizeof(aot_rom_%zu), aot_run_%zu},\n",
+             name, count, count, count);
+    table += entry;
+    printf("%s: %zu blocks, %zu instructions\n", name, stats.blocks,
+           stats.instructions);
+    count++;
+  }
+  out += "static const AotProgram aot_programs[] = {\n" + table + "};\n";
+  out += "constexpr size_t POT8TO_AOT_PROGRAMS =\n"
+         "    sizeof(aot_programs) / sizeof(aot_programs[0]);\n\n"
+         "} // namespace Pot8to\n";
+
+  FILE *file = fopen(argv[1], "wb");
+  if (file == NULL) {
+    fprintf(stderr, "Could not open '%s'\n", argv[1]);
+    return 1;
+  }
+  fwrite(out.data(), 1, out.size(), file);
+  fclose(file);
+  return 0;
+}
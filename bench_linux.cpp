@@ -0,0 +1,536 @@
+// Benchmarks for the core, results go to stdout as CSV so runs can be kept
+// and compared. Microbenchmarks time decoding, every opcode through
+// `execute_decoded_instruction`, DXYN at every sprite height, the display
+// opcodes in hires and with both planes, `initialize` and `reset_state`;
+// ROM benchmarks run every file in the ROM directory for a fixed number of
+// instructions on each core, including their ahead-of-time recompiled code
+// in builds made by build/linux_aot.sh, and then as host frames with 0 to 4
+// frames of run-ahead.
+//
+// Columns: kind, name, variant, iterations, ns_per_op, ops_per_second,
+// checksum. An op is one iteration: an instruction, a call plus its return,
+// an `initialize`, a `reset_state`, a ROM instruction or a host frame. The
+// checksum is
+// there to keep the work observable and to spot runs that stopped doing the
+// same thing.
+#include "platform.h"
+#include "platform_linux.cpp"
+#include "pot8to.cpp"
+#include "pot8to_jit_x64.cpp"
+#include "pot8to_runahead.cpp"
+#ifdef POT8TO_AOT
+// Written by aot_linux, see build/linux_aot.sh.
+#include "aot_programs.cpp"
+#endif
+#include <algorithm>
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <time.h>
+#include <vector>
+
+static void print_usage(const char *program) {
+  fprintf(stderr,
+          "usage: %s [options]\n"
+          "  --roms DIR        ROMs to run (default roms)\n"
+          "  --instructions N  instructions per ROM run (default 20000000)\n"
+          "  --iterations N    iterations per microbenchmark (default 4M)\n"
+          "  --repeat N        keep the fastest of N runs (default 3)\n"
+          "  --filter TEXT     only benchmarks whose name contains TEXT\n",
+          program);
+}
+
+static double seconds_now() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static const char *name_filter = NULL;
+static size_t repeat = 3;
+
+static bool selected(const std::string &name) {
+  return name_filter == NULL || name.find(name_filter) != std::string::npos;
+}
+
+static void report(const char *kind, const std::string &name,
+                   const char *variant, uint64_t iterations, double seconds,
+                   uint64_t checksum) {
+  double ns = iterations > 0 ? seconds * 1e9 / iterations : 0.0;
+  printf("%s,\"%s\",%s,%llu,%.3f,%.0f,%016llx\n", kind, name.c_str(), variant,
+         (unsigned long long)iterations, ns,
+         seconds > 0 ? iterations / seconds : 0.0,
+         (unsigned long long)checksum);
+  fflush(stdout);
+}
+
+static uint64_t state_checksum(const Pot8to::State &state) {
+  uint64_t hash = Pot8to::display_hash(state);
+  for (size_t i = 0; i < 16; i++) {
+    hash = (hash ^ state.registers.V[i]) * 0x100000001B3ull;
+  }
+  return (hash ^ state.registers.I) * 0x100000001B3ull;
+}
+
+// Program memory full of arbitrary bytes, so decoding sees every opcode.
+static Platform::Program noise_program() {
+  Platform::Program program = {};
+  uint32_t rng = POT8TO_DEFAULT_SEED;
+  for (size_t i = 0; i < POT8TO_PROGRAM_MEMORY; i++) {
+    program.buffer[i] = Pot8to::next_random(rng);
+  }
+  program.size = POT8TO_PROGRAM_MEMORY;
+  return program;
+}
+
+// Fastest of `repeat` runs of `body(iterations)`, which returns a checksum.
+template <typename Body>
+static double best_time(uint64_t iterations, uint64_t &checksum, Body body) {
+  double best = 0;
+  for (size_t run = 0; run < repeat; run++) {
+    double start = seconds_now();
+    checksum = body(iterations);
+    double elapsed = seconds_now() - start;
+    if (run == 0 || elapsed < best) {
+      best = elapsed;
+    }
+  }
+  return best;
+}
+
+static void bench_decode(uint64_t iterations) {
+  if (!selected("decode")) {
+    return;
+  }
+  Pot8to::State state = Pot8to::initialize(noise_program());
+  uint64_t checksum = 0;
+  double seconds = best_time(iterations, checksum, [&](uint64_t n) {
+    uint64_t sum = 0;
+    for (uint64_t i = 0; i < n; i++) {
+      if (state.registers.PC >= POT8TO_MAX_MEMORY - 1) {
+        state.registers.PC = POT8TO_PROGRAM_MEMORY_INITIAL_POSITION;
+      }
+      Pot8to::Instruction inst = Pot8to::decode_next_intruction(state);
+      sum = sum * 31 + inst.identifier + inst.address.NNN;
+    }
+    return sum;
+  });
+  report("micro", "decode_next_intruction", "", iterations, seconds, checksum);
+
+  // Same walk served from the decode cache once it is warm.
+  checksum = 0;
+  seconds = best_time(iterations, checksum, [&](uint64_t n) {
+    Pot8to::Instruction scratch;
+    uint64_t sum = 0;
+    for (uint64_t i = 0; i < n; i++) {
+      if (state.registers.PC >= POT8TO_MAX_MEMORY - 1) {
+        state.registers.PC = POT8TO_PROGRAM_MEMORY_INITIAL_POSITION;
+      }
+      const Pot8to::Instruction &inst =
+          Pot8to::fetch_decoded_instruction(state, scratch);
+      sum = sum * 31 + inst.identifier + inst.address.NNN;
+    }
+    return sum;
+  });
+  report("micro", "fetch_decoded_instruction", "cached", iterations, seconds,
+         checksum);
+}
+
+// Opcodes executed back to back per iteration, named after the first one.
+// Calls are paired with a return so the stack never overflows.
+struct OpcodeBench {
+  const char *name;
+  uint16_t opcodes[2];
+  size_t count;
+};
+
+static const OpcodeBench opcode_benches[] = {
+    {"00E0", {0x00E0}, 1},
+    {"2NNN+00EE", {0x2300, 0x00EE}, 2},
+    {"1NNN", {0x1200}, 1},
+    {"3XNN", {0x3A12}, 1},
+    {"4XNN", {0x4A12}, 1},
+    {"5XY0", {0x5AB0}, 1},
+    {"6XNN", {0x6A12}, 1},
+    {"7XNN", {0x7A01}, 1},
+    {"8XY0", {0x8AB0}, 1},
+    {"8XY1", {0x8AB1}, 1},
+    {"8XY2", {0x8AB2}, 1},
+    {"8XY3", {0x8AB3}, 1},
+    {"8XY4", {0x8AB4}, 1},
+    {"8XY5", {0x8AB5}, 1},
+    {"8XY6", {0x8AB6}, 1},
+    {"8XY7", {0x8AB7}, 1},
+    {"8XYE", {0x8ABE}, 1},
+    {"9XY0", {0x9AB0}, 1},
+    {"ANNN", {0xA300}, 1},
+    {"BNNN", {0xB200}, 1},
+    {"CXNN", {0xCAFF}, 1},
+    {"EX9E", {0xEA9E}, 1},
+    {"EXA1", {0xEAA1}, 1},
+    {"FX07", {0xFA07}, 1},
+    {"FX0A", {0xFA0A}, 1},
+    {"FX15", {0xFA15}, 1},
+    {"FX18", {0xFA18}, 1},
+    {"FX1E", {0xFA1E}, 1},
+    {"FX29", {0xFA29}, 1},
+    {"FX33", {0xFA33}, 1},
+    {"FX55", {0xFF55}, 1},
+    {"FX65", {0xFF65}, 1},
+};
+
+// Kept out of line so the compiler can't specialise the switch for one
+// opcode, every iteration goes through the real dispatch.
+template <typename Quirks = Pot8to::DefaultQuirks>
+__attribute__((noinline)) static uint64_t
+run_opcodes(Pot8to::State &state, const Pot8to::Instruction *instructions,
+            size_t count, uint64_t iterations) {
+  for (uint64_t i = 0; i < iterations; i++) {
+    for (size_t j = 0; j < count; j++) {
+      Pot8to::execute_decoded_instruction<Quirks>(state, instructions[j]);
+    }
+    // Jumps, FX1E and the stack would otherwise wander off.
+    state.registers.PC = POT8TO_PROGRAM_MEMORY_INITIAL_POSITION;
+    state.registers.I = 0x300;
+    state.registers.SP = 0;
+  }
+  return state_checksum(state);
+}
+
+static void bench_opcodes(uint64_t iterations) {
+  for (const OpcodeBench &bench : opcode_benches) {
+    if (!selected(bench.name)) {
+      continue;
+    }
+    Pot8to::Instruction instructions[2];
+    for (size_t j = 0; j < bench.count; j++) {
+      instructions[j] = Pot8to::decode_instruction(bench.opcodes[j]);
+    }
+    Pot8to::State state = Pot8to::initialize(Platform::Program{});
+    uint64_t checksum = 0;
+    double seconds = best_time(iterations, checksum, [&](uint64_t n) {
+      return run_opcodes(state, instructions, bench.count, n);
+    });
+    report("micro", bench.name, "execute", iterations, seconds, checksum);
+  }
+}
+
+static void bench_dxyn(uint64_t iterations) {
+  if (!selected("DXYN")) {
+    return;
+  }
+  for (uint16_t height = 1; height <= 15; height++) {
+    Pot8to::State state = Pot8to::initialize(noise_program());
+    state.registers.I = 0x300;
+    Pot8to::Instruction draw = Pot8to::decode_instruction(0xD010 | height);
+    uint64_t checksum = 0;
+    double seconds = best_time(iterations, checksum, [&](uint64_t n) {
+      for (uint64_t i = 0; i < n; i++) {
+        // Walk the sprite over the screen so every shift and wrap shows up.
+        state.registers.V[0] = (uint8_t)i;
+        state.registers.V[1] = (uint8_t)(i >> 6);
+        Pot8to::execute_decoded_instruction(state, draw);
+      }
+      return state_checksum(state);
+    });
+    char variant[8];
+    snprintf(variant, sizeof(variant), "N=%u", (unsigned)height);
+    report("micro", "DXYN", variant, iterations, seconds, checksum);
+  }
+}
+// Display opcodes again on a display already switched to `hires` and with
+// the `planes` mask selected, run like `opcode_benches` but with the
+// SUPER-CHIP quirks, where DXY0 draws 16x16 sprites.
+struct DisplayBench {
+  const char *name;
+  const char *variant;
+  uint16_t opcode;
+  bool hires;
+  uint8_t planes;
+};
+
+static const DisplayBench display_benches[] = {
+    {"DXYN", "hires", 0xD018, true, 1},
+    {"DXYN", "hires planes=3", 0xD018, true, 3},
+    {"DXY0", "lores", 0xD010, false, 1},
+    {"DXY0", "hires", 0xD010, true, 1},
+    {"DXY0", "hires planes=3", 0xD010, true, 3},
+    {"00E0", "hires planes=3", 0x00E0, true, 3},
+    {"00CN", "hires", 0x00C4, true, 1},
+    {"00DN", "hires", 0x00D4, true, 1},
+    {"00FB", "hires", 0x00FB, true, 1},
+    {"00FC", "hires", 0x00FC, true, 1},
+};
+
+static void bench_display_modes(uint64_t iterations) {
+  for (const DisplayBench &bench : display_benches) {
+    if (!selected(bench.name)) {
+      continue;
+    }
+    Pot8to::Instruction instruction = Pot8to::decode_instruction(bench.opcode);
+    Pot8to::State state = Pot8to::initialize(noise_program());
+    state.hires = bench.hires;
+    state.planes = bench.planes;
+    // Something to move around for the scrolls.
+    for (size_t plane = 0; plane < POT8TO_DISPLAY_PLANES; plane++) {
+      for (size_t i = 0; i < POT8TO_DISPLAY_WORDS; i++) {
+        state.display[plane][i] = 0x9E3779B97F4A7C15ull * (i + 1);
+      }
+    }
+    state.registers.V[0xA] = 60;
+    state.registers.V[0xB] = 20;
+    uint64_t checksum = 0;
+    double seconds = best_time(iterations, checksum, [&](uint64_t n) {
+      return run_opcodes<Pot8to::SuperChipQuirks>(state, &instruction, 1, n);
+    });
+    report("micro", bench.name, bench.variant, iterations, seconds, checksum);
+  }
+}
+
+static void bench_initialize(uint64_t iterations) {
+  if (!selected("initialize")) {
+    return;
+  }
+  Platform::Program program = noise_program();
+  // A whole State per call, far slower than an opcode.
+  iterations = std::max<uint64_t>(iterations / 256, 1);
+  uint64_t checksum = 0;
+  double seconds = best_time(iterations, checksum, [&](uint64_t n) {
+    uint64_t sum = 0;
+    for (uint64_t i = 0; i < n; i++) {
+      Pot8to::State state = Pot8to::initialize(program);
+      sum += state.memory[POT8TO_PROGRAM_MEMORY_INITIAL_POSITION + i % 256];
+    }
+    return sum;
+  });
+  report("micro", "initialize", "", iterations, seconds, checksum);
+}
+
+// What a fuzzer pays per input instead of `initialize`.
+static void bench_reset_state(uint64_t iterations) {
+  if (!selected("reset_state")) {
+    return;
+  }
+  Platform::Program program = noise_program();
+  const Pot8to::State initial = Pot8to::initialize(program);
+  Pot8to::State state = initial;
+  iterations = std::max<uint64_t>(iterations / 256, 1);
+  uint64_t checksum = 0;
+  double seconds = best_time(iterations, checksum, [&](uint64_t n) {
+    uint64_t sum = 0;
+    for (uint64_t i = 0; i < n; i++) {
+      Pot8to::reset_state(state, initial);
+      sum += state.memory[POT8TO_PROGRAM_MEMORY_INITIAL_POSITION + i % 256];
+      state.memory[POT8TO_PROGRAM_MEMORY_INITIAL_POSITION + i % 256]++;
+    }
+    return sum;
+  });
+  report("micro", "reset_state", "", iterations, seconds, checksum);
+}
+
+#ifdef POT8TO_HAS_JIT
+static Pot8to::Jit jit;
+#endif
+
+enum Core { CORE_SWITCH, CORE_THREADED, CORE_JIT, CORE_AOT };
+static const char *const core_names[] = {"switch", "threaded", "jit", "aot"};
+
+// The core a ROM runs on with `core`, NULL for the JIT and where it can't
+// run.
+static Pot8to::RunFunction rom_core(const Platform::Program &rom, Core core) {
+  switch (core) {
+  case CORE_SWITCH:
+    return Pot8to::run_switch;
+  case CORE_THREADED:
+    return Pot8to::run_threaded;
+#ifdef POT8TO_AOT
+  case CORE_AOT: {
+    const Pot8to::AotProgram *program = Pot8to::aot_find(
+        Pot8to::aot_programs, Pot8to::POT8TO_AOT_PROGRAMS, rom);
+    return program != NULL ? program->run : NULL;
+  }
+#endif
+  default:
+    (void)rom;
+    return NULL;
+  }
+}
+
+// Runs `instructions` instructions of `rom` in 11-instruction frames, like
+// the hosts do, and returns the display checksum.
+static uint64_t run_rom(const Platform::Program &rom, Core core,
+                        uint64_t instructions) {
+  Pot8to::State state = Pot8to::initialize(rom);
+#ifdef POT8TO_HAS_JIT
+  if (core == CORE_JIT) {
+    Pot8to::jit_reset(jit);
+  }
+#endif
+  Pot8to::RunFunction run = rom_core(rom, core);
+  uint64_t executed = 0;
+  while (executed < instructions) {
+    size_t budget = (size_t)std::min<uint64_t>(11, instructions - executed);
+    executed += budget;
+    while (budget > 0) {
+      Pot8to::RunResult result;
+#ifdef POT8TO_HAS_JIT
+      if (core == CORE_JIT) {
+        result = Pot8to::jit_run(jit, state, budget);
+      } else
+#endif
+      {
+        result = run(state, budget);
+      }
+      budget -= result.executed;
+    }
+    Pot8to::decrement_timers(state);
+  }
+  return Pot8to::display_hash(state);
+}
+
+// The selected .ch8 files in `directory`, sorted.
+static std::vector<std::string> rom_names(const char *directory) {
+  std::vector<std::string> names;
+  DIR *dir = opendir(directory);
+  if (dir == NULL) {
+    fprintf(stderr, "Could not open '%s'\n", directory);
+    return names;
+  }
+  while (dirent *entry = readdir(dir)) {
+    std::string name = entry->d_name;
+    if (name.size() > 4 && name.compare(name.size() - 4, 4, ".ch8") == 0 &&
+        selected(name)) {
+      names.push_back(name);
+    }
+  }
+  closedir(dir);
+  std::sort(names.begin(), names.end());
+  return names;
+}
+
+static void bench_roms(const char *directory, uint64_t instructions) {
+  std::vector<std::string> names = rom_names(directory);
+  for (const std::string &name : names) {
+    std::string path = std::string(directory) + "/" + name;
+    Platform::Program rom = Platform::load_program(path.c_str());
+    if (rom.size == 0) {
+      continue;
+    }
+    for (int core = CORE_SWITCH; core <= CORE_AOT; core++) {
+#ifdef POT8TO_HAS_JIT
+      bool available = core == CORE_JIT || rom_core(rom, (Core)core) != NULL;
+#else
+      bool available = rom_core(rom, (Core)core) != NULL;
+#endif
+      if (!available) {
+        continue;
+      }
+      uint64_t checksum = 0;
+      double seconds = best_time(instructions, checksum, [&](uint64_t n) {
+        return run_rom(rom, (Core)core, n);
+      });
+      report("rom", name, core_names[core], instructions, seconds, checksum);
+    }
+  }
+}
+
+static Pot8to::RunAhead runahead;
+
+// What a windowed host pays per frame for --run-ahead: a frame of 11
+// instructions on the interpreter, then `ahead` frames more on a copy. With
+// `ahead` 0 there is no copy at all. Returns the checksum of what would be
+// shown.
+static uint64_t run_host_frames(const Platform::Program &rom, uint64_t ahead,
+                                uint64_t frames) {
+  Pot8to::State state = Pot8to::initialize(rom);
+  Pot8to::run_ahead_reset(runahead);
+  uint64_t rows = 0;
+  for (uint64_t frame = 0; frame < frames; frame++) {
+    size_t budget = 11;
+    while (budget > 0) {
+      budget -= Pot8to::run(state, budget).executed;
+    }
+    Pot8to::decrement_timers(state);
+    if (ahead > 0) {
+      rows ^= Pot8to::run_ahead(runahead, state, Pot8to::run, 11, ahead);
+    } else {
+      rows ^= Pot8to::take_dirty_rows(state);
+    }
+  }
+  return (ahead > 0 ? Pot8to::display_hash(runahead.ahead)
+                    : Pot8to::display_hash(state)) ^
+         rows;
+}
+
+static void bench_run_ahead(const char *directory, uint64_t frames) {
+  static const char *const variants[] = {"off", "n1", "n2", "n3", "n4"};
+  std::vector<std::string> names = rom_names(directory);
+  for (const std::string &name : names) {
+    std::string path = std::string(directory) + "/" + name;
+    Platform::Program rom = Platform::load_program(path.c_str());
+    if (rom.size == 0) {
+      continue;
+    }
+    for (uint64_t ahead = 0; ahead <= 4; ahead++) {
+      uint64_t checksum = 0;
+      double seconds = best_time(frames, checksum, [&](uint64_t n) {
+        return run_host_frames(rom, ahead, n);
+      });
+      report("run_ahead", name, variants[ahead], frames, seconds, checksum);
+    }
+  }
+}
+
+int main(int argc, char **argv) {
+  const char *roms = "roms";
+  uint64_t instructions = 20000000;
+  uint64_t iterations = 4000000;
+
+  for (int i = 1; i < argc; i++) {
+    bool has_value = i + 1 < argc;
+    if (strcmp(argv[i], "--roms") == 0 && has_value) {
+      roms = argv[++i];
+    } else if (strcmp(argv[i], "--instructions") == 0 && has_value) {
+      instructions = strtoull(argv[++i], NULL, 10);
+    } else if (strcmp(argv[i], "--iterations") == 0 && has_value) {
+      iterations = strtoull(argv[++i], NULL, 10);
+    } else if (strcmp(argv[i], "--repeat") == 0 && has_value) {
+      repeat = strtoull(argv[++i], NULL, 10);
+    } else if (strcmp(argv[i], "--filter") == 0 && has_value) {
+      name_filter = argv[++i];
+    } else {
+      print_usage(argv[0]);
+      return 1;
+    }
+  }
+  if (repeat == 0) {
+    print_usage(argv[0]);
+    return 1;
+  }
+
+#ifdef POT8TO_HAS_JIT
+  if (!Pot8to::jit_create(jit)) {
+    fprintf(stderr, "Could not allocate executable memory for the JIT\n");
+    return 1;
+  }
+#endif
+
+  printf("kind,name,variant,iterations,ns_per_op,ops_per_second,checksum\n");
+  bench_decode(iterations);
+  bench_opcodes(iterations);
+  bench_dxyn(iterations);
+  bench_display_modes(iterations);
+  bench_initialize(iterations);
+  bench_reset_state(iterations);
+  bench_roms(roms, instructions);
+  // Run-ahead multiplies the frames run, a tenth of the instructions is
+  // plenty.
+  bench_run_ahead(roms, std::max<uint64_t>(instructions / 110, 1));
+
+#ifdef POT8TO_HAS_JIT
+  Pot8to::jit_destroy(jit);
+#endif
+  return 0;
+}
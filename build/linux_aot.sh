@@ -0,0 +1,22 @@
+# Recompiles every ROM in roms/ ahead of time (see pot8to_aot.cpp), builds
+# the Linux host and the benchmarks around the generated code, and checks
+# each ROM against the interpreter frame by frame with random input. Exits
+# non-zero on the first mismatch. Compare the speed with
+#   build/output/pot8to_aot_bench_linux --filter .ch8
+mkdir -p build/output
+g++ -std=c++11 -pthread -Wall -Wextra -O2 -DNDEBUG \
+-o build/output/aot_linux aot_linux.cpp || exit 1
+build/output/aot_linux build/output/aot_programs.cpp roms/*.ch8 || exit 1
+
+g++ \
+-std=c++11 -pthread -Wall -Wextra -O3 -DNDEBUG -DPOT8TO_AOT -I. -Ibuild/output \
+-o build/output/pot8to_aot_linux main_linux.cpp || exit 1
+g++ \
+-std=c++11 -pthread -Wall -Wextra -O3 -DNDEBUG -DPOT8TO_AOT -I. -Ibuild/output \
+-o build/output/pot8to_aot_bench_linux bench_linux.cpp || exit 1
+
+for rom in roms/*.ch8; do
+  build/output/pot8to_aot_linux "$rom" --aot --verify --frames 20000 \
+    --random-input 3 > /dev/null || exit 1
+done
+echo "Recompiled ROMs match the interpreter"
@@ -0,0 +1,8 @@
+# Builds the benchmark suite and runs it, CSV goes to stdout:
+#   sh build/linux_bench.sh > bench.csv
+# Arguments are passed on, e.g. --filter DXYN or --instructions 1000000.
+mkdir -p build/output
+g++ -std=c++11 -pthread -Wall -Wextra -O2 -DNDEBUG \
+-o build/output/pot8to_bench_linux bench_linux.cpp || exit 1
+
+build/output/pot8to_bench_linux "$@"
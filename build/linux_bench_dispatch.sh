@@ -0,0 +1,18 @@
+# Compares the switch and threaded interpreter cores on every bundled ROM.
+mkdir -p build/output
+g++ -std=c++11 -pthread -Wall -Wextra -O2 -DNDEBUG \
+-o build/output/pot8to_linux_switch main_linux.cpp
+g++ -std=c++11 -pthread -Wall -Wextra -O2 -DNDEBUG -DPOT8TO_THREADED_DISPATCH \
+-o build/output/pot8to_linux_threaded main_linux.cpp
+
+INSTRUCTIONS=${INSTRUCTIONS:-50000000}
+printf "%-45s %-9s %15s %18s\n" rom core instructions/s display_checksum
+for rom in roms/*.ch8; do
+  for core in switch threaded; do
+    build/output/pot8to_linux_$core "$rom" --instructions "$INSTRUCTIONS" |
+      awk -v rom="$(basename "$rom")" -v core=$core '
+        /^instructions_per_second/ { ips = $2 }
+        /^display_checksum/ { sum = $2 }
+        END { printf "%-45s %-9s %15s %18s\n", rom, core, ips, sum }'
+  done
+done
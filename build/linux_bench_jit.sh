@@ -0,0 +1,30 @@
+# Compares the JIT with the threaded interpreter on every bundled ROM, with
+# the ROM benchmarks of bench_linux.cpp built as is and with
+# POT8TO_NO_IDLE_SKIP, so loops run instead of being counted. Exits non-zero
+# if the JIT is slower than the threaded core on any of them.
+mkdir -p build/output
+g++ -std=c++11 -pthread -Wall -Wextra -O2 -DNDEBUG \
+-o build/output/pot8to_bench_linux bench_linux.cpp || exit 1
+g++ -std=c++11 -pthread -Wall -Wextra -O2 -DNDEBUG -DPOT8TO_NO_IDLE_SKIP \
+-o build/output/pot8to_bench_linux_no_idle_skip bench_linux.cpp || exit 1
+
+printf "%-45s %-13s %9s %9s %8s\n" rom build threaded jit speedup
+for build in idle_skip no_idle_skip; do
+  binary=build/output/pot8to_bench_linux
+  [ $build = no_idle_skip ] && binary=${binary}_no_idle_skip
+  $binary --filter .ch8 | grep '^rom,' | sed "s/^rom/$build/"
+done | awk -F, '
+  # Counted from the end, ROM names can have commas.
+  {
+    rom = $2
+    for (i = 3; i <= NF - 5; i++) { rom = rom "," $i }
+    key = $1 rom
+  }
+  $(NF - 4) == "threaded" { threaded[key] = $(NF - 2) }
+  $(NF - 4) == "jit" {
+    speedup = threaded[key] / $(NF - 2)
+    printf "%-45s %-13s %9.3f %9.3f %7.2fx\n", rom, $1, threaded[key],
+      $(NF - 2), speedup
+    if (speedup < 1) { slower++ }
+  }
+  END { exit slower > 0 }'
@@ -0,0 +1,4 @@
+mkdir -p build/output
+g++ \
+-std=c++11 -pthread -Wall -Wextra -g -DPOT8TO_CHECK_DECODE_CACHE \
+-o build/output/pot8to_dbg_linux main_linux.cpp
@@ -0,0 +1,27 @@
+# Builds the fuzz target, see fuzz_linux.cpp, and a seed corpus of every ROM
+# in roms/ with an empty input header. With clang it is a libFuzzer target,
+# run it with
+#   build/output/pot8to_fuzz_linux build/output/fuzz_corpus
+# g++ has no libFuzzer and gets the standalone driver, which is run here on
+# blind mutations of the corpus under AddressSanitizer and UBSan. Exits
+# non-zero if anything fails to build or the sanitizers find something.
+mkdir -p build/output/fuzz_corpus
+for rom in roms/*.ch8; do
+  { printf '\000\000'; cat "$rom"; } \
+    > "build/output/fuzz_corpus/$(basename "$rom")"
+done
+
+if command -v clang++ > /dev/null; then
+  clang++ \
+  -std=c++11 -Wall -Wextra -g -O1 -DPOT8TO_GUARD \
+  -fsanitize=fuzzer,address,undefined -fno-sanitize-recover=all \
+  -o build/output/pot8to_fuzz_linux fuzz_linux.cpp || exit 1
+  build/output/pot8to_fuzz_linux -runs=100000 build/output/fuzz_corpus || exit 1
+else
+  g++ \
+  -std=c++11 -Wall -Wextra -g -O1 -DPOT8TO_GUARD -DPOT8TO_FUZZ_STANDALONE \
+  -fsanitize=address,undefined -fno-sanitize-recover=all \
+  -o build/output/pot8to_fuzz_linux fuzz_linux.cpp || exit 1
+  build/output/pot8to_fuzz_linux --runs 100000 build/output/fuzz_corpus \
+    || exit 1
+fi
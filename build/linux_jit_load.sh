@@ -0,0 +1,32 @@
+# Checks that the JIT drops code translated from one program when a save
+# state swaps in another, all on --jit --verify. First two ROMs that are
+# nothing but a translatable loop, `6005 1200` and `6007 1200`, at 12
+# instructions a frame so the loop's block always fits and nothing is ever
+# interpreted. Then every ROM in roms/ with a state of the next one loaded
+# halfway. Exits non-zero on the first divergence.
+mkdir -p build/output
+g++ \
+-std=c++11 -pthread -Wall -Wextra -O2 -DNDEBUG \
+-o build/output/pot8to_linux main_linux.cpp || exit 1
+
+host=build/output/pot8to_linux
+out=build/output
+printf '\140\005\022\000' > $out/loop_a.ch8
+printf '\140\007\022\000' > $out/loop_b.ch8
+$host $out/loop_b.ch8 --frames 10 --save $out/loop_b.p8s > /dev/null || exit 1
+$host $out/loop_a.ch8 --jit --verify --ipf 12 --load $out/loop_b.p8s \
+  --load-frame 10 --frames 20 > /dev/null || exit 1
+
+previous=
+for rom in roms/*.ch8 "$(ls roms/*.ch8 | head -n 1)"; do
+  if [ -n "$previous" ]; then
+    $host "$rom" --frames 100 --save $out/jit_load.p8s > /dev/null || exit 1
+    $host "$previous" --jit --verify --random-input 5 --load $out/jit_load.p8s \
+      --load-frame 100 --frames 200 > /dev/null || {
+      echo "$previous with a state of $rom loaded"
+      exit 1
+    }
+  fi
+  previous=$rom
+done
+echo "The JIT followed every loaded state"
@@ -0,0 +1,6 @@
+# Interpreter and JIT with the profiler compiled in, see `Profile`.
+# Run with --profile FILE to get the JSON.
+mkdir -p build/output
+g++ \
+-std=c++11 -pthread -Wall -Wextra -O2 -DNDEBUG -DPOT8TO_PROFILE \
+-o build/output/pot8to_profile_linux main_linux.cpp
@@ -0,0 +1,31 @@
+# Checks behaviours that differ between quirk profiles on tiny ROMs written
+# here. DXY0 draws a 16x16 sprite under schip only, under the others it
+# draws nothing, so `A20A D000 1204` with sprite bytes at 0x20A must leave
+# the display as blank as `A20A 6000 1204` does. Exits non-zero on the first
+# mismatch.
+mkdir -p build/output
+g++ \
+-std=c++11 -pthread -Wall -Wextra -O2 -DNDEBUG \
+-o build/output/pot8to_linux main_linux.cpp || exit 1
+
+host=build/output/pot8to_linux
+out=build/output
+sprite='\377\377\377\377\377\377\377\377\377\377\377\377\377\377\377\377'
+printf "\242\012\320\000\022\004\000\000\000\000$sprite$sprite" > $out/dxy0.ch8
+printf "\242\012\140\000\022\004\000\000\000\000$sprite$sprite" > $out/blank.ch8
+
+checksum() {
+  $host "$@" --frames 2 | grep display_checksum
+}
+blank=$(checksum $out/blank.ch8) || exit 1
+for quirks in default vip chip48; do
+  if [ "$(checksum $out/dxy0.ch8 --quirks $quirks)" != "$blank" ]; then
+    echo "DXY0 drew something under --quirks $quirks"
+    exit 1
+  fi
+done
+if [ "$(checksum $out/dxy0.ch8 --quirks schip)" = "$blank" ]; then
+  echo "DXY0 drew nothing under --quirks schip"
+  exit 1
+fi
+echo "Every quirk profile drew DXY0 as it should"
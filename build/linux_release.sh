@@ -0,0 +1,4 @@
+mkdir -p build/output
+g++ \
+-std=c++11 -pthread -Wall -Wextra -O2 -DNDEBUG \
+-o build/output/pot8to_linux main_linux.cpp
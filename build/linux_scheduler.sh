@@ -0,0 +1,10 @@
+# Builds the scheduler check, see scheduler_linux.cpp, and runs it: the
+# scheduler on a simulated clock, checking frame sizes, catching up after a
+# stall and drift. Exits non-zero if any check fails.
+mkdir -p build/output
+g++ \
+-std=c++11 -Wall -Wextra -O2 -DNDEBUG \
+-o build/output/pot8to_scheduler_linux scheduler_linux.cpp || exit 1
+
+build/output/pot8to_scheduler_linux || exit 1
+echo "The scheduler kept time"
@@ -0,0 +1,32 @@
+# Builds the stream viewer (see pot8to_spectate.cpp) and watches two
+# seconds of every ROM in roms/ through it: the last frame the viewer
+# decodes has to match the host's, once live and once from the recorded
+# stream. Exits non-zero on the first mismatch.
+mkdir -p build/output
+g++ \
+-std=c++11 -pthread -Wall -Wextra -O2 -DNDEBUG \
+-o build/output/pot8to_linux main_linux.cpp || exit 1
+g++ \
+-std=c++11 -Wall -Wextra -O2 -DNDEBUG \
+-o build/output/viewer_linux viewer_linux.cpp || exit 1
+
+socket=build/output/spectate.sock
+for rom in roms/*.ch8; do
+  build/output/pot8to_linux "$rom" --realtime --frames 120 \
+    --random-input 5 --spectate $socket > build/output/spectate_host.txt &
+  host=$!
+  sleep 0.5
+  build/output/viewer_linux $socket --record build/output/spectate.p8ts \
+    > build/output/spectate_live.txt || exit 1
+  wait $host || exit 1
+  build/output/viewer_linux --file build/output/spectate.p8ts \
+    > build/output/spectate_file.txt || exit 1
+  expected=$(grep display_checksum build/output/spectate_host.txt)
+  for seen in build/output/spectate_live.txt build/output/spectate_file.txt; do
+    if [ "$(grep display_checksum $seen)" != "$expected" ]; then
+      echo "$rom: $seen doesn't end on the host's last frame"
+      exit 1
+    fi
+  done
+done
+echo "Viewers saw every ROM's last frame"
@@ -0,0 +1,25 @@
+# Builds the host with the tracer compiled in and tracediff_linux, then
+# traces two seconds of every ROM in roms/ on the interpreter and on the JIT:
+# the two traces have to match. Exits non-zero on the first difference.
+# Run with --trace FILE to write a trace.
+mkdir -p build/output
+g++ \
+-std=c++11 -pthread -Wall -Wextra -O2 -DNDEBUG -DPOT8TO_TRACE \
+-o build/output/pot8to_trace_linux main_linux.cpp || exit 1
+g++ \
+-std=c++11 -pthread -Wall -Wextra -O2 -DNDEBUG \
+-o build/output/tracediff_linux tracediff_linux.cpp || exit 1
+
+for rom in roms/*.ch8; do
+  build/output/pot8to_trace_linux "$rom" --frames 120 --random-input 5 \
+    --trace build/output/switch.p8tr > /dev/null || exit 1
+  build/output/pot8to_trace_linux "$rom" --frames 120 --random-input 5 --jit \
+    --trace build/output/jit.p8tr > /dev/null || exit 1
+  build/output/tracediff_linux build/output/switch.p8tr \
+    build/output/jit.p8tr > build/output/tracediff.txt || {
+    echo "$rom:"
+    cat build/output/tracediff.txt
+    exit 1
+  }
+done
+echo "Interpreter and JIT traces match for every ROM"
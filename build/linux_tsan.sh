@@ -0,0 +1,17 @@
+# Builds the Linux host with ThreadSanitizer and stress-tests everything
+# that crosses threads: the emulation thread against a renderer taking
+# frames as fast as it can while flipping keys, and the batch runner.
+# Exits non-zero on the first race report.
+mkdir -p build/output
+g++ \
+-std=c++11 -pthread -Wall -Wextra -g -O1 -fsanitize=thread \
+-o build/output/pot8to_tsan_linux main_linux.cpp || exit 1
+
+export TSAN_OPTIONS="halt_on_error=1 $TSAN_OPTIONS"
+for rom in roms/*.ch8; do
+  build/output/pot8to_tsan_linux "$rom" --threaded --frames 20000 \
+    --random-input 2 > /dev/null || exit 1
+  build/output/pot8to_tsan_linux "$rom" --instances 64 --frames 600 \
+    --threads 4 > /dev/null || exit 1
+done
+echo "No races found"
@@ -0,0 +1,367 @@
+// Fuzz target for the core, compatible with libFuzzer. Every input is a ROM
+// and the keys pressed while it runs:
+//   byte 0         quirk profile in the low 2 bits, see `QuirkProfile`
+//   byte 1         K, the number of key events
+//   2 * K bytes    events in order: the frame, then the key in the low
+//                  nibble, held down if bit 4 is set and released if not
+//   the rest       the ROM, at most POT8TO_PROGRAM_MEMORY bytes of it
+// An event whose frame has passed applies right away. Each input runs for
+// POT8TO_FUZZ_FRAMES frames, or until an unknown instruction or a fault.
+//
+// Only builds with POT8TO_GUARD, random ROMs run off the end of memory and
+// the stack all the time. Faults end the input, with
+// POT8TO_FUZZ_ABORT_ON_FAULT they abort() so the fuzzer keeps the ROM.
+// Inputs start from one `State` initialized up front, copied back with
+// `reset_state`, and the ROM goes straight into its memory.
+//
+//   clang++ -fsanitize=fuzzer,address,undefined -DPOT8TO_GUARD fuzz_linux.cpp
+//
+// Compilers without libFuzzer build with POT8TO_FUZZ_STANDALONE for a main()
+// that runs inputs from files, or mutates them blindly for --runs inputs.
+// See build/linux_fuzz.sh.
+#include "platform.h"
+#include "platform_linux.cpp"
+#include "pot8to.cpp"
+#include <stdlib.h>
+
+#ifndef POT8TO_GUARD
+#error "Build the fuzz target with -DPOT8TO_GUARD"
+#endif
+
+constexpr size_t POT8TO_FUZZ_HEADER_SIZE = 2;
+constexpr uint64_t POT8TO_FUZZ_FRAMES = 64;
+constexpr size_t POT8TO_FUZZ_INSTRUCTIONS_PER_FRAME = 32;
+
+struct FuzzInput {
+  Pot8to::QuirkProfile profile;
+  const uint8_t *events;
+  size_t event_count;
+  const uint8_t *rom;
+  size_t rom_size;
+};
+
+static bool fuzz_parse(const uint8_t *data, size_t size, FuzzInput &input) {
+  if (size < POT8TO_FUZZ_HEADER_SIZE) {
+    return false;
+  }
+  input.profile = (Pot8to::QuirkProfile)(data[0] & 3);
+  input.events = data + POT8TO_FUZZ_HEADER_SIZE;
+  input.event_count = data[1];
+  if (input.event_count > (size - POT8TO_FUZZ_HEADER_SIZE) / 2) {
+    input.event_count = (size - POT8TO_FUZZ_HEADER_SIZE) / 2;
+  }
+  input.rom = input.events + 2 * input.event_count;
+  input.rom_size = size - (size_t)(input.rom - data);
+  if (input.rom_size > POT8TO_PROGRAM_MEMORY) {
+    input.rom_size = POT8TO_PROGRAM_MEMORY;
+  }
+  return true;
+}
+
+// What every input starts from, and where it runs.
+static Pot8to::State fuzz_initial;
+static Pot8to::State fuzz_state;
+static bool fuzz_ready = false;
+// Inputs run and how many ended in each `Fault`.
+static uint64_t fuzz_inputs = 0;
+static uint64_t fuzz_faults[Pot8to::FAULT_PC + 1];
+
+static const char *const fault_names[] = {"none", "memory", "stack_overflow",
+                                          "stack_underflow", "pc"};
+
+static void fuzz_setup() {
+  Platform::Program empty = {};
+  fuzz_initial = Pot8to::initialize(empty);
+  fuzz_ready = true;
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+  FuzzInput input;
+  if (!fuzz_parse(data, size, input)) {
+    return 0;
+  }
+  if (!fuzz_ready) {
+    fuzz_setup();
+  }
+  Pot8to::State &state = fuzz_state;
+  Pot8to::reset_state(state, fuzz_initial);
+  memcpy(state.memory + POT8TO_PROGRAM_MEMORY_INITIAL_POSITION, input.rom,
+         input.rom_size);
+  Pot8to::RunFunction run = Pot8to::select_run(input.profile);
+  fuzz_inputs++;
+
+  size_t event = 0;
+  for (uint64_t frame = 0; frame < POT8TO_FUZZ_FRAMES; frame++) {
+    for (; event < input.event_count && input.events[2 * event] <= frame;
+         event++) {
+      uint8_t key = input.events[2 * event + 1];
+      Pot8to::set_key(state, key & 0xF, (key & 0x10) != 0);
+    }
+    size_t budget = POT8TO_FUZZ_INSTRUCTIONS_PER_FRAME;
+    while (budget > 0) {
+      Pot8to::RunResult result = run(state, budget);
+      if (result.executed > budget) {
+        fprintf(stderr, "A run went %zu instructions over its budget\n",
+                result.executed - budget);
+        abort();
+      }
+      budget -= result.executed;
+      if (result.reason == Pot8to::STOP_FAULT) {
+        fuzz_faults[state.fault]++;
+#ifdef POT8TO_FUZZ_ABORT_ON_FAULT
+        fprintf(stderr, "Fault: %s at PC %03x\n", fault_names[state.fault],
+                state.registers.PC);
+        abort();
+#endif
+        return 0;
+      }
+      if (result.reason == Pot8to::STOP_UNKNOWN_INSTRUCTION) {
+        return 0;
+      }
+    }
+    Pot8to::decrement_timers(state);
+    if (Pot8to::idle_until_input(state)) {
+      // Nothing changes before the next key event, jump right to it.
+      uint64_t next = event < input.event_count ? input.events[2 * event]
+                                                : POT8TO_FUZZ_FRAMES;
+      uint64_t frames = next > frame + 1 ? next - frame - 1 : 0;
+      if (frames > POT8TO_FUZZ_FRAMES - frame - 1) {
+        frames = POT8TO_FUZZ_FRAMES - frame - 1;
+      }
+      size_t left = (size_t)Pot8to::skip_idle_frames(
+          state, frames, POT8TO_FUZZ_INSTRUCTIONS_PER_FRAME);
+      while (left > 0) {
+        left -= run(state, left).executed;
+      }
+      frame += frames;
+    }
+  }
+  return 0;
+}
+
+static uint32_t fuzz_random(uint32_t &rng) {
+  rng ^= rng << 13;
+  rng ^= rng >> 17;
+  rng ^= rng << 5;
+  return rng;
+}
+
+#ifdef POT8TO_FUZZ_STANDALONE
+// Stands in for libFuzzer's byte-level mutations: sets, flips, inserts or
+// erases one byte.
+static size_t fuzz_mutate_bytes(uint8_t *data, size_t size, size_t max_size,
+                                uint32_t &rng) {
+  size_t at = size > 0 ? fuzz_random(rng) % size : 0;
+  switch (fuzz_random(rng) % 4) {
+  case 0:
+    if (size > 0) {
+      data[at] = (uint8_t)fuzz_random(rng);
+      return size;
+    }
+    break;
+  case 1:
+    if (size > 0) {
+      data[at] ^= (uint8_t)(1u << (fuzz_random(rng) % 8));
+      return size;
+    }
+    break;
+  case 2:
+    if (size > 1) {
+      memmove(data + at, data + at + 1, size - at - 1);
+      return size - 1;
+    }
+    break;
+  default:
+    break;
+  }
+  if (size >= max_size) {
+    return size;
+  }
+  memmove(data + at + 1, data + at, size - at);
+  data[at] = (uint8_t)fuzz_random(rng);
+  return size + 1;
+}
+#else
+extern "C" size_t LLVMFuzzerMutate(uint8_t *data, size_t size,
+                                   size_t max_size);
+
+static size_t fuzz_mutate_bytes(uint8_t *data, size_t size, size_t max_size,
+                                uint32_t &) {
+  return LLVMFuzzerMutate(data, size, max_size);
+}
+#endif
+
+// One of each instruction with the bits that vary, so mutations write code
+// that decodes instead of mostly unknown instructions.
+static const uint16_t opcode_templates[][2] = {
+    {0x00E0, 0x0000}, {0x00EE, 0x0000}, {0x1000, 0x0FFF}, {0x2000, 0x0FFF},
+    {0x3000, 0x0FFF}, {0x4000, 0x0FFF}, {0x5000, 0x0FF0}, {0x6000, 0x0FFF},
+    {0x7000, 0x0FFF}, {0x8000, 0x0FF0}, {0x8001, 0x0FF0}, {0x8002, 0x0FF0},
+    {0x8003, 0x0FF0}, {0x8004, 0x0FF0}, {0x8005, 0x0FF0}, {0x8006, 0x0FF0},
+    {0x8007, 0x0FF0}, {0x800E, 0x0FF0}, {0x9000, 0x0FF0}, {0xA000, 0x0FFF},
+    {0xB000, 0x0FFF}, {0xC000, 0x0FFF}, {0xD000, 0x0FFF}, {0xE09E, 0x0F00},
+    {0xE0A1, 0x0F00}, {0xF007, 0x0F00}, {0xF00A, 0x0F00}, {0xF015, 0x0F00},
+    {0xF018, 0x0F00}, {0xF01E, 0x0F00}, {0xF029, 0x0F00}, {0xF033, 0x0F00},
+    {0xF055, 0x0F00}, {0xF065, 0x0F00}, {0x00C0, 0x000F}, {0x00FB, 0x0000},
+    {0x00FC, 0x0000}, {0x00FD, 0x0000}, {0x00FE, 0x0000}, {0x00FF, 0x0000},
+    {0xF030, 0x0F00}, {0xF075, 0x0F00}, {0xF085, 0x0F00}, {0x00D0, 0x000F},
+    {0xF001, 0x0F00}};
+
+// Half the time a byte-level mutation, the other half one whole instruction
+// written over an even offset of the ROM or appended to it. Jumps and calls
+// mostly land on the ROM's own instructions.
+extern "C" size_t LLVMFuzzerCustomMutator(uint8_t *data, size_t size,
+                                          size_t max_size, unsigned int seed) {
+  uint32_t rng = seed != 0 ? seed : POT8TO_DEFAULT_SEED;
+  FuzzInput input;
+  if (!fuzz_parse(data, size, input) || (fuzz_random(rng) & 1) != 0) {
+    return fuzz_mutate_bytes(data, size, max_size, rng);
+  }
+  size_t at = 2 * (fuzz_random(rng) % (input.rom_size / 2 + 1));
+  size_t offset = (size_t)(input.rom - data) + at;
+  if (offset + 2 > max_size || at + 2 > POT8TO_PROGRAM_MEMORY) {
+    return fuzz_mutate_bytes(data, size, max_size, rng);
+  }
+  const uint16_t *pick =
+      opcode_templates[fuzz_random(rng) % (sizeof(opcode_templates) /
+                                           sizeof(opcode_templates[0]))];
+  uint16_t opcode = (uint16_t)(pick[0] | (fuzz_random(rng) & pick[1]));
+  uint16_t kind = opcode & 0xF000;
+  if ((kind == 0x1000 || kind == 0x2000 || kind == 0xB000) &&
+      input.rom_size >= 2 && (fuzz_random(rng) & 3) != 0) {
+    size_t target = 2 * (fuzz_random(rng) % (input.rom_size / 2));
+    opcode =
+        (uint16_t)(kind | (POT8TO_PROGRAM_MEMORY_INITIAL_POSITION + target));
+  }
+  data[offset] = (uint8_t)(opcode >> 8);
+  data[offset + 1] = (uint8_t)opcode;
+  return offset + 2 > size ? offset + 2 : size;
+}
+
+#ifdef POT8TO_FUZZ_STANDALONE
+#include <dirent.h>
+#include <string>
+#include <sys/stat.h>
+#include <time.h>
+#include <vector>
+
+static void print_usage(const char *program) {
+  fprintf(stderr,
+          "usage: %s [options] <input or directory>...\n"
+          "  --runs N    mutate the inputs into N new ones (default: run\n"
+          "              each input once)\n"
+          "  --seed N    seed for the mutations (default 1)\n"
+          "  --max-len N largest mutated input in bytes (default 4096)\n",
+          program);
+}
+
+static bool read_input(const std::string &path,
+                       std::vector<std::vector<uint8_t>> &inputs) {
+  FILE *file = fopen(path.c_str(), "rb");
+  if (file == NULL) {
+    fprintf(stderr, "Could not open '%s'\n", path.c_str());
+    return false;
+  }
+  std::vector<uint8_t> bytes;
+  uint8_t chunk[4096];
+  size_t read;
+  while ((read = fread(chunk, 1, sizeof(chunk), file)) > 0) {
+    bytes.insert(bytes.end(), chunk, chunk + read);
+  }
+  fclose(file);
+  inputs.push_back(bytes);
+  return true;
+}
+
+static bool read_inputs(const char *path,
+                        std::vector<std::vector<uint8_t>> &inputs) {
+  struct stat info;
+  if (stat(path, &info) != 0 || !S_ISDIR(info.st_mode)) {
+    return read_input(path, inputs);
+  }
+  DIR *dir = opendir(path);
+  if (dir == NULL) {
+    fprintf(stderr, "Could not open '%s'\n", path);
+    return false;
+  }
+  while (dirent *entry = readdir(dir)) {
+    if (entry->d_name[0] != '.' &&
+        !read_input(std::string(path) + "/" + entry->d_name, inputs)) {
+      closedir(dir);
+      return false;
+    }
+  }
+  closedir(dir);
+  return true;
+}
+
+static double seconds_now() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv) {
+  uint64_t runs = 0;
+  uint32_t seed = 1;
+  size_t max_len = 4096;
+  std::vector<std::vector<uint8_t>> inputs;
+  for (int i = 1; i < argc; i++) {
+    bool has_value = i + 1 < argc;
+    if (strcmp(argv[i], "--runs") == 0 && has_value) {
+      runs = strtoull(argv[++i], NULL, 10);
+    } else if (strcmp(argv[i], "--seed") == 0 && has_value) {
+      seed = (uint32_t)strtoul(argv[++i], NULL, 10);
+    } else if (strcmp(argv[i], "--max-len") == 0 && has_value) {
+      max_len = strtoull(argv[++i], NULL, 10);
+    } else if (argv[i][0] == '-') {
+      print_usage(argv[0]);
+      return 1;
+    } else if (!read_inputs(argv[i], inputs)) {
+      return 1;
+    }
+  }
+  if (max_len < POT8TO_FUZZ_HEADER_SIZE) {
+    print_usage(argv[0]);
+    return 1;
+  }
+  if (inputs.empty()) {
+    inputs.push_back(std::vector<uint8_t>(POT8TO_FUZZ_HEADER_SIZE, 0));
+  }
+
+  double start = seconds_now();
+  if (runs == 0) {
+    for (const std::vector<uint8_t> &input : inputs) {
+      LLVMFuzzerTestOneInput(input.data(), input.size());
+    }
+  } else {
+    // No coverage to go by: every run mutates a copy of one of the inputs,
+    // a few mutations deep.
+    uint32_t rng = seed != 0 ? seed : POT8TO_DEFAULT_SEED;
+    std::vector<uint8_t> buffer(max_len);
+    for (uint64_t run = 0; run < runs; run++) {
+      const std::vector<uint8_t> &input =
+          inputs[fuzz_random(rng) % inputs.size()];
+      size_t size = input.size() < max_len ? input.size() : max_len;
+      memcpy(buffer.data(), input.data(), size);
+      for (uint32_t n = 1 + fuzz_random(rng) % 8; n > 0; n--) {
+        size = LLVMFuzzerCustomMutator(buffer.data(), size, max_len,
+                                       fuzz_random(rng));
+      }
+      LLVMFuzzerTestOneInput(buffer.data(), size);
+    }
+  }
+  double elapsed = seconds_now() - start;
+
+  printf("inputs: %llu\n", (unsigned long long)fuzz_inputs);
+  printf("seconds: %.6f\n", elapsed);
+  printf("executions_per_second: %.0f\n",
+         elapsed > 0 ? fuzz_inputs / elapsed : 0.0);
+  for (size_t fault = Pot8to::FAULT_MEMORY; fault <= Pot8to::FAULT_PC;
+       fault++) {
+    printf("faults_%s: %llu\n", fault_names[fault],
+           (unsigned long long)fuzz_faults[fault]);
+  }
+  return 0;
+}
+#endif
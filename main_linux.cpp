@@ -0,0 +1,964 @@
+#include "platform.h"
+#include "platform_linux.cpp"
+#include "pot8to.cpp"
+#include "pot8to_audio.cpp"
+#include "pot8to_batch.cpp"
+#include "pot8to_jit_x64.cpp"
+#include "pot8to_lanes.cpp"
+#include "pot8to_profile.cpp"
+#include "pot8to_record.cpp"
+#include "pot8to_runahead.cpp"
+#include "pot8to_runner.cpp"
+#include "pot8to_savestate.cpp"
+#include "pot8to_scheduler.cpp"
+#include "pot8to_spectate.cpp"
+#include "pot8to_trace.cpp"
+#ifdef POT8TO_AOT
+// Written by aot_linux, see build/linux_aot.sh.
+#include "aot_programs.cpp"
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static void print_usage(const char *program) {
+  fprintf(stderr,
+          "usage: %s <rom.ch8> [options]\n"
+          "  --instructions N  stop after N instructions\n"
+          "  --frames N        stop after N frames (default 600)\n"
+          "  --ipf N           instructions per frame (default 11)\n"
+          "  --jit             run on the x86-64 recompiler\n"
+          "  --aot             run the ROM's ahead-of-time recompiled code\n"
+          "                    (builds with -DPOT8TO_AOT only)\n"
+          "  --verify          check every frame against the interpreter\n"
+          "  --dump            print the final display\n"
+          "  --instances N     run N copies of the ROM as a batch\n"
+          "  --threads N       batch worker threads (default: all cores)\n"
+          "  --lanes           run 16 copies in lockstep, copy N holds key N\n"
+          "  --load FILE       start from a save state\n"
+          "  --load-frame N    load it after N frames of the ROM instead\n"
+          "  --save FILE       write a save state at the end\n"
+          "  --rewind N        keep N frames of rewind, then step back\n"
+          "                    through all of them checking each frame\n"
+          "  --seed N          seed for CXNN (default 0x2545F491)\n"
+          "  --random-input N  press or release a random key every N frames\n"
+          "  --record FILE     write the seed and key changes to FILE\n"
+          "  --replay FILE     rerun a recording as fast as possible\n"
+          "  --wav FILE        write the sound as a WAV file\n"
+          "  --realtime        run at 60 frames per second, like the\n"
+          "                    windowed hosts\n"
+          "  --threaded        run on an emulation thread and present its\n"
+          "                    frames from this one, like the macOS host\n"
+          "  --run-ahead N     present every frame as it will be N frames\n"
+          "                    later with the keys held as they are\n"
+          "  --quirks NAME     default, vip, chip48 or schip\n"
+          "  --profile FILE    write an opcode and PC profile as JSON\n"
+          "                    (builds with -DPOT8TO_PROFILE only)\n"
+          "  --trace FILE      write every instruction to FILE, compare two\n"
+          "                    with tracediff_linux (builds with\n"
+          "                    -DPOT8TO_TRACE only)\n"
+          "  --spectate PATH   serve every frame to viewers connecting to a\n"
+          "                    Unix socket at PATH, see viewer_linux\n",
+          program);
+}
+
+static double seconds_now() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// The scheduler's clock for --realtime.
+static double clock_now(void *) { return seconds_now(); }
+
+static void clock_sleep(void *, double seconds) {
+  timespec ts;
+  ts.tv_sec = (time_t)seconds;
+  ts.tv_nsec = (long)((seconds - ts.tv_sec) * 1e9);
+  nanosleep(&ts, NULL);
+}
+
+#ifdef POT8TO_HAS_JIT
+static Pot8to::Jit jit;
+#endif
+
+// Interpreter core for the quirk profile picked on the command line.
+static Pot8to::RunFunction run_core = Pot8to::select_run(Pot8to::QUIRKS_DEFAULT);
+
+static bool parse_quirks(const char *name, Pot8to::QuirkProfile &profile) {
+  static const struct {
+    const char *name;
+    Pot8to::QuirkProfile profile;
+  } names[] = {{"default", Pot8to::QUIRKS_DEFAULT},
+               {"vip", Pot8to::QUIRKS_COSMAC_VIP},
+               {"chip48", Pot8to::QUIRKS_CHIP48},
+               {"schip", Pot8to::QUIRKS_SUPER_CHIP}};
+  for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+    if (strcmp(name, names[i].name) == 0) {
+      profile = names[i].profile;
+      return true;
+    }
+  }
+  return false;
+}
+
+#ifdef POT8TO_PROFILE
+static Pot8to::Profile profile;
+#endif
+
+// Spends the whole frame budget, which starts at instruction `now`. Headless
+// there is nothing to react to, so every early stop goes straight back into
+// the core after being counted. A replay's key changes land between runs.
+static void run_frame(Pot8to::State &emu, uint64_t now, size_t budget,
+                      bool use_jit, Pot8to::Replay *replay, uint64_t stops[]) {
+  while (budget > 0) {
+    size_t chunk = budget;
+    if (replay != NULL) {
+      uint64_t until = Pot8to::replay_advance(*replay, emu, now);
+      if (until > 0 && until < chunk) {
+        chunk = until;
+      }
+    }
+#ifdef POT8TO_HAS_JIT
+    Pot8to::RunResult result =
+        use_jit ? Pot8to::jit_run(jit, emu, chunk) : run_core(emu, chunk);
+#else
+    (void)use_jit;
+    Pot8to::RunResult result = run_core(emu, chunk);
+#endif
+    stops[result.reason]++;
+    budget -= result.executed;
+    now += result.executed;
+  }
+}
+
+static bool read_file(const char *path, std::vector<uint8_t> &data) {
+  FILE *file = fopen(path, "rb");
+  if (file == NULL) {
+    fprintf(stderr, "Could not open '%s'\n", path);
+    return false;
+  }
+  uint8_t chunk[4096];
+  size_t size;
+  while ((size = fread(chunk, 1, sizeof(chunk), file)) > 0) {
+    data.insert(data.end(), chunk, chunk + size);
+  }
+  fclose(file);
+  return true;
+}
+
+static bool write_file(const char *path, const uint8_t *data, size_t size) {
+  FILE *file = fopen(path, "wb");
+  if (file == NULL || fwrite(data, 1, size, file) != size) {
+    fprintf(stderr, "Could not write '%s'\n", path);
+    if (file != NULL) {
+      fclose(file);
+    }
+    return false;
+  }
+  fclose(file);
+  return true;
+}
+
+// Batch mode: every instance runs the same number of frames and only the
+// aggregate numbers are printed.
+static int run_batch_mode(const char *rom_path, const Platform::Program &rom,
+                          uint64_t instances, uint64_t threads,
+                          uint64_t frames, uint64_t instructions_per_frame) {
+  Pot8to::BatchJob job = {&rom, 0, POT8TO_DEFAULT_SEED};
+  std::vector<Pot8to::BatchJob> jobs(instances, job);
+  Pot8to::BatchConfig config = {frames, instructions_per_frame, threads};
+
+  double start = seconds_now();
+  std::vector<Pot8to::BatchResult> results = Pot8to::run_batch(jobs, config);
+  double elapsed = seconds_now() - start;
+
+  uint64_t instructions = 0;
+  uint64_t unknown_stops = 0;
+  uint64_t mismatched = 0;
+  for (size_t i = 0; i < results.size(); i++) {
+    instructions += results[i].instructions;
+    if (results[i].stop_reason == Pot8to::STOP_UNKNOWN_INSTRUCTION) {
+      unknown_stops++;
+    }
+    if (results[i].display_hash != results[0].display_hash) {
+      mismatched++;
+    }
+  }
+
+  printf("rom: %s\n", rom_path);
+  printf("instances: %llu\n", (unsigned long long)instances);
+  printf("frames: %llu\n", (unsigned long long)frames);
+  printf("instructions: %llu\n", (unsigned long long)instructions);
+  printf("seconds: %.6f\n", elapsed);
+  printf("instructions_per_second: %.0f\n",
+         elapsed > 0 ? instructions / elapsed : 0.0);
+  printf("instances_per_second: %.0f\n",
+         elapsed > 0 ? instances / elapsed : 0.0);
+  printf("unknown_instruction_stops: %llu\n",
+         (unsigned long long)unknown_stops);
+  printf("checksum_mismatches: %llu\n", (unsigned long long)mismatched);
+  if (!results.empty()) {
+    printf("display_checksum: %016llx\n",
+           (unsigned long long)results[0].display_hash);
+  }
+  return 0;
+}
+
+// Lanes mode: one lane-parallel group. With --verify every lane is replayed
+// on the switch interpreter and compared after each frame.
+static int run_lanes_mode(const char *rom_path, const Platform::Program &rom,
+                          uint64_t frames, uint64_t instructions_per_frame,
+                          bool verify) {
+  static Pot8to::Lanes lanes;
+  Pot8to::lanes_initialize(lanes, rom);
+  std::vector<Pot8to::State> reference;
+  for (size_t lane = 0; lane < Pot8to::POT8TO_LANES; lane++) {
+    Pot8to::lanes_set_keys(lanes, lane, (uint16_t)(1u << lane));
+    if (verify) {
+      reference.push_back(Pot8to::initialize(rom));
+      Pot8to::press_key(reference.back(), (uint8_t)lane);
+    }
+  }
+
+  uint64_t instructions = 0;
+  uint64_t waited = 0;
+  uint64_t steps = 0;
+  double start = seconds_now();
+  for (uint64_t frame = 0; frame < frames; frame++) {
+    Pot8to::LanesRunResult result =
+        Pot8to::run_lanes(lanes, instructions_per_frame);
+    instructions += result.executed;
+    waited += result.waited;
+    steps += result.steps;
+    Pot8to::lanes_decrement_timers(lanes);
+
+    for (size_t lane = 0; lane < reference.size(); lane++) {
+      size_t left = instructions_per_frame;
+      while (left > 0) {
+        left -= Pot8to::run_switch(reference[lane], left).executed;
+      }
+      Pot8to::decrement_timers(reference[lane]);
+      Pot8to::State state = Pot8to::lanes_extract(lanes, lane);
+      if (!Pot8to::same_emulated_state(state, reference[lane])) {
+        fprintf(stderr, "Lane %zu diverged from the interpreter in frame "
+                "%llu\n", lane, (unsigned long long)frame);
+        return 2;
+      }
+    }
+  }
+  double elapsed = seconds_now() - start;
+
+  printf("rom: %s\n", rom_path);
+  printf("lanes: %zu\n", Pot8to::POT8TO_LANES);
+  printf("frames: %llu\n", (unsigned long long)frames);
+  printf("instructions: %llu\n", (unsigned long long)instructions);
+  printf("seconds: %.6f\n", elapsed);
+  printf("instructions_per_second: %.0f\n",
+         elapsed > 0 ? instructions / elapsed : 0.0);
+  // Waiting lanes count as running, like in the other cores, but not for
+  // how full the group steps were.
+  printf("lane_utilization: %.3f\n",
+         steps > 0 ? (double)(instructions - waited) /
+                         (steps * Pot8to::POT8TO_LANES)
+                   : 0.0);
+  printf("lanes_with_unknown_instructions: %zu\n",
+         Pot8to::lane_count(lanes.unknown));
+  printf("display_checksum: %016llx\n",
+         (unsigned long long)Pot8to::display_hash(
+             Pot8to::lanes_extract(lanes, 0)));
+  return 0;
+}
+
+static bool read_save_state(const char *path, Pot8to::State &emu) {
+  std::vector<uint8_t> data;
+  if (!read_file(path, data)) {
+    return false;
+  }
+  if (!Pot8to::load_state(emu, data.data(), data.size())) {
+    fprintf(stderr, "'%s' is not a save state of version %u\n", path,
+            (unsigned)Pot8to::POT8TO_SAVE_STATE_VERSION);
+    return false;
+  }
+  return true;
+}
+
+// The run's sound goes through a ring like an interactive host's would, it
+// is drained into `samples` after every frame.
+static Pot8to::AudioRing audio_ring;
+
+static bool write_wav(const char *path, const std::vector<int16_t> &samples) {
+  std::vector<uint8_t> data(Pot8to::POT8TO_WAV_HEADER_SIZE);
+  Pot8to::wav_header(data.data(), samples.size());
+  for (size_t i = 0; i < samples.size(); i++) {
+    data.push_back((uint8_t)samples[i]);
+    data.push_back((uint8_t)((uint16_t)samples[i] >> 8));
+  }
+  return write_file(path, data.data(), data.size());
+}
+
+static bool write_save_state(const char *path, const Pot8to::State &emu) {
+  uint8_t data[Pot8to::POT8TO_SAVE_STATE_MAX_SIZE];
+  size_t size = Pot8to::save_state(emu, data, sizeof(data));
+  return write_file(path, data, size);
+}
+
+// One character per pixel at the current resolution: '.' for the
+// background, '#' for plane 0 alone, then '+' for plane 1 and '@' for both.
+static void dump_display(const Pot8to::State &emu) {
+  static uint8_t pixels[POT8TO_HIRES_DISPLAY_WIDTH *
+                        POT8TO_HIRES_DISPLAY_HEIGHT];
+  Pot8to::unpack_display(emu, pixels);
+  size_t width = Pot8to::display_width(emu);
+  size_t height = Pot8to::display_height(emu);
+  for (size_t y = 0; y < height; y++) {
+    for (size_t x = 0; x < width; x++) {
+      putchar(".#+@"[pixels[y * width + x]]);
+    }
+    putchar('\n');
+  }
+}
+
+static void print_spectate_stats(const Pot8to::SpectateServer &server) {
+  printf("spectators: %llu\n", (unsigned long long)server.connections);
+  printf("spectator_frames_dropped: %llu\n",
+         (unsigned long long)server.dropped);
+}
+
+// Threaded mode: the runner emulates on its own thread while this one
+// presents every frame it can get, the way a windowed host would. With
+// --random-input keys change per presented frame, so those runs depend on
+// thread timing.
+static int run_threaded_mode(const char *rom_path, const Pot8to::State &emu,
+                             uint64_t frames, uint64_t instructions_per_frame,
+                             bool realtime, uint64_t random_input, bool dump,
+                             Pot8to::SpectateServer *spectate) {
+  static Pot8to::Runner runner;
+  runner.state = emu;
+  Pot8to::RunnerConfig config = {};
+  config.core = run_core;
+  config.schedule.instructions_per_second =
+      (uint32_t)(instructions_per_frame * 60);
+  config.schedule.frames_per_second = 60;
+  config.schedule.max_catch_up_frames = 4;
+  if (realtime) {
+    config.clock.now = clock_now;
+    config.clock.sleep = clock_sleep;
+  }
+  config.frames = frames;
+
+  Platform::Context ctx = {};
+  uint32_t input_rng = POT8TO_DEFAULT_SEED ^ 0x9E3779B9;
+  uint64_t presented = 0;
+  double start = seconds_now();
+  Pot8to::runner_start(runner, config);
+  bool finished = false;
+  while (!finished) {
+    // Read before taking the frame, so the last one isn't missed.
+    finished = runner.finished.load(std::memory_order_acquire);
+    uint64_t rows;
+    const Pot8to::DisplaySnapshot &snapshot =
+        Pot8to::triple_buffer_take(runner.display, rows);
+    if (rows == 0) {
+      std::this_thread::yield();
+      continue;
+    }
+    Platform::render_display(ctx, Pot8to::snapshot_frame(snapshot), rows);
+    if (spectate != NULL) {
+      Pot8to::spectate_publish(*spectate, snapshot.display, snapshot.hires,
+                               snapshot.frame);
+    }
+    if (random_input > 0 && ++presented % random_input == 0) {
+      uint8_t key = Pot8to::next_random(input_rng) & 0xF;
+      bool down = (runner.keys.load(std::memory_order_relaxed) >> key) & 1;
+      Pot8to::runner_set_key(runner, key, !down);
+    }
+  }
+  Pot8to::runner_join(runner);
+  double elapsed = seconds_now() - start;
+
+  if (dump) {
+    dump_display(runner.state);
+  }
+  uint64_t instructions = frames * instructions_per_frame;
+  printf("rom: %s\n", rom_path);
+  printf("instructions: %llu\n", (unsigned long long)instructions);
+  printf("frames: %llu\n", (unsigned long long)frames);
+  printf("seconds: %.6f\n", elapsed);
+  printf("instructions_per_second: %.0f\n",
+         elapsed > 0 ? instructions / elapsed : 0.0);
+  printf("frames_presented: %llu\n",
+         (unsigned long long)ctx.frames_presented);
+  printf("rows_presented: %llu\n", (unsigned long long)ctx.rows_presented);
+  printf("display_checksum: %016llx\n",
+         (unsigned long long)Pot8to::display_hash(runner.state));
+  if (spectate != NULL) {
+    print_spectate_stats(*spectate);
+  }
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  const char *rom_path = NULL;
+  uint64_t max_instructions = UINT64_MAX;
+  uint64_t max_frames = UINT64_MAX;
+  uint64_t instructions_per_frame = 11; // ~660 instructions per second
+  bool dump = false;
+  bool use_jit = false;
+  bool use_aot = false;
+  bool verify = false;
+  bool realtime = false;
+  bool threaded = false;
+  const char *wav_path = NULL;
+  uint64_t instances = 0;
+  uint64_t threads = 0;
+  bool lanes = false;
+  const char *load_path = NULL;
+  uint64_t load_frame = 0;
+  const char *save_path = NULL;
+  uint64_t rewind_frames = 0;
+  uint32_t seed = POT8TO_DEFAULT_SEED;
+  uint64_t random_input = 0;
+  const char *record_path = NULL;
+  const char *replay_path = NULL;
+  const char *profile_path = NULL;
+  const char *spectate_path = NULL;
+  const char *trace_path = NULL;
+  uint64_t run_ahead_frames = 0;
+  Pot8to::QuirkProfile quirks = Pot8to::QUIRKS_DEFAULT;
+
+  for (int i = 1; i < argc; i++) {
+    bool has_value = i + 1 < argc;
+    if (strcmp(argv[i], "--instructions") == 0 && has_value) {
+      max_instructions = strtoull(argv[++i], NULL, 10);
+    } else if (strcmp(argv[i], "--frames") == 0 && has_value) {
+      max_frames = strtoull(argv[++i], NULL, 10);
+    } else if (strcmp(argv[i], "--ipf") == 0 && has_value) {
+      instructions_per_frame = strtoull(argv[++i], NULL, 10);
+    } else if (strcmp(argv[i], "--jit") == 0) {
+      use_jit = true;
+    } else if (strcmp(argv[i], "--aot") == 0) {
+      use_aot = true;
+    } else if (strcmp(argv[i], "--verify") == 0) {
+      verify = true;
+    } else if (strcmp(argv[i], "--dump") == 0) {
+      dump = true;
+    } else if (strcmp(argv[i], "--instances") == 0 && has_value) {
+      instances = strtoull(argv[++i], NULL, 10);
+    } else if (strcmp(argv[i], "--threads") == 0 && has_value) {
+      threads = strtoull(argv[++i], NULL, 10);
+    } else if (strcmp(argv[i], "--lanes") == 0) {
+      lanes = true;
+    } else if (strcmp(argv[i], "--load") == 0 && has_value) {
+      load_path = argv[++i];
+    } else if (strcmp(argv[i], "--load-frame") == 0 && has_value) {
+      load_frame = strtoull(argv[++i], NULL, 10);
+    } else if (strcmp(argv[i], "--save") == 0 && has_value) {
+      save_path = argv[++i];
+    } else if (strcmp(argv[i], "--rewind") == 0 && has_value) {
+      rewind_frames = strtoull(argv[++i], NULL, 10);
+    } else if (strcmp(argv[i], "--seed") == 0 && has_value) {
+      seed = (uint32_t)strtoul(argv[++i], NULL, 0);
+    } else if (strcmp(argv[i], "--random-input") == 0 && has_value) {
+      random_input = strtoull(argv[++i], NULL, 10);
+    } else if (strcmp(argv[i], "--record") == 0 && has_value) {
+      record_path = argv[++i];
+    } else if (strcmp(argv[i], "--replay") == 0 && has_value) {
+      replay_path = argv[++i];
+    } else if (strcmp(argv[i], "--quirks") == 0 && has_value &&
+               parse_quirks(argv[i + 1], quirks)) {
+      i++;
+    } else if (strcmp(argv[i], "--wav") == 0 && has_value) {
+      wav_path = argv[++i];
+    } else if (strcmp(argv[i], "--threaded") == 0) {
+      threaded = true;
+    } else if (strcmp(argv[i], "--run-ahead") == 0 && has_value) {
+      run_ahead_frames = strtoull(argv[++i], NULL, 10);
+    } else if (strcmp(argv[i], "--realtime") == 0) {
+      realtime = true;
+    } else if (strcmp(argv[i], "--profile") == 0 && has_value) {
+      profile_path = argv[++i];
+    } else if (strcmp(argv[i], "--trace") == 0 && has_value) {
+      trace_path = argv[++i];
+    } else if (strcmp(argv[i], "--spectate") == 0 && has_value) {
+      spectate_path = argv[++i];
+    } else if (argv[i][0] != '-' && rom_path == NULL) {
+      rom_path = argv[i];
+    } else {
+      print_usage(argv[0]);
+      return 1;
+    }
+  }
+  if (rom_path == NULL || instructions_per_frame == 0) {
+    print_usage(argv[0]);
+    return 1;
+  }
+  if (replay_path != NULL &&
+      (max_instructions != UINT64_MAX || max_frames != UINT64_MAX || verify ||
+       load_path != NULL || record_path != NULL || random_input > 0)) {
+    fprintf(stderr, "--replay runs the whole recording and nothing else\n");
+    return 1;
+  }
+  if (record_path != NULL && load_path != NULL) {
+    fprintf(stderr, "Recordings always start from a fresh state\n");
+    return 1;
+  }
+  if (max_instructions == UINT64_MAX && max_frames == UINT64_MAX &&
+      replay_path == NULL) {
+    max_frames = 600;
+  }
+  if (instances > 0 &&
+      (max_frames == UINT64_MAX || use_jit || verify || dump || realtime ||
+       wav_path != NULL || threaded || spectate_path != NULL ||
+       run_ahead_frames > 0)) {
+    fprintf(stderr, "--instances only takes --frames, --ipf and --threads\n");
+    return 1;
+  }
+  if (lanes && (max_frames == UINT64_MAX || use_jit || dump ||
+                instances > 0 || realtime || wav_path != NULL || threaded ||
+                spectate_path != NULL || run_ahead_frames > 0)) {
+    fprintf(stderr, "--lanes only takes --frames, --ipf and --verify\n");
+    return 1;
+  }
+  if (threaded && run_ahead_frames > 0) {
+    fprintf(stderr, "--run-ahead can't be combined with --threaded\n");
+    return 1;
+  }
+  if (use_aot && (use_jit || lanes || instances > 0)) {
+    fprintf(stderr, "--aot can't be combined with --jit, --lanes or "
+                    "--instances\n");
+    return 1;
+  }
+  // The recompilers, the lanes and the batch runner only implement the
+  // default behaviour, and --verify checks against the default interpreter.
+  if (quirks != Pot8to::QUIRKS_DEFAULT &&
+      (use_jit || use_aot || verify || lanes || instances > 0)) {
+    fprintf(stderr, "--quirks can't be combined with --jit, --aot, --verify, "
+                    "--lanes or --instances\n");
+    return 1;
+  }
+  run_core = Pot8to::select_run(quirks);
+#ifdef POT8TO_PROFILE
+  if (profile_path != NULL && (instances > 0 || lanes)) {
+    fprintf(stderr, "--profile only covers single instance runs\n");
+    return 1;
+  }
+#else
+  if (profile_path != NULL) {
+    fprintf(stderr, "Profiling needs a build with -DPOT8TO_PROFILE\n");
+    return 1;
+  }
+#endif
+#ifdef POT8TO_TRACE
+  if (trace_path != NULL && (instances > 0 || lanes || threaded)) {
+    fprintf(stderr, "--trace only covers single instance runs on this "
+                    "thread\n");
+    return 1;
+  }
+#else
+  if (trace_path != NULL) {
+    fprintf(stderr, "Tracing needs a build with -DPOT8TO_TRACE\n");
+    return 1;
+  }
+#endif
+
+  Platform::Program rom = Platform::load_program(rom_path);
+  if (rom.size == 0) {
+    return 1;
+  }
+#ifdef POT8TO_AOT
+  if (use_aot) {
+    const Pot8to::AotProgram *program = Pot8to::aot_find(
+        Pot8to::aot_programs, Pot8to::POT8TO_AOT_PROGRAMS, rom);
+    if (program == NULL) {
+      fprintf(stderr, "'%s' wasn't recompiled into this build\n", rom_path);
+      return 1;
+    }
+    run_core = program->run;
+  }
+#else
+  if (use_aot) {
+    fprintf(stderr, "Recompiled ROMs need a build with -DPOT8TO_AOT, see "
+                    "build/linux_aot.sh\n");
+    return 1;
+  }
+#endif
+  if (instances > 0) {
+    return run_batch_mode(rom_path, rom, instances, threads, max_frames,
+                          instructions_per_frame);
+  }
+  if (lanes) {
+    return run_lanes_mode(rom_path, rom, max_frames, instructions_per_frame,
+                          verify);
+  }
+  Pot8to::State emu = Pot8to::initialize(rom);
+  Pot8to::seed(emu, seed);
+  if (load_frame > 0 && (load_path == NULL || threaded)) {
+    fprintf(stderr, "--load-frame needs --load and can't be combined with "
+                    "--threaded\n");
+    return 1;
+  }
+  if (load_path != NULL && load_frame == 0 &&
+      !read_save_state(load_path, emu)) {
+    return 1;
+  }
+  // Viewers get a keyframe at least once a second.
+  static Pot8to::SpectateServer spectate;
+  if (spectate_path != NULL && !Pot8to::spectate_open(spectate, spectate_path,
+                                                      60)) {
+    fprintf(stderr, "Could not listen on '%s'\n", spectate_path);
+    return 1;
+  }
+  if (threaded) {
+    int status = run_threaded_mode(rom_path, emu, max_frames,
+                                   instructions_per_frame, realtime,
+                                   random_input, dump,
+                                   spectate_path != NULL ? &spectate : NULL);
+    if (spectate_path != NULL) {
+      Pot8to::spectate_close(spectate);
+    }
+    return status;
+  }
+
+  std::vector<uint8_t> replay_data;
+  Pot8to::Replay replay = {};
+  if (replay_path != NULL) {
+    if (!read_file(replay_path, replay_data) ||
+        !Pot8to::replay_open(replay, replay_data.data(), replay_data.size(),
+                             rom)) {
+      fprintf(stderr, "'%s' is not a recording of this ROM\n", replay_path);
+      return 1;
+    }
+    Pot8to::seed(emu, replay.seed);
+    instructions_per_frame = replay.instructions_per_frame;
+    max_instructions = replay.end;
+  }
+  Pot8to::Recorder recorder;
+  if (record_path != NULL) {
+    Pot8to::record_begin(recorder, rom, emu.rng,
+                         (uint32_t)instructions_per_frame);
+  }
+  // Host-side generator for --random-input, kept apart from the program's.
+  uint32_t input_rng = seed ^ 0x9E3779B9;
+  // Folds every frame's display hash, to compare recordings and replays.
+  bool hash_frames = record_path != NULL || replay_path != NULL;
+  uint64_t frames_checksum = 0;
+
+  Pot8to::State reference = emu;
+  Platform::Context ctx = {};
+#ifdef POT8TO_PROFILE
+  // Attached after the copy so --verify's reference run isn't counted.
+  if (profile_path != NULL) {
+    emu.profile = &profile;
+  }
+#endif
+#ifdef POT8TO_TRACE
+  static Pot8to::Trace trace;
+  if (trace_path != NULL && !Pot8to::trace_start(trace, emu, trace_path)) {
+    fprintf(stderr, "Could not open '%s'\n", trace_path);
+    return 1;
+  }
+#endif
+
+#ifdef POT8TO_HAS_JIT
+  if (use_jit && !Pot8to::jit_create(jit)) {
+    fprintf(stderr, "Could not allocate executable memory for the JIT\n");
+    return 1;
+  }
+#else
+  if (use_jit) {
+    fprintf(stderr, "The JIT is only available on x86-64\n");
+    return 1;
+  }
+#endif
+
+  // Display hashes of the frames the rewind ring should still hold, so
+  // stepping back can be checked.
+  Pot8to::Rewind rewind = {};
+  std::vector<uint64_t> rewind_hashes;
+  double rewind_push_seconds = 0;
+  if (rewind_frames > 0) {
+    // Typical deltas are a few dozen bytes, leave room for much worse.
+    size_t arena_size = rewind_frames * Pot8to::POT8TO_DELTA_MAX_SIZE / 8 +
+                        Pot8to::POT8TO_DELTA_MAX_SIZE;
+    Pot8to::rewind_create(rewind, rewind_frames, arena_size);
+    Pot8to::rewind_push(rewind, emu);
+    rewind_hashes.push_back(Pot8to::display_hash(emu));
+  }
+
+  // No throttling: every frame runs its instructions back to back, then the
+  // timers tick as if 1/60 s had passed.
+  uint64_t instructions = 0;
+  uint64_t frames = 0;
+  uint64_t idle_frames = 0;
+  uint64_t stops[Pot8to::STOP_FAULT + 1] = {};
+  uint64_t reference_stops[Pot8to::STOP_FAULT + 1] = {};
+  // --realtime waits for each frame's deadline, at most 4 late frames
+  // catch up back to back.
+  Pot8to::Scheduler scheduler;
+  uint64_t due = 0;
+  if (realtime) {
+    Pot8to::SchedulerConfig schedule = {
+        (uint32_t)(instructions_per_frame * 60), 60, 4};
+    Pot8to::Clock clock = {clock_now, clock_sleep, NULL};
+    Pot8to::scheduler_start(scheduler, schedule, clock);
+  }
+  Pot8to::SquareWave tone;
+  Pot8to::square_wave_begin(tone, 440);
+  std::vector<int16_t> samples;
+  // The copy --run-ahead runs, kept off the stack, and what it costs.
+  static Pot8to::RunAhead runahead;
+  Pot8to::run_ahead_reset(runahead);
+  double run_ahead_seconds = 0;
+  uint64_t run_ahead_calls = 0;
+  double start = seconds_now();
+  while (instructions < max_instructions && frames < max_frames) {
+    if (realtime) {
+      while (due == 0) {
+        Pot8to::scheduler_wait(scheduler);
+        due = Pot8to::scheduler_due_frames(scheduler);
+      }
+      due--;
+      Pot8to::scheduler_next_frame(scheduler);
+    }
+    if (load_frame > 0 && frames == load_frame) {
+      // Replaces the whole machine under the core, code it translated from
+      // the ROM included.
+      if (!read_save_state(load_path, emu) ||
+          !read_save_state(load_path, reference)) {
+        return 1;
+      }
+    }
+    uint64_t budget = max_instructions - instructions;
+    if (budget > instructions_per_frame) {
+      budget = instructions_per_frame;
+    }
+    if (random_input > 0 && frames % random_input == 0) {
+      uint8_t key = Pot8to::next_random(input_rng) & 0xF;
+      bool down = !emu.keyboard[key];
+      Pot8to::set_key(emu, key, down);
+      Pot8to::set_key(reference, key, down);
+      if (record_path != NULL) {
+        Pot8to::record_key(recorder, instructions, key, down);
+      }
+    }
+    run_frame(emu, instructions, budget, use_jit,
+              replay_path != NULL ? &replay : NULL, stops);
+    instructions += budget;
+    if (wav_path != NULL) {
+      Pot8to::audio_push_frame(tone, emu, audio_ring);
+      size_t at = samples.size();
+      samples.resize(at + Pot8to::POT8TO_AUDIO_FRAME_SAMPLES);
+      Pot8to::audio_ring_read(audio_ring, &samples[at],
+                              Pot8to::POT8TO_AUDIO_FRAME_SAMPLES);
+    }
+    Pot8to::decrement_timers(emu);
+
+    if (verify) {
+      // Replay the frame on the switch interpreter and compare everything
+      // the program can see.
+      size_t left = budget;
+      while (left > 0) {
+        Pot8to::RunResult result = Pot8to::run_switch(reference, left);
+        reference_stops[result.reason]++;
+        left -= result.executed;
+      }
+      Pot8to::decrement_timers(reference);
+      if (!Pot8to::same_emulated_state(emu, reference) ||
+          memcmp(stops, reference_stops, sizeof(stops)) != 0) {
+        fprintf(stderr, "State diverged from the interpreter in frame %llu\n",
+                (unsigned long long)frames);
+        return 2;
+      }
+    }
+    if (rewind_frames > 0) {
+      double push_start = seconds_now();
+      Pot8to::rewind_push(rewind, emu);
+      rewind_push_seconds += seconds_now() - push_start;
+      rewind_hashes.push_back(Pot8to::display_hash(emu));
+    }
+    if (hash_frames) {
+      frames_checksum =
+          (frames_checksum ^ Pot8to::display_hash(emu)) * 0x100000001B3ull;
+    }
+    uint64_t dirty_rows = Pot8to::take_dirty_rows(emu);
+    if (run_ahead_frames > 0) {
+      // The JIT's code is tied to `emu`, the copy runs on the interpreter.
+      double ahead_start = seconds_now();
+      dirty_rows = Pot8to::run_ahead(runahead, emu, run_core,
+                                     instructions_per_frame, run_ahead_frames);
+      run_ahead_seconds += seconds_now() - ahead_start;
+      run_ahead_calls++;
+      if (dirty_rows != 0) {
+        Platform::render_display(ctx, Pot8to::display_frame(runahead.ahead),
+                                 dirty_rows);
+      }
+    } else if (dirty_rows != 0) {
+      Platform::render_display(ctx, Pot8to::display_frame(emu), dirty_rows);
+    }
+    frames++;
+    if (spectate_path != NULL) {
+      Pot8to::spectate_publish(spectate, emu.display, emu.hires, frames);
+    }
+
+    // A program spinning until a key changes looks the same every frame, so
+    // jump to the next frame that can change a key or ends the run. Verify,
+    // rewind and --wav need every frame, --realtime has to wait for it and
+    // a trace every instruction, they keep running it all.
+    if (Pot8to::idle_until_input(emu) && !verify && rewind_frames == 0 &&
+        !realtime && wav_path == NULL && trace_path == NULL) {
+      uint64_t skip = (max_instructions - instructions) / instructions_per_frame;
+      if (skip > max_frames - frames) {
+        skip = max_frames - frames;
+      }
+      uint64_t until_input =
+          random_input > 0 ? (random_input - frames % random_input) % random_input
+                           : skip;
+      if (skip > until_input) {
+        skip = until_input;
+      }
+      if (load_frame > frames && skip > load_frame - frames) {
+        skip = load_frame - frames;
+      }
+      if (replay_path != NULL && replay.event != Pot8to::POT8TO_RECORDING_END &&
+          skip > (replay.next - instructions) / instructions_per_frame) {
+        skip = (replay.next - instructions) / instructions_per_frame;
+      }
+      if (skip > 0) {
+        size_t left =
+            (size_t)Pot8to::skip_idle_frames(emu, skip, instructions_per_frame);
+        run_frame(emu, instructions, left, use_jit, NULL, stops);
+        if (hash_frames) {
+          uint64_t hash = Pot8to::display_hash(emu);
+          for (uint64_t i = 0; i < skip; i++) {
+            frames_checksum = (frames_checksum ^ hash) * 0x100000001B3ull;
+          }
+        }
+        instructions += skip * instructions_per_frame;
+        frames += skip;
+        idle_frames += skip;
+      }
+    }
+  }
+  double elapsed = seconds_now() - start;
+  if (spectate_path != NULL) {
+    Pot8to::spectate_close(spectate);
+  }
+#ifdef POT8TO_TRACE
+  if (trace_path != NULL && !Pot8to::trace_stop(trace, emu)) {
+    fprintf(stderr, "Could not write '%s'\n", trace_path);
+    return 1;
+  }
+#endif
+
+  if (record_path != NULL) {
+    Pot8to::record_end(recorder, instructions);
+    if (!write_file(record_path, recorder.bytes.data(),
+                    recorder.bytes.size())) {
+      return 1;
+    }
+  }
+
+  if (wav_path != NULL && !write_wav(wav_path, samples)) {
+    return 1;
+  }
+
+  if (save_path != NULL && !write_save_state(save_path, emu)) {
+    return 1;
+  }
+
+#ifdef POT8TO_PROFILE
+  if (profile_path != NULL) {
+    FILE *file = fopen(profile_path, "w");
+    bool written = file != NULL && Pot8to::profile_write_json(profile, emu, file);
+    if (file != NULL && fclose(file) != 0) {
+      written = false;
+    }
+    if (!written) {
+      fprintf(stderr, "Could not write '%s'\n", profile_path);
+      return 1;
+    }
+  }
+#endif
+
+  size_t rewind_bytes = 0;
+  size_t rewound = 0;
+  double rewind_step_seconds = 0;
+  if (rewind_frames > 0) {
+    // Walk the whole history back, the state goes back to `emu` after.
+    rewind_bytes = Pot8to::rewind_bytes(rewind);
+    Pot8to::State rewound_state = emu;
+    double step_start = seconds_now();
+    while (Pot8to::rewind_step_back(rewind, rewound_state)) {
+      rewound++;
+      uint64_t expected = rewind_hashes[rewind_hashes.size() - 1 - rewound];
+      if (Pot8to::display_hash(rewound_state) != expected) {
+        fprintf(stderr, "Rewind step %zu restored the wrong frame\n", rewound);
+        return 2;
+      }
+    }
+    rewind_step_seconds = seconds_now() - step_start;
+    Pot8to::rewind_destroy(rewind);
+  }
+
+  if (dump) {
+    dump_display(emu);
+  }
+
+  printf("rom: %s\n", rom_path);
+  printf("instructions: %llu\n", (unsigned long long)instructions);
+  printf("frames: %llu\n", (unsigned long long)frames);
+  printf("seconds: %.6f\n", elapsed);
+  printf("instructions_per_second: %.0f\n",
+         elapsed > 0 ? instructions / elapsed : 0.0);
+  printf("frames_per_second: %.0f\n", elapsed > 0 ? frames / elapsed : 0.0);
+  printf("idle_frames: %llu\n", (unsigned long long)idle_frames);
+  printf("display_updates: %llu\n",
+         (unsigned long long)stops[Pot8to::STOP_DISPLAY_CHANGED]);
+  printf("frames_presented: %llu\n",
+         (unsigned long long)ctx.frames_presented);
+  printf("rows_presented: %llu\n", (unsigned long long)ctx.rows_presented);
+  printf("sound_starts: %llu\n",
+         (unsigned long long)stops[Pot8to::STOP_SOUND_STARTED]);
+  printf("key_waits: %llu\n",
+         (unsigned long long)stops[Pot8to::STOP_WAITING_FOR_KEY]);
+  printf("unknown_instructions: %llu\n",
+         (unsigned long long)stops[Pot8to::STOP_UNKNOWN_INSTRUCTION]);
+  printf("display_checksum: %016llx\n",
+         (unsigned long long)Pot8to::display_hash(emu));
+  if (hash_frames) {
+    printf("frames_checksum: %016llx\n", (unsigned long long)frames_checksum);
+  }
+  if (realtime) {
+    printf("frames_dropped: %llu\n", (unsigned long long)scheduler.dropped);
+  }
+  if (spectate_path != NULL) {
+    print_spectate_stats(spectate);
+  }
+#ifdef POT8TO_TRACE
+  if (trace_path != NULL) {
+    printf("trace_records: %llu\n",
+           (unsigned long long)Pot8to::trace_records(trace));
+    // Times the run had to wait for the disk.
+    printf("trace_stalls: %llu\n", (unsigned long long)trace.ring.stalls);
+  }
+#endif
+  if (run_ahead_frames > 0) {
+    printf("run_ahead_checksum: %016llx\n",
+           (unsigned long long)Pot8to::display_hash(runahead.ahead));
+    printf("run_ahead_us: %.3f\n",
+           run_ahead_calls > 0 ? run_ahead_seconds * 1e6 / run_ahead_calls
+                               : 0.0);
+  }
+  if (rewind_frames > 0) {
+    printf("rewind_frames: %zu\n", rewound);
+    printf("rewind_bytes: %zu\n", rewind_bytes);
+    printf("rewind_push_us: %.3f\n",
+           frames > 0 ? rewind_push_seconds * 1e6 / frames : 0.0);
+    printf("rewind_step_us: %.3f\n",
+           rewound > 0 ? rewind_step_seconds * 1e6 / rewound : 0.0);
+  }
+
+  return 0;
+}
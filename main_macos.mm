@@ -1,30 +1,86 @@
 #import "platform.h"
 #include "pot8to.cpp"
+#include "pot8to_runner.cpp"
 #import <Cocoa/Cocoa.h>
+#include <time.h>
+
+// The emulation thread's clock.
+static double uptime(void *) {
+  return [[NSProcessInfo processInfo] systemUptime];
+}
+
+static void sleepSeconds(void *, double seconds) {
+  timespec ts;
+  ts.tv_sec = (time_t)seconds;
+  ts.tv_nsec = (long)((seconds - ts.tv_sec) * 1e9);
+  nanosleep(&ts, NULL);
+}
+
+// Emulates on its own thread, the main thread only draws its frames and
+// passes keys in. Static so its cache-line alignment holds.
+static Pot8to::Runner runner;
+
+// CHIP-8 keypad on the left-hand block of a QWERTY keyboard:
+//   1 2 3 C      1 2 3 4
+//   4 5 6 D  ->  Q W E R
+//   7 8 9 E      A S D F
+//   A 0 B F      Z X C V
+static const char keypadKeys[16] = {'x', '1', '2', '3', 'q', 'w', 'e', 'a',
+                                    's', 'd', 'z', 'c', '4', 'r', 'f', 'v'};
+
+static int keypadKey(NSEvent *event) {
+  NSString *characters = [event charactersIgnoringModifiers];
+  if ([characters length] != 1) {
+    return -1;
+  }
+  unichar character = [[characters lowercaseString] characterAtIndex:0];
+  for (int key = 0; key < 16; key++) {
+    if (keypadKeys[key] == character) {
+      return key;
+    }
+  }
+  return -1;
+}
 
 @interface Chip8View : NSView
-@property(nonatomic, assign) Pot8to::State *emulatorState;
+// The renderer's slot of the runner's triple buffer, see `presentFrame`.
+@property(nonatomic, assign) const Pot8to::DisplaySnapshot *snapshot;
 @end
 
 @implementation Chip8View
 - (void)drawRect:(NSRect)dirtyRect {
   [super drawRect:dirtyRect];
 
-  CGFloat pixelSize = 15.0;
+  // The view stays 64x32 pixels of 15 points, hires pixels are half that.
+  Platform::Frame frame = Pot8to::snapshot_frame(*self.snapshot);
+  CGFloat pixelSize = 15.0 * POT8TO_DISPLAY_WIDTH / frame.width;
+  size_t words = frame.width / 64;
 
   [[NSColor colorWithCalibratedRed:0.10 green:0.11 blue:0.15
                              alpha:1.0] setFill];
   NSRectFill(dirtyRect);
 
-  [[NSColor colorWithCalibratedRed:0.56 green:0.80 blue:0.98
-                             alpha:1.0] setFill];
-
-  for (size_t y = 0; y < POT8TO_DISPLAY_HEIGHT; y++) {
-    for (size_t x = 0; x < POT8TO_DISPLAY_WIDTH; x++) {
-      // Invert the Y-axis when accessing the display buffer
-      uint8_t pixel =
-          self.emulatorState->display[POT8TO_DISPLAY_HEIGHT - 1 - y][x];
-      if (pixel) {
+  // Plane 0, plane 1, both planes.
+  NSColor *colours[3] = {
+      [NSColor colorWithCalibratedRed:0.56 green:0.80 blue:0.98 alpha:1.0],
+      [NSColor colorWithCalibratedRed:0.98 green:0.70 blue:0.40 alpha:1.0],
+      [NSColor colorWithCalibratedRed:0.95 green:0.95 blue:0.95 alpha:1.0]};
+
+  // Only the rows overlapping the dirty rect, see `presentFrame`.
+  size_t first = (size_t)MAX(0.0, floor(NSMinY(dirtyRect) / pixelSize));
+  size_t last = (size_t)MIN((CGFloat)frame.height,
+                            ceil(NSMaxY(dirtyRect) / pixelSize));
+  for (size_t y = first; y < last; y++) {
+    // Invert the Y-axis when accessing the display buffer
+    size_t row = (frame.height - 1 - y) * words;
+    for (size_t x = 0; x < frame.width; x++) {
+      unsigned colour = 0;
+      for (size_t plane = 0; plane < POT8TO_DISPLAY_PLANES; plane++) {
+        uint64_t word = frame.planes[plane][row + x / 64];
+        colour |= (unsigned)((word >> (63 - x % 64)) & 1) << plane;
+      }
+      if (colour != 0) {
+        [colours[colour - 1] setFill];
         NSRect rect =
             NSMakeRect(x * pixelSize, y * pixelSize, pixelSize, pixelSize);
         NSRectFill(rect);
@@ -32,21 +88,38 @@
     }
   }
 }
+
+- (BOOL)acceptsFirstResponder {
+  return YES;
+}
+
+- (void)keyDown:(NSEvent *)event {
+  int key = keypadKey(event);
+  if (key >= 0) {
+    Pot8to::runner_set_key(runner, (uint8_t)key, true);
+  }
+}
+
+- (void)keyUp:(NSEvent *)event {
+  int key = keypadKey(event);
+  if (key >= 0) {
+    Pot8to::runner_set_key(runner, (uint8_t)key, false);
+  }
+}
 @end
 
 @interface AppDelegate : NSObject <NSApplicationDelegate>
 @property(strong) NSWindow *window;
 @property(strong) Chip8View *chip8View;
-@property(strong) NSTimer *emulationTimer;
+@property(strong) NSTimer *presentTimer;
 @end
 
-@implementation AppDelegate {
-  Pot8to::State *emulatorState;
-}
+@implementation AppDelegate
 
 - (void)applicationDidFinishLaunching:(NSNotification *)notification {
   Platform::Program rom = Platform::pick_and_load_program();
-  emulatorState = new Pot8to::State(Pot8to::initialize(rom));
+  runner.state = Pot8to::initialize(rom);
+  Pot8to::seed(runner.state, Platform::random_seed());
 
   CGFloat pixelSize = 15.0;
   NSRect windowRect = NSMakeRect(0, 0, POT8TO_DISPLAY_WIDTH * pixelSize,
@@ -60,27 +133,60 @@
   [self.window setTitle:@"Chip-8 Emulator"];
 
   self.chip8View = [[Chip8View alloc] initWithFrame:windowRect];
-  self.chip8View.emulatorState = emulatorState;
   [self.window setContentView:self.chip8View];
 
   [self.window makeKeyAndOrderFront:nil];
-
-  self.emulationTimer =
+  [self.window makeFirstResponder:self.chip8View];
+
+  // Around 660 instructions per second in frames of 11, paced by the
+  // emulation thread itself. The timer only picks up finished frames, a
+  // late or coalesced fire can't slow the emulation down.
+  Pot8to::RunnerConfig config = {};
+  config.core = Pot8to::run;
+  config.schedule.instructions_per_second = 660;
+  config.schedule.frames_per_second = 60;
+  config.schedule.max_catch_up_frames = 4;
+  config.clock.now = uptime;
+  config.clock.sleep = sleepSeconds;
+  config.frames = UINT64_MAX;
+  Pot8to::runner_start(runner, config);
+  [self presentFrame];
+  self.presentTimer =
       [NSTimer scheduledTimerWithTimeInterval:(1.0 / 60.0)
                                        target:self
-                                     selector:@selector(tickEmulator)
+                                     selector:@selector(presentFrame)
                                      userInfo:nil
                                       repeats:YES];
 }
 
-- (void)tickEmulator {
-  Pot8to::tick(*emulatorState);
-  [self.chip8View setNeedsDisplay:YES];
+- (void)presentFrame {
+  uint64_t rows;
+  self.chip8View.snapshot = &Pot8to::triple_buffer_take(runner.display, rows);
+
+  // Invalidate each run of changed rows. The view's origin is bottom-left,
+  // so display row y is view row height - 1 - y.
+  size_t height = Pot8to::snapshot_frame(*self.chip8View.snapshot).height;
+  CGFloat rowHeight = 15.0 * POT8TO_DISPLAY_HEIGHT / height;
+  for (size_t y = 0; y < height;) {
+    if (((rows >> y) & 1) == 0) {
+      y++;
+      continue;
+    }
+    size_t start = y;
+    while (y < height && ((rows >> y) & 1)) {
+      y++;
+    }
+    NSRect rect = NSMakeRect(0, (height - y) * rowHeight,
+                             POT8TO_DISPLAY_WIDTH * 15.0,
+                             (y - start) * rowHeight);
+    [self.chip8View setNeedsDisplayInRect:rect];
+  }
 }
 
-- (void)dealloc {
-  [self.emulationTimer invalidate];
-  delete emulatorState;
+- (void)applicationWillTerminate:(NSNotification *)notification {
+  [self.presentTimer invalidate];
+  Pot8to::runner_stop(runner);
+  Pot8to::runner_join(runner);
 }
 @end
 
@@ -1,10 +1,75 @@
 #include "platform.h"
 #include "platform_windows.cpp"
 #include "pot8to.cpp"
+#include "pot8to_audio.cpp"
+#include "pot8to_record.cpp"
+#include "pot8to_runahead.cpp"
+#include "pot8to_savestate.cpp"
+#include "pot8to_scheduler.cpp"
 #include <commdlg.h>
+#include <math.h>
 #include <stdio.h>
 #include <windows.h>
 
+// CHIP-8 keypad on the left-hand block of a QWERTY keyboard:
+//   1 2 3 C      1 2 3 4
+//   4 5 6 D  ->  Q W E R
+//   7 8 9 E      A S D F
+//   A 0 B F      Z X C V
+static const char keypadKeys[16] = {'X', '1', '2', '3', 'Q', 'W', 'E', 'A',
+                                    'S', 'D', 'Z', 'C', '4', 'R', 'F', 'V'};
+
+static int keypadKey(WPARAM virtualKey) {
+  for (int key = 0; key < 16; key++) {
+    if (keypadKeys[key] == (char)virtualKey) {
+      return key;
+    }
+  }
+  return -1;
+}
+
+// Every session is recorded here, replay it with the Linux host's --replay.
+static const char *const sessionRecordingPath = "last_session.p8r";
+
+static void writeRecording(const Pot8to::Recorder &recorder) {
+  FILE *file = fopen(sessionRecordingPath, "wb");
+  if (file != NULL) {
+    fwrite(recorder.bytes.data(), 1, recorder.bytes.size(), file);
+    fclose(file);
+  }
+}
+
+// The scheduler's clock: the performance counter, `context` points at its
+// frequency.
+static double clockNow(void *context) {
+  LARGE_INTEGER counter;
+  QueryPerformanceCounter(&counter);
+  return counter.QuadPart / (double)((LARGE_INTEGER *)context)->QuadPart;
+}
+
+// Any window message ends the wait early, so input is handled right away.
+static void clockSleep(void *, double seconds) {
+  MsgWaitForMultipleObjects(0, NULL, FALSE, (DWORD)ceil(seconds * 1000.0),
+                            QS_ALLINPUT);
+}
+
+// Filled by the emulation loop once per frame, drained by the platform's
+// audio thread.
+static Pot8to::AudioRing audioRing;
+
+static size_t pullAudio(void *, int16_t *out, size_t count) {
+  return Pot8to::audio_ring_read(audioRing, out, count);
+}
+
+// Frames shown ahead of the emulation, taking back the frame or two most
+// programs need to draw a key press. 0 shows the emulation itself.
+static const uint64_t runAheadFrames = 1;
+static Pot8to::RunAhead runAhead;
+
+// Set when Windows asks for a repaint (first show, uncovered, restored...),
+// the next frame redraws every row instead of just the changed ones.
+static bool windowExposed = true;
+
 // Window Procedure function to handle messages
 LRESULT CALLBACK WindowProc(HWND hwnd, UINT uMsg, WPARAM wParam,
                             LPARAM lParam) {
@@ -12,6 +77,13 @@ LRESULT CALLBACK WindowProc(HWND hwnd, UINT uMsg, WPARAM wParam,
   case WM_DESTROY:
     PostQuitMessage(0);
     return 0;
+  case WM_PAINT: {
+    PAINTSTRUCT paint;
+    BeginPaint(hwnd, &paint);
+    EndPaint(hwnd, &paint);
+    windowExposed = true;
+    return 0;
+  }
   default:
     return DefWindowProc(hwnd, uMsg, wParam, lParam);
   }
@@ -24,6 +96,7 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance,
     // TODO: Finish execution
   }
   Pot8to::State emu = Pot8to::initialize(rom);
+  Pot8to::seed(emu, Platform::random_seed());
 
   const int pixelSize = 15;
   // Define the window class
@@ -60,59 +133,117 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance,
   // Show the window
   ShowWindow(hwnd, nCmdShow);
 
-  // Run around 660 instructions per second
-  const double targetInstructionTime = 1.0 / 660;
-  // Render the display 60 times per second
-  const double targetFrameTime = 1.0 / 60.0;
+  // Around 660 instructions per second, one frame of 11 per timer tick.
+  // After a stall at most 4 late frames run back to back.
+  const Pot8to::SchedulerConfig schedule = {660, 60, 4};
+  const size_t instructionsPerFrame =
+      schedule.instructions_per_second / schedule.frames_per_second;
 
+  // Sleeps in MsgWaitForMultipleObjects get 1 ms resolution instead of the
+  // default ~15.6 ms.
+  timeBeginPeriod(1);
   LARGE_INTEGER frequency;
   QueryPerformanceFrequency(&frequency);
+  Pot8to::Clock clock = {clockNow, clockSleep, &frequency};
+  Pot8to::Scheduler scheduler;
+  Pot8to::scheduler_start(scheduler, schedule, clock);
+
+  // Without an audio device the program just runs silent.
+  Pot8to::SquareWave tone;
+  Pot8to::square_wave_begin(tone, 440);
+  Pot8to::audio_ring_reset(audioRing);
+  Platform::start_audio(Pot8to::POT8TO_AUDIO_SAMPLE_RATE, pullAudio, NULL);
+
+  // Always on: ten seconds of frames, hold Backspace to play them backwards.
+  Pot8to::Rewind rewind = {};
+  bool canRewind = Pot8to::rewind_create(rewind, 600, 256 * 1024);
+  if (canRewind) {
+    Pot8to::rewind_push(rewind, emu);
+  }
 
-  LARGE_INTEGER previousTimeInstruction;
-  LARGE_INTEGER previousTimeFrame;
-  QueryPerformanceCounter(&previousTimeInstruction);
-  QueryPerformanceCounter(&previousTimeFrame);
+  // Stops for good once the session is rewound, a recording can only go
+  // forwards.
+  Pot8to::Recorder recorder;
+  bool recording = true;
+  uint64_t instructionsRun = 0;
+  Pot8to::record_begin(recorder, rom, emu.rng,
+                       (uint32_t)instructionsPerFrame);
 
-  double accumulatedTimeInstruction = 0.0;
-  double accumulatedTimeFrame = 0.0;
+  // Whether the last repaint drew the run-ahead copy rather than `emu`.
+  bool showingAhead = false;
+  Pot8to::run_ahead_reset(runAhead);
 
   MSG msg = {0};
   while (true) {
+    Pot8to::scheduler_wait(scheduler);
     while (PeekMessage(&msg, NULL, 0, 0, PM_REMOVE)) {
-      if (msg.message == WM_QUIT)
+      if (msg.message == WM_QUIT) {
+        if (recording) {
+          Pot8to::record_end(recorder, instructionsRun);
+          writeRecording(recorder);
+        }
+        Platform::stop_audio();
+        timeEndPeriod(1);
         return 0;
+      }
+      if (msg.message == WM_KEYDOWN || msg.message == WM_KEYUP) {
+        int key = keypadKey(msg.wParam);
+        bool down = msg.message == WM_KEYDOWN;
+        // Held keys repeat WM_KEYDOWN, only log actual changes.
+        if (key >= 0 && emu.keyboard[key] != down) {
+          Pot8to::set_key(emu, (uint8_t)key, down);
+          if (recording) {
+            Pot8to::record_key(recorder, instructionsRun, (uint8_t)key, down);
+          }
+        }
+      }
       TranslateMessage(&msg);
       DispatchMessage(&msg);
     }
 
-    LARGE_INTEGER currentTime;
-    QueryPerformanceCounter(&currentTime);
-
-    double lastInstructionElapsedTime =
-        (currentTime.QuadPart - previousTimeInstruction.QuadPart) /
-        (double)frequency.QuadPart;
-    double lastFrameElapsedTime =
-        (currentTime.QuadPart - previousTimeFrame.QuadPart) /
-        (double)frequency.QuadPart;
-
-    accumulatedTimeInstruction += lastInstructionElapsedTime;
-    accumulatedTimeFrame += lastFrameElapsedTime;
-
-    printf("Accumulated Time Frame: %f", accumulatedTimeFrame);
-
-    if (accumulatedTimeInstruction >= targetInstructionTime) {
-      Pot8to::tick(emu);
-      accumulatedTimeInstruction -= targetInstructionTime;
-      previousTimeInstruction = currentTime;
-    }
-    if (accumulatedTimeFrame >= targetFrameTime) {
-      if (emu.registers.T.sound > 0) {
-        Platform::beep();
+    bool rewinding = canRewind && GetForegroundWindow() == hwnd &&
+                     (GetAsyncKeyState(VK_BACK) & 0x8000) != 0;
+    for (uint64_t due = Pot8to::scheduler_due_frames(scheduler); due > 0;
+         due--) {
+      size_t budget = Pot8to::scheduler_next_frame(scheduler);
+      if (rewinding) {
+        if (Pot8to::rewind_step_back(rewind, emu)) {
+          recording = false;
+        }
+        continue;
       }
+      instructionsRun += budget;
+      while (budget > 0) {
+        budget -= Pot8to::run(emu, budget).executed;
+      }
+      Pot8to::audio_push_frame(tone, emu, audioRing);
       Pot8to::decrement_timers(emu);
-      Platform::render_display(ctx, emu.display);
-      accumulatedTimeFrame -= targetFrameTime;
-      previousTimeFrame = currentTime;
+      if (canRewind) {
+        Pot8to::rewind_push(rewind, emu);
+      }
+    }
+
+    // Repaint only the rows that changed, if any. Run-ahead is redone even
+    // when no frame was due, so a key pressed mid-frame shows right away.
+    // Rewinding shows the real frames.
+    uint64_t dirtyRows = Pot8to::take_dirty_rows(emu);
+    const Pot8to::State *shown = &emu;
+    bool ahead = runAheadFrames > 0 && !rewinding;
+    if (ahead) {
+      dirtyRows = Pot8to::run_ahead(runAhead, emu, Pot8to::run,
+                                    instructionsPerFrame, runAheadFrames);
+      shown = &runAhead.ahead;
+    } else if (showingAhead) {
+      dirtyRows = Pot8to::POT8TO_ALL_ROWS;
+      Pot8to::run_ahead_reset(runAhead);
+    }
+    showingAhead = ahead;
+    if (windowExposed) {
+      dirtyRows = Pot8to::POT8TO_ALL_ROWS;
+      windowExposed = false;
+    }
+    if (dirtyRows != 0) {
+      Platform::render_display(ctx, Pot8to::display_frame(*shown), dirtyRows);
     }
   }
 
@@ -12,15 +12,33 @@ struct Program {
 };
 Program pick_and_load_program();
 
-void render_display(
-    Context &ctx,
-    const uint8_t display[POT8TO_DISPLAY_HEIGHT][POT8TO_DISPLAY_WIDTH]);
+// The display at its current resolution. Each plane holds `height` rows of
+// `width / 64` words, bit 63 of a row's first word is its leftmost pixel. A
+// pixel's colour is bit p set for every plane p it's lit on, 0 is the
+// background.
+struct Frame {
+  const uint64_t *planes[POT8TO_DISPLAY_PLANES];
+  size_t width;
+  size_t height;
+};
 
-void beep();
+// Only the rows set in `rows` (bit y for row y) changed since the last call
+// and need repainting.
+void render_display(Context &ctx, const Frame &frame, uint64_t rows);
 
-uint8_t rnd_8bits();
+// Pulls up to `count` mono signed 16-bit samples into `out` and returns how
+// many it wrote, the rest plays as silence. Runs on the platform's audio
+// thread, so it must never block.
+typedef size_t (*AudioSource)(void *context, int16_t *out, size_t count);
 
-void except_unknown_inst();
+// Starts playing `source` at `sample_rate` on a thread of the platform's
+// own. Returns false if there is no audio output, the host runs silent then.
+bool start_audio(uint32_t sample_rate, AudioSource source, void *context);
+void stop_audio();
 
-void block_for_input();
+// Seed for a new session's CXNN sequence. The core never asks for it, hosts
+// that want every session to play differently pass it to `Pot8to::seed`.
+uint32_t random_seed();
+
+void except_unknown_inst();
 } // namespace Platform
@@ -0,0 +1,63 @@
+#pragma once
+#include "platform.h"
+#include <stdio.h>
+#include <string.h>
+
+namespace Platform {
+struct Context {
+  // Number of frames and rows handed to `render_display` so far.
+  uint64_t frames_presented;
+  uint64_t rows_presented;
+};
+
+// Headless hosts take the ROM path from the command line instead of a file
+// picker. On failure the returned program has size 0.
+Program load_program(const char *path) {
+  Program program = {};
+
+  FILE *file = fopen(path, "rb");
+  if (file == NULL) {
+    fprintf(stderr, "Could not open ROM '%s'\n", path);
+    return program;
+  }
+
+  size_t size = fread(program.buffer, 1, sizeof(program.buffer), file);
+  if (fgetc(file) != EOF) {
+    fprintf(stderr, "ROM '%s' does not fit in program memory\n", path);
+    size = 0;
+  }
+  fclose(file);
+
+  program.size = size;
+  return program;
+}
+
+// There is no dialog to show, so "picking" reads a path from stdin.
+Program pick_and_load_program() {
+  char path[4096] = {};
+  if (fgets(path, sizeof(path), stdin) == NULL) {
+    return Program{};
+  }
+  path[strcspn(path, "\r\n")] = '\0';
+  return load_program(path);
+}
+
+void render_display(Context &ctx, const Frame &frame, uint64_t rows) {
+  // Nothing to draw on, the host reads the display directly when it needs it.
+  (void)frame;
+  ctx.frames_presented++;
+  for (; rows != 0; rows &= rows - 1) {
+    ctx.rows_presented++;
+  }
+}
+
+// Headless: there is nothing to play on, --wav writes the samples instead.
+bool start_audio(uint32_t, AudioSource, void *) { return false; }
+void stop_audio() {}
+
+// Headless runs stay reproducible unless asked for another seed.
+uint32_t random_seed() { return POT8TO_DEFAULT_SEED; }
+
+// `run` already reports these through its stop reason.
+void except_unknown_inst() {}
+} // namespace Platform
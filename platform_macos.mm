@@ -57,13 +57,13 @@ void render_and_play_sound(
     bool sound) {}
 } // namespace Platform
 
-uint8_t Platform::rnd_8bits() {
+uint32_t Platform::random_seed() {
   @autoreleasepool {
-    uint8_t rnd;
-    if (getentropy(&rnd, 1) == 0) {
-      return rnd;
+    uint32_t seed;
+    if (getentropy(&seed, sizeof(seed)) == 0) {
+      return seed;
     } else {
-      return 42;
+      return POT8TO_DEFAULT_SEED;
     }
   }
 }
@@ -77,6 +77,4 @@ void Platform::except_unknown_inst() {
   [NSApp terminate:nil];
 };
 
-void Platform::block_for_input() {}
-
 #endif
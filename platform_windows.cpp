@@ -1,7 +1,10 @@
 #pragma once
 #include "platform.h"
+#include <string.h>
 #include <windows.h>
 
+#include <mmsystem.h>
+
 namespace Platform {
 struct Context {
   HWND &hwnd;
@@ -56,31 +59,57 @@ Program pick_and_load_program() {
 }
 
 // NOTE: This funciton in Windows may need to receive `hwnd`...
-void render_display(
-    Context &ctx,
-    const uint8_t display[POT8TO_DISPLAY_HEIGHT][POT8TO_DISPLAY_WIDTH]) {
+void render_display(Context &ctx, const Frame &frame, uint64_t rows) {
+  // Created once, GDI brushes are process-wide objects. One per colour:
+  // background, plane 0, plane 1, both planes.
+  static const HBRUSH brushes[4] = {
+      CreateSolidBrush(RGB(0, 0, 0)), CreateSolidBrush(RGB(255, 255, 255)),
+      CreateSolidBrush(RGB(170, 170, 170)), CreateSolidBrush(RGB(85, 85, 85))};
+
   // Get device context of the window
   HDC hdc = GetDC(ctx.hwnd);
 
-  // Define the size of each CHIP-8 pixel to be drawn
-  const int pixelSize = 15; // Adjusted size to match window setup
-
-  // Loop through the CHIP-8 display array
-  for (int y = 0; y < POT8TO_DISPLAY_HEIGHT; y++) {
-    for (int x = 0; x < POT8TO_DISPLAY_WIDTH; x++) {
-      // Determine color based on display value
-      HBRUSH brush;
-      RECT rect = {x * pixelSize, y * pixelSize, (x + 1) * pixelSize,
-                   (y + 1) * pixelSize};
-      if (display[y][x] == 1) {
-        // Set brush to white to draw a filled rectangle
-        brush = CreateSolidBrush(RGB(255, 255, 255));
-      } else {
-        // Clear the pixel if it should be empty
-        brush = CreateSolidBrush(RGB(0, 0, 0));
+  // The window is 64x32 pixels of 15x15 at the low resolution. Hires pixels
+  // get half that, pixel edges are scaled so the rounding never leaves gaps.
+  const int windowWidth = 64 * 15;
+  const int windowHeight = 32 * 15;
+  const int width = (int)frame.width;
+  const int height = (int)frame.height;
+  const size_t words = frame.width / 64;
+
+  for (int y = 0; y < height; y++) {
+    if (((rows >> y) & 1) == 0) {
+      continue;
+    }
+    int top = y * windowHeight / height;
+    int bottom = (y + 1) * windowHeight / height;
+    // Clear the whole row in one call, then fill each run of same-coloured
+    // lit pixels.
+    RECT row = {0, top, windowWidth, bottom};
+    FillRect(hdc, &row, brushes[0]);
+    int x = 0;
+    while (x < width) {
+      int colour = 0;
+      for (int plane = 0; plane < POT8TO_DISPLAY_PLANES; plane++) {
+        uint64_t word = frame.planes[plane][y * words + x / 64];
+        colour |= (int)((word >> (63 - x % 64)) & 1) << plane;
+      }
+      int start = x;
+      for (x++; x < width; x++) {
+        int next = 0;
+        for (int plane = 0; plane < POT8TO_DISPLAY_PLANES; plane++) {
+          uint64_t word = frame.planes[plane][y * words + x / 64];
+          next |= (int)((word >> (63 - x % 64)) & 1) << plane;
+        }
+        if (next != colour) {
+          break;
+        }
+      }
+      if (colour != 0) {
+        RECT run = {start * windowWidth / width, top,
+                    x * windowWidth / width, bottom};
+        FillRect(hdc, &run, brushes[colour]);
       }
-      FillRect(hdc, &rect, brush);
-      DeleteObject(brush);
     }
   }
 
@@ -88,16 +117,101 @@ void render_display(
   ReleaseDC(ctx.hwnd, hdc);
 }
 
-void beep() { Beep(1000, 100); }
+// waveOut plays a few short buffers queued back to back. A thread of its
+// own refills each one from the source as soon as the device is done with
+// it, so the emulation thread never waits on the sound card.
+constexpr size_t audioBufferCount = 4;
+// About 12 ms at 44.1 kHz, ~46 ms of latency with all four queued.
+constexpr size_t audioBufferSamples = 512;
+
+static struct {
+  HWAVEOUT device;
+  HANDLE done;
+  HANDLE thread;
+  volatile LONG stopping;
+  AudioSource source;
+  void *context;
+  WAVEHDR headers[audioBufferCount];
+  int16_t samples[audioBufferCount][audioBufferSamples];
+} audio;
+
+static void queueAudioBuffer(WAVEHDR &header) {
+  int16_t *samples = (int16_t *)header.lpData;
+  size_t filled = audio.source(audio.context, samples, audioBufferSamples);
+  memset(samples + filled, 0, (audioBufferSamples - filled) * 2);
+  waveOutWrite(audio.device, &header, sizeof(header));
+}
+
+static DWORD WINAPI audioThread(LPVOID) {
+  while (WaitForSingleObject(audio.done, INFINITE) == WAIT_OBJECT_0 &&
+         !audio.stopping) {
+    for (size_t i = 0; i < audioBufferCount; i++) {
+      if (audio.headers[i].dwFlags & WHDR_DONE) {
+        queueAudioBuffer(audio.headers[i]);
+      }
+    }
+  }
+  return 0;
+}
 
-uint8_t rnd_8bits() {
+bool start_audio(uint32_t sample_rate, AudioSource source, void *context) {
+  WAVEFORMATEX format = {};
+  format.wFormatTag = WAVE_FORMAT_PCM;
+  format.nChannels = 1;
+  format.nSamplesPerSec = sample_rate;
+  format.wBitsPerSample = 16;
+  format.nBlockAlign = 2;
+  format.nAvgBytesPerSec = sample_rate * 2;
+
+  // Auto-reset, signalled by the device whenever a buffer finishes.
+  audio.done = CreateEvent(NULL, FALSE, FALSE, NULL);
+  if (audio.done == NULL) {
+    return false;
+  }
+  if (waveOutOpen(&audio.device, WAVE_MAPPER, &format, (DWORD_PTR)audio.done,
+                  0, CALLBACK_EVENT) != MMSYSERR_NOERROR) {
+    CloseHandle(audio.done);
+    return false;
+  }
+  audio.stopping = 0;
+  audio.source = source;
+  audio.context = context;
+  for (size_t i = 0; i < audioBufferCount; i++) {
+    WAVEHDR &header = audio.headers[i];
+    ZeroMemory(&header, sizeof(header));
+    header.lpData = (LPSTR)audio.samples[i];
+    header.dwBufferLength = sizeof(audio.samples[i]);
+    waveOutPrepareHeader(audio.device, &header, sizeof(header));
+    queueAudioBuffer(header);
+  }
+  audio.thread = CreateThread(NULL, 0, audioThread, NULL, 0, NULL);
+  return audio.thread != NULL;
+}
+
+void stop_audio() {
+  if (audio.thread == NULL) {
+    return;
+  }
+  InterlockedExchange(&audio.stopping, 1);
+  SetEvent(audio.done);
+  WaitForSingleObject(audio.thread, INFINITE);
+  CloseHandle(audio.thread);
+  audio.thread = NULL;
+  waveOutReset(audio.device);
+  for (size_t i = 0; i < audioBufferCount; i++) {
+    waveOutUnprepareHeader(audio.device, &audio.headers[i],
+                           sizeof(audio.headers[i]));
+  }
+  waveOutClose(audio.device);
+  CloseHandle(audio.done);
+}
+
+uint32_t random_seed() {
   LARGE_INTEGER counter;
   QueryPerformanceCounter(&counter);
-  return (uint8_t)(counter.QuadPart & 0xFF);
+  return (uint32_t)(counter.QuadPart ^ (counter.QuadPart >> 32));
 }
 
-void block_for_input() {}
-
 void except_unknown_inst() {
   // TODO: Implement - This is called by the emulator when it finds an
   // unknown instruction (which should not happen in a sane program).
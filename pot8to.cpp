@@ -1,78 +1,34 @@
+#pragma once
 // #include "platform.h"
 #include "specs.h"
 #include <cstddef>
 #include <cstdint>
+#include <cstring>
+#ifdef POT8TO_TRACE
+#include <atomic>
+#include <thread>
+#endif
+// Define POT8TO_PLANES_SCALAR to build the portable two-plane sprite draw on
+// x86 too.
+#if !defined(POT8TO_PLANES_SCALAR) &&                                          \
+    (defined(__SSE2__) || defined(_M_X64) ||                                   \
+     (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define POT8TO_PLANES_SSE2
+#include <emmintrin.h>
+#endif
 
-namespace Pot8to {
-struct State {
-  // Add the default sprites here
-  uint8_t memory[POT8TO_MAX_MEMORY] = {};
-  bool keyboard[16] = {};
-  uint16_t stack[16] = {};
-  uint8_t display[POT8TO_DISPLAY_HEIGHT][POT8TO_DISPLAY_WIDTH] = {};
-  struct {
-    // General purpose registers
-    uint8_t V[16] = {};
-    // Instruction pointer
-    uint16_t I = 0;
-    // Timers
-    struct {
-      uint8_t sound = 0;
-      uint8_t delay = 0;
-    } T;
-    // Program counter - Always start at 0x200!
-    uint16_t PC = POT8TO_PROGRAM_MEMORY_INITIAL_POSITION;
-    // Stack pointer
-    uint8_t SP = 0;
-  } registers;
-};
-
-static void load_rom(State &state, Platform::Program &program) {
-  if (program.size > POT8TO_PROGRAM_MEMORY) {
-    return;
-  }
-  for (size_t i = 0; i < program.size; i++) {
-    state.memory[POT8TO_PROGRAM_MEMORY_INITIAL_POSITION + i] =
-        program.buffer[i];
-  }
-}
-
-State initialize(Platform::Program &program) {
-  State s = State{};
-
-  uint8_t default_sprites[16][5] = {
-      {0xF0, 0x90, 0x90, 0x90, 0xF0}, // 0
-      {0x20, 0x60, 0x20, 0x20, 0x70}, // 1
-      {0xF0, 0x10, 0xF0, 0x80, 0xF0}, // 2
-      {0xF0, 0x10, 0xF0, 0x10, 0xF0}, // 3
-      {0x90, 0x90, 0xF0, 0x10, 0x10}, // 4
-      {0xF0, 0x80, 0xF0, 0x10, 0xF0}, // 5
-      {0xF0, 0x80, 0xF0, 0x90, 0xF0}, // 6
-      {0xF0, 0x10, 0x20, 0x40, 0x40}, // 7
-      {0xF0, 0x90, 0xF0, 0x90, 0xF0}, // 8
-      {0xF0, 0x90, 0xF0, 0x10, 0xF0}, // 9
-      {0xF0, 0x90, 0xF0, 0x90, 0x90}, // A
-      {0xE0, 0x90, 0xE0, 0x90, 0xE0}, // B
-      {0xF0, 0x80, 0x80, 0x80, 0xF0}, // C
-      {0xE0, 0x90, 0x90, 0x90, 0xE0}, // D
-      {0xF0, 0x80, 0xF0, 0x80, 0xF0}, // E
-      {0xF0, 0x80, 0xF0, 0x80, 0x80}  // F
-  };
+// For the few helpers the dispatch loops call from many places, where the
+// compiler would rather emit a call than copy them into every handler.
+#if defined(_MSC_VER)
+#define POT8TO_FORCE_INLINE __forceinline
+#elif defined(__GNUC__)
+#define POT8TO_FORCE_INLINE inline __attribute__((always_inline))
+#else
+#define POT8TO_FORCE_INLINE inline
+#endif
 
-  // I guess the compiler will optimize this
-  // and if it doesn't who cares lol
-  for (size_t i = 0; i < 16; i++) {
-    for (size_t j = 0; j < 5; j++) {
-      s.memory[i * 5 + j] = default_sprites[i][j];
-    }
-  }
-
-  load_rom(s, program);
-
-  return s;
-}
-
-enum InstructionIdentifier {
+namespace Pot8to {
+enum InstructionIdentifier : uint8_t {
   INST_00E0,
   INST_00EE,
   INST_1NNN,
@@ -107,6 +63,19 @@ enum InstructionIdentifier {
   INST_FX33,
   INST_FX55,
   INST_FX65,
+  // SUPER-CHIP.
+  INST_00CN,
+  INST_00FB,
+  INST_00FC,
+  INST_00FD,
+  INST_00FE,
+  INST_00FF,
+  INST_FX30,
+  INST_FX75,
+  INST_FX85,
+  // XO-CHIP.
+  INST_00DN,
+  INST_FN01,
   INST_UNKNOWN
 };
 
@@ -123,11 +92,441 @@ struct Instruction {
   } address;
 };
 
-static Instruction decode_next_intruction(State &state) {
-  uint16_t inst_raw = (state.memory[state.registers.PC] << 8) |
-                      state.memory[state.registers.PC + 1];
+#ifdef POT8TO_PROFILE
+// Frames with this many instructions or more share the last bucket.
+constexpr size_t POT8TO_PROFILE_FRAME_BUCKETS = 256;
+
+// Where emulated time goes, filled in by the cores when built with
+// POT8TO_PROFILE and attached through `State::profile`. Without the flag
+// none of this exists and the cores carry no counting code.
+struct Profile {
+  uint64_t instructions;
+  uint64_t by_identifier[INST_UNKNOWN + 1];
+  // Instructions fetched from each address.
+  uint64_t by_pc[POT8TO_MAX_MEMORY];
+  // Lit sprite pixels XORed onto the display by DXYN.
+  uint64_t dxyn_pixels;
+  // A frame ends at every `decrement_timers`.
+  uint64_t frames;
+  uint64_t frame_start;
+  uint64_t frame_min;
+  uint64_t frame_max;
+  uint64_t by_frame_length[POT8TO_PROFILE_FRAME_BUCKETS];
+};
+#endif
+
+#ifdef POT8TO_TRACE
+// What one instruction did, as the cores record it when built with
+// POT8TO_TRACE. Everything but `pc`, `opcode` and the write's address is the
+// state right after the instruction. See pot8to_trace.cpp for the file.
+struct TraceRecord {
+  uint16_t pc;
+  // As it was in memory when fetched.
+  uint16_t opcode;
+  uint16_t I;
+  // First byte written to memory and a Fletcher-16 of the `written` bytes,
+  // both 0 if it wrote none.
+  uint16_t address;
+  uint16_t written_sum;
+  // The register it writes besides VF, POT8TO_TRACE_NO_REGISTER if none.
+  // For FX65 and FX85, which write V0 to VX, that is VX.
+  uint8_t x;
+  uint8_t vx;
+  uint8_t vf;
+  uint8_t SP;
+  uint8_t written;
+  uint8_t reserved;
+};
+static_assert(sizeof(TraceRecord) == 16, "trace records are 16 bytes");
 
+constexpr uint8_t POT8TO_TRACE_NO_REGISTER = 0xFF;
+
+// Records of one running `State`, attached through `State::trace`. Only the
+// thread running the state writes records and only the trace's flush thread
+// reads them, so handing them over takes no lock. See pot8to_trace.cpp.
+struct TraceRing {
+  TraceRecord *records;
+  // Capacity minus one, the capacity is a power of two.
+  uint64_t mask;
+  // Records written, only the running state moves it.
+  std::atomic<uint64_t> head;
+  // The state's last look at `tail`, read again only when the ring seems
+  // full.
+  uint64_t seen_tail;
+  // Times the state found the ring full and had to wait for the flush.
+  uint64_t stalls;
+  // An instruction is recorded once the next one is fetched, when what it
+  // did is known. Until then its record waits unpublished at `head`.
+  InstructionIdentifier pending_identifier;
+  bool has_pending;
+  // Records flushed, only the flush thread moves it. On a cache line of its
+  // own so the flush thread doesn't keep taking the state's away.
+  alignas(64) std::atomic<uint64_t> tail;
+};
+#endif
+
+#ifdef POT8TO_GUARD
+// What a guard build caught, see `POT8TO_FAULT_IF`. Without POT8TO_GUARD
+// these go unchecked and read or write out of bounds.
+enum Fault : uint8_t {
+  FAULT_NONE,
+  // FX33, FX55 or FX65 reached past the end of memory.
+  FAULT_MEMORY,
+  // 2NNN with all 16 stack entries in use.
+  FAULT_STACK_OVERFLOW,
+  // 00EE with an empty stack.
+  FAULT_STACK_UNDERFLOW,
+  // The PC is too close to the end of memory to fetch from.
+  FAULT_PC
+};
+#endif
+
+constexpr uint64_t POT8TO_ALL_ROWS = ~0ull;
+static_assert(POT8TO_HIRES_DISPLAY_HEIGHT <= 64,
+              "dirty_rows needs one bit per row");
+
+struct State {
+  // Add the default sprites here
+  uint8_t memory[POT8TO_MAX_MEMORY] = {};
+  bool keyboard[16] = {};
+  // Set by FX0A until a key is released, the key then goes into
+  // V[key_register]. See `press_key`.
+  bool waiting_for_key = false;
+  uint8_t key_register = 0;
+  uint16_t stack[16] = {};
+  // One bitmap per plane, `display_height` rows of `display_width / 64`
+  // words, bit 63 of a word is its leftmost pixel. At 64x32 row y is just
+  // `display[plane][y]`. Use `unpack_display` for a byte per pixel.
+  uint64_t display[POT8TO_DISPLAY_PLANES][POT8TO_DISPLAY_WORDS] = {};
+  // SUPER-CHIP 128x64 mode, 00FF turns it on and 00FE off.
+  bool hires = false;
+  // Planes that drawing, clearing and scrolling touch, bit p for plane p.
+  // Only XO-CHIP's FN01 changes it.
+  uint8_t planes = 1;
+  // SUPER-CHIP's RPL user flags, FX75 and FX85 copy registers to and from
+  // them.
+  uint8_t flags[16] = {};
+  struct {
+    // General purpose registers
+    uint8_t V[16] = {};
+    // Instruction pointer
+    uint16_t I = 0;
+    // Timers
+    struct {
+      uint8_t sound = 0;
+      uint8_t delay = 0;
+    } T;
+    // Program counter - Always start at 0x200!
+    uint16_t PC = POT8TO_PROGRAM_MEMORY_INITIAL_POSITION;
+    // Stack pointer
+    uint8_t SP = 0;
+  } registers;
+  // Decoded instructions for every 2-byte slot of program memory, filled
+  // lazily by `tick`. A slot is only valid while its bit is set in
+  // `decoded_valid`, writes to memory must go through `invalidate_code`.
+  Instruction decoded[POT8TO_PROGRAM_MEMORY / 2];
+  uint64_t decoded_valid[(POT8TO_PROGRAM_MEMORY / 2 + 63) / 64] = {};
+  // One bit per `POT8TO_CODE_PAGE_SIZE` bytes of memory written since the
+  // bit was last cleared. Backends that translate code (the JIT) consume it.
+  uint64_t written_pages = 0;
+  // xorshift32 state behind CXNN, never 0. Set it with `seed`.
+  uint32_t rng = POT8TO_DEFAULT_SEED;
+  // One bit per display row (bit y for row y) changed since the host last
+  // called `take_dirty_rows`. Starts all set, nothing has been drawn yet.
+  uint64_t dirty_rows = POT8TO_ALL_ROWS;
+  // Bumped by every memory write and by every FX07, FX15 and FX18, so idle
+  // loop detection can tell a loop that only spins from one with effects.
+  uint32_t memory_writes = 0;
+  uint32_t timer_accesses = 0;
+  // Instructions per pass of the loop the last `run` ended up spinning in,
+  // 0 if it didn't, and whether that loop reads or sets a timer. See
+  // `idle_until_input`.
+  uint32_t idle_period = 0;
+  bool idle_on_timers = false;
+#ifdef POT8TO_GUARD
+  // Why the last run stopped with STOP_FAULT, cleared when a run starts.
+  Fault fault = FAULT_NONE;
+#endif
+#ifdef POT8TO_PROFILE
+  // Not owned, counting is off while it is null.
+  Profile *profile = nullptr;
+#endif
+#ifdef POT8TO_TRACE
+  // Not owned, tracing is off while it is null.
+  TraceRing *trace = nullptr;
+#endif
+};
+static_assert(POT8TO_MAX_MEMORY / POT8TO_CODE_PAGE_SIZE <= 64,
+              "written_pages needs one bit per code page");
+
+// Current resolution, 64x32 or 128x64.
+size_t display_width(const State &state) {
+  return state.hires ? POT8TO_HIRES_DISPLAY_WIDTH : POT8TO_DISPLAY_WIDTH;
+}
+
+size_t display_height(const State &state) {
+  return state.hires ? POT8TO_HIRES_DISPLAY_HEIGHT : POT8TO_DISPLAY_HEIGHT;
+}
+
+#ifdef POT8TO_PROFILE
+static void profile_instruction(State &state, uint16_t pc,
+                                InstructionIdentifier identifier) {
+  if (state.profile != nullptr) {
+    state.profile->instructions++;
+    state.profile->by_identifier[identifier]++;
+    state.profile->by_pc[pc % POT8TO_MAX_MEMORY]++;
+  }
+}
+
+static void profile_pixels(State &state, uint64_t sprite) {
+  if (state.profile != nullptr) {
+    for (; sprite != 0; sprite &= sprite - 1) {
+      state.profile->dxyn_pixels++;
+    }
+  }
+}
+
+static void profile_frame(State &state) {
+  Profile *profile = state.profile;
+  if (profile == nullptr) {
+    return;
+  }
+  uint64_t length = profile->instructions - profile->frame_start;
+  if (profile->frames == 0 || length < profile->frame_min) {
+    profile->frame_min = length;
+  }
+  if (length > profile->frame_max) {
+    profile->frame_max = length;
+  }
+  profile->by_frame_length[length < POT8TO_PROFILE_FRAME_BUCKETS
+                               ? length
+                               : POT8TO_PROFILE_FRAME_BUCKETS - 1]++;
+  profile->frames++;
+  profile->frame_start = profile->instructions;
+}
+
+#define POT8TO_PROFILE_INSTRUCTION(state, pc, identifier)                      \
+  profile_instruction(state, pc, identifier)
+#define POT8TO_PROFILE_PIXELS(state, sprite) profile_pixels(state, sprite)
+#define POT8TO_PROFILE_FRAME(state) profile_frame(state)
+#else
+#define POT8TO_PROFILE_INSTRUCTION(state, pc, identifier) ((void)0)
+#define POT8TO_PROFILE_PIXELS(state, sprite) ((void)0)
+#define POT8TO_PROFILE_FRAME(state) ((void)0)
+#endif
+
+#ifdef POT8TO_TRACE
+// Fletcher-16 of `length` bytes of memory from `address`, the part past the
+// end of memory counts as zeroes.
+static uint16_t trace_checksum(const State &state, size_t address,
+                               size_t length) {
+  uint32_t low = 0;
+  uint32_t high = 0;
+  for (size_t i = 0; i < length; i++) {
+    size_t a = address + i;
+    low = (low + (a < POT8TO_MAX_MEMORY ? state.memory[a] : 0)) % 255;
+    high = (high + low) % 255;
+  }
+  return (uint16_t)(high << 8 | low);
+}
+
+// Fills in what the pending instruction did from `state`, which it just
+// left, and hands its record over.
+static void trace_finish(State &state, TraceRing &ring) {
+  uint64_t head = ring.head.load(std::memory_order_relaxed);
+  TraceRecord &record = ring.records[head & ring.mask];
+  record.I = state.registers.I;
+  record.vf = state.registers.V[0xF];
+  record.SP = state.registers.SP;
+  if (record.x != POT8TO_TRACE_NO_REGISTER) {
+    record.vx = state.registers.V[record.x];
+  }
+  if (ring.pending_identifier == INST_FX33) {
+    record.written = 3;
+  } else if (ring.pending_identifier == INST_FX55) {
+    record.written = (uint8_t)(record.x + 1);
+    // FX55 writes memory, not VX.
+    record.x = POT8TO_TRACE_NO_REGISTER;
+    record.vx = 0;
+  }
+  if (record.written != 0) {
+    record.written_sum = trace_checksum(state, record.address, record.written);
+  } else {
+    record.address = 0;
+  }
+  ring.has_pending = false;
+  ring.head.store(head + 1, std::memory_order_release);
+}
+
+// The instructions whose record has an `x`: those writing VX, and FX55 for
+// how many bytes it writes.
+static constexpr uint64_t trace_vx_instructions =
+    1ull << INST_6XNN | 1ull << INST_7XNN | 1ull << INST_8XY0 |
+    1ull << INST_8XY1 | 1ull << INST_8XY2 | 1ull << INST_8XY3 |
+    1ull << INST_8XY4 | 1ull << INST_8XY5 | 1ull << INST_8XY6 |
+    1ull << INST_8XY7 | 1ull << INST_8XYE | 1ull << INST_CXNN |
+    1ull << INST_FX07 | 1ull << INST_FX0A | 1ull << INST_FX55 |
+    1ull << INST_FX65 | 1ull << INST_FX85;
+static_assert(INST_UNKNOWN < 64, "trace_vx_instructions has a bit per opcode");
+
+// Records the previous instruction, which `pc` follows, and starts the
+// record of the one just fetched from `pc` in the next free slot, waiting
+// for the flush thread if there is none.
+#if defined(__GNUC__)
+__attribute__((noinline))
+#endif
+static void trace_instruction(State &state, uint16_t pc,
+                              const Instruction &inst) {
+  TraceRing *ring = state.trace;
+  if (ring->has_pending) {
+    trace_finish(state, *ring);
+  }
+  uint64_t head = ring->head.load(std::memory_order_relaxed);
+  if (head - ring->seen_tail > ring->mask) {
+    ring->seen_tail = ring->tail.load(std::memory_order_acquire);
+    if (head - ring->seen_tail > ring->mask) {
+      ring->stalls++;
+      do {
+        std::this_thread::yield();
+        ring->seen_tail = ring->tail.load(std::memory_order_acquire);
+      } while (head - ring->seen_tail > ring->mask);
+    }
+  }
+  TraceRecord &record = ring->records[head & ring->mask];
+  record.pc = pc;
+  record.opcode =
+      (uint16_t)(state.memory[pc] << 8 | state.memory[(pc + 1) & 0xFFF]);
+  // Where FX33 and FX55 write, before FX55 moves I.
+  record.address = state.registers.I;
+  record.written_sum = 0;
+  record.x = ((trace_vx_instructions >> inst.identifier) & 1) != 0
+                 ? inst.registers.vx
+                 : POT8TO_TRACE_NO_REGISTER;
+  record.vx = 0;
+  record.written = 0;
+  record.reserved = 0;
+  ring->pending_identifier = inst.identifier;
+  ring->has_pending = true;
+}
+
+// Only the check is copied into every handler, the rest is a call.
+#define POT8TO_TRACE_INSTRUCTION(state, pc, inst)                              \
+  if ((state).trace != nullptr) {                                              \
+    trace_instruction(state, pc, inst);                                        \
+  }
+#else
+#define POT8TO_TRACE_INSTRUCTION(state, pc, inst) ((void)0)
+#endif
+
+#ifdef POT8TO_GUARD
+// Records `kind` and skips the rest of the instruction when `condition`
+// holds, the run it is in then stops with STOP_FAULT. Costs nothing
+// without POT8TO_GUARD.
+#define POT8TO_FAULT_IF(state, condition, kind)                                \
+  if (condition) {                                                             \
+    (state).fault = (kind);                                                    \
+    return;                                                                    \
+  }
+#define POT8TO_CLEAR_FAULT(state) ((state).fault = FAULT_NONE)
+#else
+#define POT8TO_FAULT_IF(state, condition, kind) ((void)0)
+#define POT8TO_CLEAR_FAULT(state) ((void)0)
+#endif
+
+// Where `initialize` puts the 8x10 font, right after the 4x5 one.
+constexpr size_t POT8TO_BIG_FONT_ADDRESS = 16 * 5;
+
+static void load_rom(State &state, const Platform::Program &program) {
+  if (program.size > POT8TO_PROGRAM_MEMORY) {
+    return;
+  }
+  memcpy(state.memory + POT8TO_PROGRAM_MEMORY_INITIAL_POSITION, program.buffer,
+         program.size);
+}
+
+// The 4x5 digits FX29 points at.
+static const uint8_t default_sprites[16][5] = {
+    {0xF0, 0x90, 0x90, 0x90, 0xF0}, // 0
+    {0x20, 0x60, 0x20, 0x20, 0x70}, // 1
+    {0xF0, 0x10, 0xF0, 0x80, 0xF0}, // 2
+    {0xF0, 0x10, 0xF0, 0x10, 0xF0}, // 3
+    {0x90, 0x90, 0xF0, 0x10, 0x10}, // 4
+    {0xF0, 0x80, 0xF0, 0x10, 0xF0}, // 5
+    {0xF0, 0x80, 0xF0, 0x90, 0xF0}, // 6
+    {0xF0, 0x10, 0x20, 0x40, 0x40}, // 7
+    {0xF0, 0x90, 0xF0, 0x90, 0xF0}, // 8
+    {0xF0, 0x90, 0xF0, 0x10, 0xF0}, // 9
+    {0xF0, 0x90, 0xF0, 0x90, 0x90}, // A
+    {0xE0, 0x90, 0xE0, 0x90, 0xE0}, // B
+    {0xF0, 0x80, 0x80, 0x80, 0xF0}, // C
+    {0xE0, 0x90, 0x90, 0x90, 0xE0}, // D
+    {0xF0, 0x80, 0xF0, 0x80, 0xF0}, // E
+    {0xF0, 0x80, 0xF0, 0x80, 0x80}  // F
+};
+
+// SUPER-CHIP's 8x10 digits for FX30, A to F come from XO-CHIP.
+static const uint8_t big_sprites[16][10] = {
+    {0xFF, 0xFF, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF}, // 0
+    {0x18, 0x78, 0x78, 0x18, 0x18, 0x18, 0x18, 0x18, 0xFF, 0xFF}, // 1
+    {0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF}, // 2
+    {0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF}, // 3
+    {0xC3, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0x03, 0x03, 0x03, 0x03}, // 4
+    {0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF}, // 5
+    {0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF}, // 6
+    {0xFF, 0xFF, 0x03, 0x03, 0x06, 0x0C, 0x18, 0x18, 0x18, 0x18}, // 7
+    {0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF}, // 8
+    {0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF}, // 9
+    {0x7E, 0xFF, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xC3}, // A
+    {0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC}, // B
+    {0x3C, 0xFF, 0xC3, 0xC0, 0xC0, 0xC0, 0xC0, 0xC3, 0xFF, 0x3C}, // C
+    {0xFC, 0xFE, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFE, 0xFC}, // D
+    {0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF}, // E
+    {0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xC0, 0xC0}  // F
+};
+
+State initialize(const Platform::Program &program) {
+  State s = State{};
+  memcpy(s.memory, default_sprites, sizeof(default_sprites));
+  memcpy(s.memory + POT8TO_BIG_FONT_ADDRESS, big_sprites, sizeof(big_sprites));
+  load_rom(s, program);
+
+  return s;
+}
+
+// Makes `state` a copy of `initial`, for hosts that restart the same machine
+// over and over (fuzzers) or copy it every frame (run-ahead). Decoded
+// instructions only come along in blocks of 64 slots with any valid in
+// `initial`, a fresh `initialize` has none and a running program a handful,
+// so a copy is little more than memory and the display.
+void reset_state(State &state, const State &initial) {
+  const size_t cache = offsetof(State, decoded);
+  const size_t rest = offsetof(State, decoded_valid);
+  memcpy((uint8_t *)&state, (const uint8_t *)&initial, cache);
+  memcpy((uint8_t *)&state + rest, (const uint8_t *)&initial + rest,
+         sizeof(State) - rest);
+  const size_t block = 64;
+  const size_t slots = sizeof(initial.decoded) / sizeof(initial.decoded[0]);
+  for (size_t word = 0; word < sizeof(initial.decoded_valid) / 8; word++) {
+    if (initial.decoded_valid[word] != 0) {
+      size_t first = word * block;
+      size_t count = slots - first < block ? slots - first : block;
+      memcpy(&state.decoded[first], &initial.decoded[first],
+             count * sizeof(initial.decoded[0]));
+    }
+  }
+}
+
+// Restarts CXNN's sequence. 0 is not a valid xorshift state and picks
+// `POT8TO_DEFAULT_SEED` instead.
+void seed(State &state, uint32_t value) {
+  state.rng = value != 0 ? value : POT8TO_DEFAULT_SEED;
+}
+
+static Instruction decode_instruction(uint16_t inst_raw) {
   Instruction inst = {};
+  // Anything the switch below doesn't recognize, including 0NNN machine
+  // code calls.
+  inst.identifier = INST_UNKNOWN;
   switch (inst_raw & 0xF000) {
   case 0x0000:
     switch (inst_raw) {
@@ -137,6 +536,30 @@ static Instruction decode_next_intruction(State &state) {
     case 0x00EE: // 00EE
       inst.identifier = INST_00EE;
       break;
+    case 0x00FB: // 00FB
+      inst.identifier = INST_00FB;
+      break;
+    case 0x00FC: // 00FC
+      inst.identifier = INST_00FC;
+      break;
+    case 0x00FD: // 00FD
+      inst.identifier = INST_00FD;
+      break;
+    case 0x00FE: // 00FE
+      inst.identifier = INST_00FE;
+      break;
+    case 0x00FF: // 00FF
+      inst.identifier = INST_00FF;
+      break;
+    default:
+      if ((inst_raw & 0xFFF0) == 0x00C0) { // 00CN
+        inst.identifier = INST_00CN;
+        inst.address.N = inst_raw & 0x000F;
+      } else if ((inst_raw & 0xFFF0) == 0x00D0) { // 00DN
+        inst.identifier = INST_00DN;
+        inst.address.N = inst_raw & 0x000F;
+      }
+      break;
     }
     break;
   case 0x1000: // 1NNN
@@ -295,6 +718,22 @@ static Instruction decode_next_intruction(State &state) {
       inst.identifier = INST_FX65;
       inst.registers.vx = (inst_raw & 0x0F00) >> 8;
       break;
+    case 0x0030: // FX30
+      inst.identifier = INST_FX30;
+      inst.registers.vx = (inst_raw & 0x0F00) >> 8;
+      break;
+    case 0x0075: // FX75
+      inst.identifier = INST_FX75;
+      inst.registers.vx = (inst_raw & 0x0F00) >> 8;
+      break;
+    case 0x0085: // FX85
+      inst.identifier = INST_FX85;
+      inst.registers.vx = (inst_raw & 0x0F00) >> 8;
+      break;
+    case 0x0001: // FN01
+      inst.identifier = INST_FN01;
+      inst.address.N = (inst_raw & 0x0F00) >> 8;
+      break;
     }
     break;
   default:
@@ -302,226 +741,1314 @@ static Instruction decode_next_intruction(State &state) {
     break;
   };
 
-  state.registers.PC += 2;
   return inst;
 }
 
-static void execute_decoded_instruction(State &state,
-                                        const Instruction &instruction) {
-  switch (instruction.identifier) {
-  case INST_00E0:
-    for (size_t i = 0; i < POT8TO_DISPLAY_HEIGHT; i++) {
-      for (size_t j = 0; j < POT8TO_DISPLAY_WIDTH; j++) {
-        state.display[i][j] = 0;
+static Instruction decode_next_intruction(State &state) {
+  uint16_t inst_raw = (state.memory[state.registers.PC] << 8) |
+                      state.memory[state.registers.PC + 1];
+  state.registers.PC += 2;
+  return decode_instruction(inst_raw);
+}
+
+#ifdef POT8TO_CHECK_DECODE_CACHE
+#include <cstdlib>
+
+static bool same_instruction(const Instruction &a, const Instruction &b) {
+  return a.identifier == b.identifier && a.registers.vx == b.registers.vx &&
+         a.registers.vy == b.registers.vy && a.address.NNN == b.address.NNN;
+}
+#endif
+
+// Cache miss path of `fetch_decoded_instruction`, kept out of line so the
+// dispatch loops only carry the hit path.
+static const Instruction &decode_and_cache_instruction(State &state,
+                                                       Instruction &scratch) {
+  uint16_t pc = state.registers.PC;
+  scratch = decode_next_intruction(state);
+  if (pc < POT8TO_PROGRAM_MEMORY_INITIAL_POSITION || (pc & 1) != 0) {
+    return scratch;
+  }
+  size_t slot = (pc - POT8TO_PROGRAM_MEMORY_INITIAL_POSITION) >> 1;
+  state.decoded[slot] = scratch;
+  state.decoded_valid[slot >> 6] |= 1ull << (slot & 63);
+  return state.decoded[slot];
+}
+
+// Same as `decode_next_intruction` but served from `State::decoded` when the
+// slot was already decoded. Odd addresses and the interpreter area below
+// 0x200 are rare enough to always go through the decoder, those are decoded
+// into `scratch`.
+static POT8TO_FORCE_INLINE const Instruction &
+fetch_decoded_instruction(State &state, Instruction &scratch) {
+  uint16_t pc = state.registers.PC;
+#ifdef POT8TO_GUARD
+  // Leaves the PC where it is, running on faults again right away.
+  if (pc > POT8TO_MAX_MEMORY - 2) {
+    state.fault = FAULT_PC;
+    scratch = Instruction{};
+    scratch.identifier = INST_UNKNOWN;
+    return scratch;
+  }
+#endif
+  size_t slot = (size_t)(pc - POT8TO_PROGRAM_MEMORY_INITIAL_POSITION) >> 1;
+  if (pc < POT8TO_PROGRAM_MEMORY_INITIAL_POSITION || (pc & 1) != 0 ||
+      (state.decoded_valid[slot >> 6] & (1ull << (slot & 63))) == 0) {
+    const Instruction &inst = decode_and_cache_instruction(state, scratch);
+    POT8TO_PROFILE_INSTRUCTION(state, pc, inst.identifier);
+    POT8TO_TRACE_INSTRUCTION(state, pc, inst);
+    return inst;
+  }
+
+#ifdef POT8TO_CHECK_DECODE_CACHE
+  // Re-decodes every cached hit and compares, with or without NDEBUG.
+  uint16_t raw = (state.memory[pc] << 8) | state.memory[pc + 1];
+  if (!same_instruction(decode_instruction(raw), state.decoded[slot])) {
+    abort();
+  }
+#endif
+  state.registers.PC += 2;
+  POT8TO_PROFILE_INSTRUCTION(state, pc, state.decoded[slot].identifier);
+  POT8TO_TRACE_INSTRUCTION(state, pc, state.decoded[slot]);
+  return state.decoded[slot];
+}
+
+// Drops the decoded slots overlapping [address, address + length) and marks
+// their pages written so self-modifying programs see their new code.
+static void invalidate_code(State &state, size_t address, size_t length) {
+  state.memory_writes++;
+  for (size_t a = address; a < address + length && a < POT8TO_MAX_MEMORY;
+       a++) {
+    state.written_pages |= 1ull << (a / POT8TO_CODE_PAGE_SIZE);
+    if (a < POT8TO_PROGRAM_MEMORY_INITIAL_POSITION) {
+      continue;
+    }
+    size_t slot = (a - POT8TO_PROGRAM_MEMORY_INITIAL_POSITION) >> 1;
+    state.decoded_valid[slot >> 6] &= ~(1ull << (slot & 63));
+  }
+}
+
+// Behaviours that differ between CHIP-8 interpreters. The cores are templates
+// over one of these policies, so every profile compiles into its own core
+// and the checks below fold away. Pick one per ROM with `select_run`.
+enum IndexIncrement {
+  // FX55/FX65 leave I alone.
+  INDEX_UNCHANGED,
+  // I ends up at I + X (CHIP-48).
+  INDEX_PLUS_X,
+  // I ends up past the last register, I + X + 1 (COSMAC VIP).
+  INDEX_PLUS_X_PLUS_1
+};
+
+// What this interpreter has always done.
+struct DefaultQuirks {
+  // 8XY6/8XYE shift VY into VX instead of shifting VX in place.
+  static constexpr bool shift_vy = false;
+  static constexpr IndexIncrement index_increment = INDEX_UNCHANGED;
+  // DXYN clips sprites at the screen edges instead of wrapping them around.
+  static constexpr bool clip_sprites = false;
+  // 8XY1/8XY2/8XY3 clear VF.
+  static constexpr bool logic_resets_vf = false;
+  // BNNN jumps to NNN + VX, X being the top digit of NNN.
+  static constexpr bool jump_vx = false;
+  // DXY0 draws a 16x16 sprite, two bytes a row, instead of nothing.
+  static constexpr bool large_sprites = false;
+};
+
+struct CosmacVipQuirks {
+  static constexpr bool shift_vy = true;
+  static constexpr IndexIncrement index_increment = INDEX_PLUS_X_PLUS_1;
+  static constexpr bool clip_sprites = true;
+  static constexpr bool logic_resets_vf = true;
+  static constexpr bool jump_vx = false;
+  static constexpr bool large_sprites = false;
+};
+
+struct Chip48Quirks {
+  static constexpr bool shift_vy = false;
+  static constexpr IndexIncrement index_increment = INDEX_PLUS_X;
+  static constexpr bool clip_sprites = true;
+  static constexpr bool logic_resets_vf = false;
+  static constexpr bool jump_vx = true;
+  static constexpr bool large_sprites = false;
+};
+
+// SUPER-CHIP 1.1.
+struct SuperChipQuirks {
+  static constexpr bool shift_vy = false;
+  static constexpr IndexIncrement index_increment = INDEX_UNCHANGED;
+  static constexpr bool clip_sprites = true;
+  static constexpr bool logic_resets_vf = false;
+  static constexpr bool jump_vx = true;
+  static constexpr bool large_sprites = true;
+};
+
+// log2 of the words in a display row at the current resolution.
+static inline unsigned row_word_shift(const State &state) {
+  return state.hires ? 1 : 0;
+}
+
+static inline void op_00E0(State &state, const Instruction &) {
+  // Clears the selected planes. Rows that were already blank stay clean.
+  unsigned word_shift = row_word_shift(state);
+  size_t height = display_height(state);
+  // Rows are one or two words, `last` is the same word as the first in lores.
+  size_t last = ((size_t)1 << word_shift) - 1;
+  uint64_t dirty = 0;
+  for (size_t plane = 0; plane < POT8TO_DISPLAY_PLANES; plane++) {
+    if (((state.planes >> plane) & 1) == 0) {
+      continue;
+    }
+    for (size_t y = 0; y < height; y++) {
+      uint64_t *row = state.display[plane] + (y << word_shift);
+      dirty |= (uint64_t)((row[0] | row[last]) != 0) << y;
+      row[0] = 0;
+      row[last] = 0;
+    }
+  }
+  state.dirty_rows |= dirty;
+}
+
+static inline void op_2NNN(State &state, const Instruction &instruction) {
+  POT8TO_FAULT_IF(state, state.registers.SP >= 16, FAULT_STACK_OVERFLOW);
+  state.stack[state.registers.SP] = state.registers.PC;
+  state.registers.SP++;
+  state.registers.PC = instruction.address.NNN;
+}
+
+static inline void op_6XNN(State &state, const Instruction &instruction) {
+  state.registers.V[instruction.registers.vx] = instruction.address.NN;
+}
+
+static inline void op_8XY7(State &state, const Instruction &instruction) {
+  int16_t sub = (int16_t)state.registers.V[instruction.registers.vy] -
+                (int16_t)state.registers.V[instruction.registers.vx];
+  uint8_t carry_flag = sub >= 0;
+  state.registers.V[instruction.registers.vx] = (uint8_t)(sub & 0xFF);
+  state.registers.V[0xF] = carry_flag;
+}
+
+template <typename Quirks>
+static inline void op_BNNN(State &state, const Instruction &instruction) {
+  size_t offset = Quirks::jump_vx ? instruction.address.NNN >> 8 : 0;
+  state.registers.PC = instruction.address.NNN + state.registers.V[offset];
+}
+
+static inline uint8_t next_random(uint32_t &rng) {
+  uint32_t x = rng;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  rng = x;
+  return (uint8_t)(x & 0xFF);
+}
+
+static inline void op_CXNN(State &state, const Instruction &instruction) {
+  uint8_t rnd = next_random(state.rng);
+  state.registers.V[instruction.registers.vx] = rnd & instruction.address.NN;
+}
+
+// The same display word of both planes, plane 0 in the low half. Plane 1's
+// word is `POT8TO_DISPLAY_WORDS` after plane 0's.
+#ifdef POT8TO_PLANES_SSE2
+typedef __m128i PlaneWords;
+
+static inline PlaneWords plane_words(uint64_t low, uint64_t high) {
+  return _mm_set_epi64x((long long)high, (long long)low);
+}
+static inline PlaneWords plane_words_load(const uint64_t *word) {
+  __m128i low = _mm_loadl_epi64((const __m128i *)word);
+  return _mm_castpd_si128(_mm_loadh_pd(
+      _mm_castsi128_pd(low), (const double *)(word + POT8TO_DISPLAY_WORDS)));
+}
+static inline void plane_words_store(uint64_t *word, PlaneWords v) {
+  _mm_storel_epi64((__m128i *)word, v);
+  _mm_storeh_pd((double *)(word + POT8TO_DISPLAY_WORDS), _mm_castsi128_pd(v));
+}
+// Both halves rotated right by `shift`, below 64.
+static inline PlaneWords plane_words_rotate(PlaneWords v, unsigned shift) {
+  // Shifting by 64 leaves 0, so a `shift` of 0 needs no special case.
+  return _mm_or_si128(_mm_srl_epi64(v, _mm_cvtsi32_si128((int)shift)),
+                      _mm_sll_epi64(v, _mm_cvtsi32_si128(64 - (int)shift)));
+}
+static inline PlaneWords plane_words_and(PlaneWords a, PlaneWords b) {
+  return _mm_and_si128(a, b);
+}
+static inline PlaneWords plane_words_or(PlaneWords a, PlaneWords b) {
+  return _mm_or_si128(a, b);
+}
+static inline PlaneWords plane_words_xor(PlaneWords a, PlaneWords b) {
+  return _mm_xor_si128(a, b);
+}
+static inline bool plane_words_any(PlaneWords v) {
+  return _mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_setzero_si128())) != 0xFFFF;
+}
+#else
+struct PlaneWords {
+  uint64_t low, high;
+};
+
+static inline PlaneWords plane_words(uint64_t low, uint64_t high) {
+  PlaneWords v = {low, high};
+  return v;
+}
+static inline PlaneWords plane_words_load(const uint64_t *word) {
+  return plane_words(word[0], word[POT8TO_DISPLAY_WORDS]);
+}
+static inline void plane_words_store(uint64_t *word, PlaneWords v) {
+  word[0] = v.low;
+  word[POT8TO_DISPLAY_WORDS] = v.high;
+}
+static inline PlaneWords plane_words_rotate(PlaneWords v, unsigned shift) {
+  return plane_words((v.low >> shift) | (v.low << ((64 - shift) % 64)),
+                     (v.high >> shift) | (v.high << ((64 - shift) % 64)));
+}
+static inline PlaneWords plane_words_and(PlaneWords a, PlaneWords b) {
+  return plane_words(a.low & b.low, a.high & b.high);
+}
+static inline PlaneWords plane_words_or(PlaneWords a, PlaneWords b) {
+  return plane_words(a.low | b.low, a.high | b.high);
+}
+static inline PlaneWords plane_words_xor(PlaneWords a, PlaneWords b) {
+  return plane_words(a.low ^ b.low, a.high ^ b.high);
+}
+static inline bool plane_words_any(PlaneWords v) {
+  return (v.low | v.high) != 0;
+}
+#endif
+
+// The sprite row at `at`, one or two bytes at the top of a word.
+static inline uint64_t sprite_row(const State &state, size_t at,
+                                  size_t row_bytes) {
+  uint64_t sprite = (uint64_t)state.memory[at % POT8TO_MAX_MEMORY] << 56;
+  if (row_bytes == 2) {
+    sprite |= (uint64_t)state.memory[(at + 1) % POT8TO_MAX_MEMORY] << 48;
+  }
+  return sprite;
+}
+
+template <typename Quirks>
+static inline void op_DXYN(State &state, const Instruction &instruction) {
+  // state: Current state of the emulator - CPU registers, display, memory...
+  // instruction: Data decoded from the currently executing instruction.
+  //
+  // Sprites are drawn a whole row at a time: each sprite row is lined up in
+  // a 64-bit word and XORed into the one or two display words it covers,
+  // never pixel by pixel whatever the resolution. DXY0 draws 16x16
+  // sprites, two bytes per row, where the quirks have `large_sprites` and
+  // nothing elsewhere, like the original machine. With several planes selected each one takes
+  // the next sprite's worth of bytes after I, and with both selected a row
+  // of each plane is drawn together in one `PlaneWords`.
+
+  // Both resolutions are powers of two, masks wrap without dividing.
+  size_t width = display_width(state);
+  size_t height = display_height(state);
+  unsigned word_shift = row_word_shift(state);
+  size_t x = state.registers.V[instruction.registers.vx] & (width - 1);
+  size_t top = state.registers.V[instruction.registers.vy];
+  bool large = Quirks::large_sprites && instruction.address.N == 0;
+  size_t sprite_rows = large ? 16 : instruction.address.N;
+  size_t row_bytes = large ? 2 : 1;
+  size_t rows = sprite_rows;
+  if (Quirks::clip_sprites) {
+    // Only the starting position wraps, rows past the bottom are dropped.
+    top &= height - 1;
+    if (rows > height - top) {
+      rows = height - top;
+    }
+  }
+
+  // Sprite rows are rotated into place, so the pixels past the end of the
+  // first word come back around at the top of it. Those belong in the next
+  // word of the row, which past the right edge wraps around to the row's
+  // first word, or is dropped when clipping. Lores rows are a single word
+  // and take the whole rotated row.
+  size_t first = x / 64;
+  size_t second = (first + 1) & ((1u << word_shift) - 1);
+  unsigned shift = x % 64;
+  uint64_t first_mask = ~0ull >> shift;
+  uint64_t second_mask =
+      Quirks::clip_sprites && second <= first ? 0 : ~first_mask;
+  if (second == first) {
+    first_mask |= second_mask;
+  }
+
+  uint64_t collision = 0;
+  uint64_t dirty = 0;
+  size_t address = state.registers.I;
+  if (state.planes == 3) {
+    size_t plane_bytes = sprite_rows * row_bytes;
+    PlaneWords first_masks = plane_words(first_mask, first_mask);
+    PlaneWords second_masks = plane_words(second_mask, second_mask);
+    PlaneWords collisions = plane_words(0, 0);
+    for (size_t i = 0; i < rows; i++) {
+      size_t at = address + i * row_bytes;
+      uint64_t low = sprite_row(state, at, row_bytes);
+      uint64_t high = sprite_row(state, at + plane_bytes, row_bytes);
+      PlaneWords sprite = plane_words_rotate(plane_words(low, high), shift);
+      size_t y = (top + i) & (height - 1);
+      uint64_t *row = state.display[0] + (y << word_shift);
+      if (second != first) {
+        PlaneWords drawn = plane_words_and(sprite, second_masks);
+        PlaneWords words = plane_words_load(row + second);
+        collisions = plane_words_or(collisions, plane_words_and(words, drawn));
+        plane_words_store(row + second, plane_words_xor(words, drawn));
       }
+      PlaneWords drawn = plane_words_and(sprite, first_masks);
+      PlaneWords words = plane_words_load(row + first);
+      collisions = plane_words_or(collisions, plane_words_and(words, drawn));
+      plane_words_store(row + first, plane_words_xor(words, drawn));
+      // Rotating doesn't change how many pixels there are.
+      POT8TO_PROFILE_PIXELS(state, low);
+      POT8TO_PROFILE_PIXELS(state, high);
+      dirty |= (uint64_t)((low | high) != 0) << y;
     }
-    break;
+    state.dirty_rows |= dirty;
+    state.registers.V[0xF] = plane_words_any(collisions);
+    return;
+  }
+  for (size_t plane = 0; plane < POT8TO_DISPLAY_PLANES; plane++) {
+    if (((state.planes >> plane) & 1) == 0) {
+      continue;
+    }
+    uint64_t *bitmap = state.display[plane];
+    for (size_t i = 0; i < rows; i++) {
+      size_t at = address + i * row_bytes;
+      uint64_t sprite = sprite_row(state, at, row_bytes);
+      sprite = (sprite >> shift) | (sprite << ((64 - shift) % 64));
+      size_t y = (top + i) & (height - 1);
+      uint64_t *row = bitmap + (y << word_shift);
+      if (second != first) {
+        collision |= row[second] & sprite & second_mask;
+        row[second] ^= sprite & second_mask;
+      }
+      collision |= row[first] & sprite & first_mask;
+      row[first] ^= sprite & first_mask;
+      POT8TO_PROFILE_PIXELS(state, sprite);
+      // XOR with a blank sprite row leaves the display row as it was.
+      dirty |= (uint64_t)(sprite != 0) << y;
+    }
+    address += sprite_rows * row_bytes;
+  }
+  state.dirty_rows |= dirty;
+  // Set VF if collision.
+  state.registers.V[0xF] = collision != 0;
+}
 
-  case INST_2NNN:
-    state.stack[state.registers.SP] = state.registers.PC;
-    state.registers.SP++;
-    state.registers.PC = instruction.address.NNN;
-    break;
+static inline void op_3XNN(State &state, const Instruction &instruction) {
+  state.registers.PC += 2 * (state.registers.V[instruction.registers.vx] ==
+                             instruction.address.NN);
+}
 
-  case INST_6XNN:
-    state.registers.V[instruction.registers.vx] = instruction.address.NN;
-    break;
+static inline void op_00EE(State &state, const Instruction &) {
+  POT8TO_FAULT_IF(state, state.registers.SP == 0, FAULT_STACK_UNDERFLOW);
+  state.registers.SP--;
+  state.registers.PC = state.stack[state.registers.SP];
+}
 
-  case INST_8XY7: {
-    int16_t sub = (int16_t)state.registers.V[instruction.registers.vy] -
-                  (int16_t)state.registers.V[instruction.registers.vx];
-    uint8_t carry_flag = sub >= 0;
-    state.registers.V[instruction.registers.vx] = (uint8_t)(sub & 0xFF);
-    state.registers.V[0xF] = carry_flag;
-  } break;
+static inline void op_8XY5(State &state, const Instruction &instruction) {
+  int16_t sub = (int16_t)state.registers.V[instruction.registers.vx] -
+                (int16_t)state.registers.V[instruction.registers.vy];
+  uint8_t carry_flag = sub >= 0;
+  state.registers.V[instruction.registers.vx] = (uint8_t)(sub & 0xFF);
+  state.registers.V[0xF] = carry_flag;
+}
 
-  case INST_BNNN:
-    state.registers.PC = instruction.address.NNN + state.registers.V[0];
-    break;
-
-  case INST_CXNN: {
-    // We need a way to generate a random number, so let's use the platform
-    // for now.
-    uint8_t rnd = Platform::rnd_8bits();
-    state.registers.V[instruction.registers.vx] = rnd & instruction.address.NN;
-  } break;
-
-  case INST_DXYN: {
-    // state: Current state of the emulator - CPU registers, display, memory...
-    // instruction: Data decoded from the currently executing instruction.
-    bool collision = false;
-    for (size_t i = 0; i < instruction.address.N; i++) {
-      // Extract the value of each bit in the byte and interpret it as a pixel.
-      uint8_t byte = state.memory[state.registers.I + i];
-      size_t row = (state.registers.V[instruction.registers.vy] + i) %
-                   POT8TO_DISPLAY_HEIGHT;
-      for (uint8_t j = 0; j < 8; j++) {
-        // Draw the pixel.
-        uint8_t pixel = (byte >> (7 - j)) & 0b1;
-        size_t col = (state.registers.V[instruction.registers.vx] + j) %
-                     POT8TO_DISPLAY_WIDTH;
-        // Check for collision.
-        collision = collision || ((state.display[row][col] & pixel) == 1);
-        state.display[row][col] ^= pixel;
+static inline void op_4XNN(State &state, const Instruction &instruction) {
+  state.registers.PC += 2 * (state.registers.V[instruction.registers.vx] !=
+                             instruction.address.NN);
+}
+
+static inline void op_8XY0(State &state, const Instruction &instruction) {
+  state.registers.V[instruction.registers.vx] =
+      state.registers.V[instruction.registers.vy];
+}
+
+template <typename Quirks>
+static inline void op_8XY6(State &state, const Instruction &instruction) {
+  uint8_t source = state.registers.V[Quirks::shift_vy ? instruction.registers.vy
+                                                      : instruction.registers.vx];
+  uint8_t carry_flag = source & 0x01;
+  state.registers.V[instruction.registers.vx] = source >> 1;
+  state.registers.V[0xF] = carry_flag;
+}
+
+static inline void op_5XY0(State &state, const Instruction &instruction) {
+  state.registers.PC += 2 * (state.registers.V[instruction.registers.vx] ==
+                             state.registers.V[instruction.registers.vy]);
+}
+
+template <typename Quirks>
+static inline void op_8XY1(State &state, const Instruction &instruction) {
+  state.registers.V[instruction.registers.vx] |=
+      state.registers.V[instruction.registers.vy];
+  if (Quirks::logic_resets_vf) {
+    state.registers.V[0xF] = 0;
+  }
+}
+
+template <typename Quirks>
+static inline void op_8XYE(State &state, const Instruction &instruction) {
+  uint8_t source = state.registers.V[Quirks::shift_vy ? instruction.registers.vy
+                                                      : instruction.registers.vx];
+  uint8_t carry_flag = (source & 0x80) >> 7;
+  state.registers.V[instruction.registers.vx] = (uint8_t)(source << 1);
+  state.registers.V[0xF] = carry_flag;
+}
+
+static inline void op_7XNN(State &state, const Instruction &instruction) {
+  state.registers.V[instruction.registers.vx] += instruction.address.NN;
+}
+
+template <typename Quirks>
+static inline void op_8XY2(State &state, const Instruction &instruction) {
+  state.registers.V[instruction.registers.vx] &=
+      state.registers.V[instruction.registers.vy];
+  if (Quirks::logic_resets_vf) {
+    state.registers.V[0xF] = 0;
+  }
+}
+
+// Where FX55/FX65 leave I after touching V0 to VX.
+template <typename Quirks>
+static inline void advance_index(State &state, const Instruction &instruction) {
+  if (Quirks::index_increment == INDEX_PLUS_X) {
+    state.registers.I += instruction.registers.vx;
+  } else if (Quirks::index_increment == INDEX_PLUS_X_PLUS_1) {
+    state.registers.I += instruction.registers.vx + 1;
+  }
+}
+
+template <typename Quirks>
+static inline void op_FX55(State &state, const Instruction &instruction) {
+  POT8TO_FAULT_IF(state,
+                  (size_t)state.registers.I + instruction.registers.vx >=
+                      POT8TO_MAX_MEMORY,
+                  FAULT_MEMORY);
+  for (size_t i = 0; i <= instruction.registers.vx; i++) {
+    state.memory[state.registers.I + i] = state.registers.V[i];
+  }
+  invalidate_code(state, state.registers.I, instruction.registers.vx + 1);
+  advance_index<Quirks>(state, instruction);
+}
+
+static inline void op_9XY0(State &state, const Instruction &instruction) {
+  state.registers.PC += 2 * (state.registers.V[instruction.registers.vx] !=
+                             state.registers.V[instruction.registers.vy]);
+}
+
+template <typename Quirks>
+static inline void op_8XY3(State &state, const Instruction &instruction) {
+  state.registers.V[instruction.registers.vx] ^=
+      state.registers.V[instruction.registers.vy];
+  if (Quirks::logic_resets_vf) {
+    state.registers.V[0xF] = 0;
+  }
+}
+
+static inline void op_FX33(State &state, const Instruction &instruction) {
+  POT8TO_FAULT_IF(state, (size_t)state.registers.I + 2 >= POT8TO_MAX_MEMORY,
+                  FAULT_MEMORY);
+  uint8_t val = state.registers.V[instruction.registers.vx];
+  state.memory[state.registers.I] = val / 100;
+  state.memory[state.registers.I + 1] = (val / 10) % 10;
+  state.memory[state.registers.I + 2] = val % 10;
+  invalidate_code(state, state.registers.I, 3);
+}
+
+static inline void op_ANNN(State &state, const Instruction &instruction) {
+  state.registers.I = instruction.address.NNN;
+}
+
+static inline void op_8XY4(State &state, const Instruction &instruction) {
+  uint16_t sum = (uint16_t)state.registers.V[instruction.registers.vx] +
+                 (uint16_t)state.registers.V[instruction.registers.vy];
+  uint8_t carry_flag = sum > 255;
+  state.registers.V[instruction.registers.vx] = (uint8_t)(sum & 0xFF);
+  state.registers.V[0xF] = carry_flag;
+}
+
+static inline void op_1NNN(State &state, const Instruction &instruction) {
+  state.registers.PC = instruction.address.NNN;
+}
+
+static inline void op_EX9E(State &state, const Instruction &instruction) {
+  state.registers.PC += 2 * (state.keyboard[instruction.registers.vx] == 1);
+}
+
+static inline void op_EXA1(State &state, const Instruction &instruction) {
+  state.registers.PC += 2 * (state.keyboard[instruction.registers.vx] == 0);
+}
+
+static inline void op_FX07(State &state, const Instruction &instruction) {
+  state.registers.V[instruction.registers.vx] = state.registers.T.delay;
+  state.timer_accesses++;
+}
+
+// Only starts the wait, `release_key` finishes it.
+static inline void op_FX0A(State &state, const Instruction &instruction) {
+  state.waiting_for_key = true;
+  state.key_register = instruction.registers.vx;
+}
+
+static inline void op_FX15(State &state, const Instruction &instruction) {
+  state.registers.T.delay = state.registers.V[instruction.registers.vx];
+  state.timer_accesses++;
+}
+
+static inline void op_FX18(State &state, const Instruction &instruction) {
+  state.registers.T.sound = state.registers.V[instruction.registers.vx];
+  state.timer_accesses++;
+}
+
+static inline void op_FX1E(State &state, const Instruction &instruction) {
+  state.registers.I += state.registers.V[instruction.registers.vx];
+}
+
+static inline void op_FX29(State &state, const Instruction &instruction) {
+  state.registers.I = state.registers.V[instruction.registers.vx] * 5;
+}
+
+template <typename Quirks>
+static inline void op_FX65(State &state, const Instruction &instruction) {
+  POT8TO_FAULT_IF(state,
+                  (size_t)state.registers.I + instruction.registers.vx >=
+                      POT8TO_MAX_MEMORY,
+                  FAULT_MEMORY);
+  for (size_t i = 0; i <= instruction.registers.vx; i++) {
+    state.registers.V[i] = state.memory[state.registers.I + i];
+  }
+  advance_index<Quirks>(state, instruction);
+}
+
+// Moves the selected planes `rows` rows down, or up, blanking the rows
+// scrolled in.
+static void scroll_vertical(State &state, size_t rows, bool down) {
+  unsigned word_shift = row_word_shift(state);
+  size_t height = display_height(state);
+  if (rows > height) {
+    rows = height;
+  }
+  size_t kept = (height - rows) << word_shift;
+  size_t blanked = rows << word_shift;
+  for (size_t plane = 0; plane < POT8TO_DISPLAY_PLANES; plane++) {
+    if (((state.planes >> plane) & 1) == 0) {
+      continue;
+    }
+    uint64_t *bitmap = state.display[plane];
+    if (down) {
+      memmove(bitmap + blanked, bitmap, kept * sizeof(uint64_t));
+      memset(bitmap, 0, blanked * sizeof(uint64_t));
+    } else {
+      memmove(bitmap, bitmap + blanked, kept * sizeof(uint64_t));
+      memset(bitmap + kept, 0, blanked * sizeof(uint64_t));
+    }
+  }
+  state.dirty_rows = POT8TO_ALL_ROWS;
+}
+
+// Moves the selected planes 4 pixels right, or left, carrying pixels across
+// the words of a row.
+static void scroll_horizontal(State &state, bool right) {
+  size_t words = (size_t)1 << row_word_shift(state);
+  size_t height = display_height(state);
+  for (size_t plane = 0; plane < POT8TO_DISPLAY_PLANES; plane++) {
+    if (((state.planes >> plane) & 1) == 0) {
+      continue;
+    }
+    for (size_t y = 0; y < height; y++) {
+      uint64_t *row = state.display[plane] + y * words;
+      if (right) {
+        for (size_t w = words; w-- > 0;) {
+          row[w] = (row[w] >> 4) | (w > 0 ? row[w - 1] << 60 : 0);
+        }
+      } else {
+        for (size_t w = 0; w < words; w++) {
+          row[w] = (row[w] << 4) | (w + 1 < words ? row[w + 1] >> 60 : 0);
+        }
       }
     }
-    // Set VF if collision.
-    state.registers.V[0xF] = collision ? 1 : 0;
-  } break;
+  }
+  state.dirty_rows = POT8TO_ALL_ROWS;
+}
+
+// 00FE/00FF, switching resolution blanks every plane.
+static void set_resolution(State &state, bool hires) {
+  state.hires = hires;
+  memset(state.display, 0, sizeof(state.display));
+  state.dirty_rows = POT8TO_ALL_ROWS;
+}
+
+static inline void op_00CN(State &state, const Instruction &instruction) {
+  scroll_vertical(state, instruction.address.N, true);
+}
 
+static inline void op_00DN(State &state, const Instruction &instruction) {
+  scroll_vertical(state, instruction.address.N, false);
+}
+
+static inline void op_00FB(State &state, const Instruction &) {
+  scroll_horizontal(state, true);
+}
+
+static inline void op_00FC(State &state, const Instruction &) {
+  scroll_horizontal(state, false);
+}
+
+static inline void op_00FD(State &state, const Instruction &) {
+  // SUPER-CHIP exits the interpreter here. There is nothing to exit to, the
+  // program stays on this instruction instead.
+  state.registers.PC -= 2;
+}
+
+static inline void op_00FE(State &state, const Instruction &) {
+  set_resolution(state, false);
+}
+
+static inline void op_00FF(State &state, const Instruction &) {
+  set_resolution(state, true);
+}
+
+static inline void op_FX30(State &state, const Instruction &instruction) {
+  state.registers.I =
+      POT8TO_BIG_FONT_ADDRESS +
+      (state.registers.V[instruction.registers.vx] & 0xF) * 10;
+}
+
+static inline void op_FX75(State &state, const Instruction &instruction) {
+  for (size_t i = 0; i <= instruction.registers.vx; i++) {
+    state.flags[i] = state.registers.V[i];
+  }
+}
+
+static inline void op_FX85(State &state, const Instruction &instruction) {
+  for (size_t i = 0; i <= instruction.registers.vx; i++) {
+    state.registers.V[i] = state.flags[i];
+  }
+}
+
+static inline void op_FN01(State &state, const Instruction &instruction) {
+  state.planes = instruction.address.N & ((1u << POT8TO_DISPLAY_PLANES) - 1);
+}
+
+static inline void op_UNKNOWN(State &, const Instruction &) {
+  Platform::except_unknown_inst();
+}
+
+template <typename Quirks>
+static POT8TO_FORCE_INLINE void
+execute_decoded_instruction(State &state, const Instruction &instruction) {
+  switch (instruction.identifier) {
+  case INST_00E0:
+    op_00E0(state, instruction);
+    break;
+  case INST_2NNN:
+    op_2NNN(state, instruction);
+    break;
+  case INST_6XNN:
+    op_6XNN(state, instruction);
+    break;
+  case INST_8XY7:
+    op_8XY7(state, instruction);
+    break;
+  case INST_BNNN:
+    op_BNNN<Quirks>(state, instruction);
+    break;
+  case INST_CXNN:
+    op_CXNN(state, instruction);
+    break;
+  case INST_DXYN:
+    op_DXYN<Quirks>(state, instruction);
+    break;
   case INST_3XNN:
-    state.registers.PC += 2 * (state.registers.V[instruction.registers.vx] ==
-                               instruction.address.NN);
+    op_3XNN(state, instruction);
     break;
-
   case INST_00EE:
-    state.registers.SP--;
-    state.registers.PC = state.stack[state.registers.SP];
+    op_00EE(state, instruction);
+    break;
+  case INST_8XY5:
+    op_8XY5(state, instruction);
     break;
-
-  case INST_8XY5: {
-    int16_t sub = (int16_t)state.registers.V[instruction.registers.vx] -
-                  (int16_t)state.registers.V[instruction.registers.vy];
-    uint8_t carry_flag = sub >= 0;
-    state.registers.V[instruction.registers.vx] = (uint8_t)(sub & 0xFF);
-    state.registers.V[0xF] = carry_flag;
-  } break;
-
   case INST_4XNN:
-    state.registers.PC += 2 * (state.registers.V[instruction.registers.vx] !=
-                               instruction.address.NN);
+    op_4XNN(state, instruction);
     break;
-
   case INST_8XY0:
-    state.registers.V[instruction.registers.vx] =
-        state.registers.V[instruction.registers.vy];
+    op_8XY0(state, instruction);
+    break;
+  case INST_8XY6:
+    op_8XY6<Quirks>(state, instruction);
     break;
-
-  case INST_8XY6: {
-    // NOTE: Some implementations seem to shift VY too??
-    uint8_t carry_flag = state.registers.V[instruction.registers.vx] & 0x01;
-    state.registers.V[instruction.registers.vx] >>= 1;
-    state.registers.V[0xF] = carry_flag;
-  } break;
-
   case INST_5XY0:
-    state.registers.PC += 2 * (state.registers.V[instruction.registers.vx] ==
-                               state.registers.V[instruction.registers.vy]);
+    op_5XY0(state, instruction);
     break;
-
   case INST_8XY1:
-    state.registers.V[instruction.registers.vx] |=
-        state.registers.V[instruction.registers.vy];
+    op_8XY1<Quirks>(state, instruction);
+    break;
+  case INST_8XYE:
+    op_8XYE<Quirks>(state, instruction);
     break;
-
-  case INST_8XYE: {
-    // NOTE: Some implementations seem to shift VY too??
-    uint8_t carry_flag =
-        (state.registers.V[instruction.registers.vx] & 0x80) >> 7;
-    state.registers.V[instruction.registers.vx] <<= 1;
-    state.registers.V[0xF] = carry_flag;
-  } break;
-
   case INST_7XNN:
-    state.registers.V[instruction.registers.vx] += instruction.address.NN;
+    op_7XNN(state, instruction);
     break;
-
   case INST_8XY2:
-    state.registers.V[instruction.registers.vx] &=
-        state.registers.V[instruction.registers.vy];
+    op_8XY2<Quirks>(state, instruction);
     break;
-
   case INST_FX55:
-    // NOTE: Apparently some implementations increment I after the loop??
-    for (size_t i = 0; i <= instruction.registers.vx; i++) {
-      state.memory[state.registers.I + i] = state.registers.V[i];
-    }
+    op_FX55<Quirks>(state, instruction);
     break;
-
   case INST_9XY0:
-    state.registers.PC += 2 * (state.registers.V[instruction.registers.vx] !=
-                               state.registers.V[instruction.registers.vy]);
+    op_9XY0(state, instruction);
     break;
-
   case INST_8XY3:
-    state.registers.V[instruction.registers.vx] ^=
-        state.registers.V[instruction.registers.vy];
+    op_8XY3<Quirks>(state, instruction);
+    break;
+  case INST_FX33:
+    op_FX33(state, instruction);
     break;
-
-  case INST_FX33: {
-    uint8_t val = state.registers.V[instruction.registers.vx];
-    state.memory[state.registers.I] = val / 100;
-    state.memory[state.registers.I + 1] = (val / 10) % 10;
-    state.memory[state.registers.I + 2] = val % 10;
-  } break;
-
   case INST_ANNN:
-    state.registers.I = instruction.address.NNN;
+    op_ANNN(state, instruction);
+    break;
+  case INST_8XY4:
+    op_8XY4(state, instruction);
     break;
-
-  case INST_8XY4: {
-    uint16_t sum = (uint16_t)state.registers.V[instruction.registers.vx] +
-                   (uint16_t)state.registers.V[instruction.registers.vy];
-    uint8_t carry_flag = sum > 255;
-    state.registers.V[instruction.registers.vx] = (uint8_t)(sum & 0xFF);
-    state.registers.V[0xF] = carry_flag;
-  } break;
-
   case INST_1NNN:
-    state.registers.PC = instruction.address.NNN;
+    op_1NNN(state, instruction);
     break;
-
   case INST_EX9E:
-    state.registers.PC += 2 * (state.keyboard[instruction.registers.vx] == 1);
+    op_EX9E(state, instruction);
     break;
-
   case INST_EXA1:
-    state.registers.PC += 2 * (state.keyboard[instruction.registers.vx] == 0);
+    op_EXA1(state, instruction);
     break;
-
   case INST_FX07:
-    state.registers.V[instruction.registers.vx] = state.registers.T.delay;
+    op_FX07(state, instruction);
     break;
-
   case INST_FX0A:
-    Platform::block_for_input();
-    // TODO: Blocking wait for input (use the platform)
+    op_FX0A(state, instruction);
     break;
-
   case INST_FX15:
-    state.registers.T.delay = state.registers.V[instruction.registers.vx];
+    op_FX15(state, instruction);
     break;
-
   case INST_FX18:
-    state.registers.T.sound = state.registers.V[instruction.registers.vx];
+    op_FX18(state, instruction);
     break;
-
   case INST_FX1E:
-    state.registers.I += state.registers.V[instruction.registers.vx];
+    op_FX1E(state, instruction);
     break;
-
   case INST_FX29:
-    state.registers.I = state.registers.V[instruction.registers.vx] * 5;
+    op_FX29(state, instruction);
     break;
-
   case INST_FX65:
-    for (size_t i = 0; i <= instruction.registers.vx; i++) {
-      state.registers.V[i] = state.memory[state.registers.I + i];
-    }
+    op_FX65<Quirks>(state, instruction);
+    break;
+  case INST_00CN:
+    op_00CN(state, instruction);
+    break;
+  case INST_00DN:
+    op_00DN(state, instruction);
+    break;
+  case INST_00FB:
+    op_00FB(state, instruction);
+    break;
+  case INST_00FC:
+    op_00FC(state, instruction);
+    break;
+  case INST_00FD:
+    op_00FD(state, instruction);
+    break;
+  case INST_00FE:
+    op_00FE(state, instruction);
+    break;
+  case INST_00FF:
+    op_00FF(state, instruction);
+    break;
+  case INST_FX30:
+    op_FX30(state, instruction);
+    break;
+  case INST_FX75:
+    op_FX75(state, instruction);
+    break;
+  case INST_FX85:
+    op_FX85(state, instruction);
+    break;
+  case INST_FN01:
+    op_FN01(state, instruction);
     break;
-
   case INST_UNKNOWN:
-    Platform::except_unknown_inst();
+    op_UNKNOWN(state, instruction);
     break;
   }
 }
 
-void tick(State &state) {
-  Instruction inst = decode_next_intruction(state);
-  execute_decoded_instruction(state, inst);
+static POT8TO_FORCE_INLINE void
+execute_decoded_instruction(State &state, const Instruction &instruction) {
+  execute_decoded_instruction<DefaultQuirks>(state, instruction);
+}
+
+// Runs one instruction, or nothing while FX0A waits for a key: FX0A has
+// already moved PC past itself, so running on would skip the wait.
+template <typename Quirks> void tick(State &state) {
+  if (state.waiting_for_key) {
+    return;
+  }
+  Instruction scratch;
+  const Instruction &inst = fetch_decoded_instruction(state, scratch);
+  execute_decoded_instruction<Quirks>(state, inst);
+}
+
+void tick(State &state) { tick<DefaultQuirks>(state); }
+
+enum StopReason {
+  // Internal to the run loops: keep going.
+  STOP_NONE,
+  STOP_BUDGET_EXHAUSTED,
+  // An instruction that draws, clears, scrolls or switches resolution ran.
+  STOP_DISPLAY_CHANGED,
+  // FX0A ran, or the run started out waiting for a key and did nothing.
+  STOP_WAITING_FOR_KEY,
+  // The sound timer went from 0 to non-zero.
+  STOP_SOUND_STARTED,
+  STOP_UNKNOWN_INSTRUCTION,
+  // Only with POT8TO_GUARD: an instruction faulted, `State::fault` says
+  // why, and did nothing else.
+  STOP_FAULT
+};
+
+struct RunResult {
+  StopReason reason;
+  // Instructions executed, including the one that caused the stop. A run
+  // waiting for a key counts its whole budget, the original machine spins
+  // in FX0A all that time too.
+  size_t executed;
+};
+
+// What every core returns while FX0A waits: nothing runs until
+// `release_key`, so hosts can go on with their frame right away.
+static inline RunResult wait_for_key(size_t budget) {
+  RunResult result = {STOP_WAITING_FOR_KEY, budget};
+  return result;
+}
+
+// Why a run loop has to return after `inst` executed, given the sound timer
+// from before it ran.
+static POT8TO_FORCE_INLINE StopReason stop_reason_after(const State &state,
+                                                       const Instruction &inst,
+                                                       uint8_t sound_before) {
+#ifdef POT8TO_GUARD
+  if (state.fault != FAULT_NONE) {
+    return STOP_FAULT;
+  }
+#endif
+  switch (inst.identifier) {
+  case INST_00E0:
+  case INST_DXYN:
+  case INST_00CN:
+  case INST_00DN:
+  case INST_00FB:
+  case INST_00FC:
+  case INST_00FE:
+  case INST_00FF:
+    return STOP_DISPLAY_CHANGED;
+  case INST_FX0A:
+    return STOP_WAITING_FOR_KEY;
+  case INST_FX18:
+    return sound_before == 0 && state.registers.T.sound != 0
+               ? STOP_SOUND_STARTED
+               : STOP_NONE;
+  case INST_UNKNOWN:
+    return STOP_UNKNOWN_INSTRUCTION;
+  default:
+    return STOP_NONE;
+  }
+}
+
+// Idle loops: a program waiting for a timer or a key spins in a loop that
+// can't get anywhere until the host calls `decrement_timers` or changes a
+// key, and neither happens during a `run`. The cores look at the state
+// after every backward jump. Once a pass through a loop comes back to the
+// same PC with nothing else changed either, every following pass must do
+// exactly the same, so the cores count as many whole passes as fit in the
+// budget as executed without running them. Only the instructions left over
+// actually run, the result is the same state either way.
+//
+// Define POT8TO_NO_IDLE_SKIP to run every instruction, e.g. to time the
+// cores themselves.
+
+// Everything that decides what a loop does next, apart from the keys and
+// the display, which the host and the stopping instructions take care of.
+struct IdleSnapshot {
+  uint8_t V[16];
+  uint16_t stack[16];
+  uint8_t flags[16];
+  uint16_t PC;
+  uint16_t I;
+  uint8_t SP;
+  uint8_t delay;
+  uint8_t sound;
+  uint8_t planes;
+  bool hires;
+  uint32_t rng;
+  uint32_t memory_writes;
+};
+
+struct IdleWatch {
+  // Instructions executed in this run when `snapshot` was taken, SIZE_MAX
+  // before the first backward jump.
+  size_t executed;
+  // Backward jumps since `snapshot` was taken, it is retaken when they
+  // reach `horizon`, which then doubles (Brent's cycle detection). A loop
+  // of any length gets caught while busy code only pays for a compare that
+  // fails on the first field that changed.
+  size_t jumps;
+  size_t horizon;
+  uint32_t timer_accesses;
+  IdleSnapshot snapshot;
+};
+
+static inline void idle_watch_reset(IdleWatch &watch) {
+  watch.executed = SIZE_MAX;
+  watch.jumps = 0;
+  watch.horizon = 1;
+}
+
+static inline void idle_snapshot(const State &state, IdleSnapshot &snapshot) {
+  memcpy(snapshot.V, state.registers.V, sizeof(snapshot.V));
+  memcpy(snapshot.stack, state.stack, sizeof(snapshot.stack));
+  memcpy(snapshot.flags, state.flags, sizeof(snapshot.flags));
+  snapshot.PC = state.registers.PC;
+  snapshot.I = state.registers.I;
+  snapshot.SP = state.registers.SP;
+  snapshot.delay = state.registers.T.delay;
+  snapshot.sound = state.registers.T.sound;
+  snapshot.planes = state.planes;
+  snapshot.hires = state.hires;
+  snapshot.rng = state.rng;
+  snapshot.memory_writes = state.memory_writes;
+}
+
+// Cheapest and most likely to differ first.
+static inline bool idle_matches(const State &state,
+                                const IdleSnapshot &snapshot) {
+  return state.registers.PC == snapshot.PC &&
+         memcmp(state.registers.V, snapshot.V, sizeof(snapshot.V)) == 0 &&
+         state.registers.I == snapshot.I && state.rng == snapshot.rng &&
+         state.memory_writes == snapshot.memory_writes &&
+         state.registers.T.delay == snapshot.delay &&
+         state.registers.T.sound == snapshot.sound &&
+         state.registers.SP == snapshot.SP &&
+         memcmp(state.stack, snapshot.stack, sizeof(snapshot.stack)) == 0 &&
+         memcmp(state.flags, snapshot.flags, sizeof(snapshot.flags)) == 0 &&
+         state.planes == snapshot.planes && state.hires == snapshot.hires;
+}
+
+// Called after a backward jump, `executed` instructions into a run of
+// `budget`. Returns how many instructions can be counted as executed
+// without running them, a whole number of passes through the loop.
+static inline size_t idle_fast_forward(State &state, IdleWatch &watch,
+                                       size_t executed, size_t budget) {
+#ifdef POT8TO_PROFILE
+  if (state.profile != nullptr) {
+    // The profile has to see every instruction.
+    return 0;
+  }
+#endif
+#ifdef POT8TO_TRACE
+  if (state.trace != nullptr) {
+    return 0;
+  }
+#endif
+  if (watch.executed != SIZE_MAX && idle_matches(state, watch.snapshot)) {
+    size_t period = executed - watch.executed;
+    size_t skipped = (budget - executed) / period * period;
+    state.idle_period = (uint32_t)period;
+    state.idle_on_timers = state.timer_accesses != watch.timer_accesses;
+    watch.executed = executed + skipped;
+    return skipped;
+  }
+  if (++watch.jumps >= watch.horizon) {
+    watch.executed = executed;
+    watch.jumps = 0;
+    watch.horizon *= 2;
+    watch.timer_accesses = state.timer_accesses;
+    idle_snapshot(state, watch.snapshot);
+  }
+  return 0;
+}
+
+#ifdef POT8TO_NO_IDLE_SKIP
+#define POT8TO_IDLE_CHECK(state, watch, from, executed, budget)               \
+  (void)(from);                                                                \
+  (void)(watch)
+#else
+// `from` is the PC before the jump was fetched, anything at or below it
+// went backward.
+#define POT8TO_IDLE_CHECK(state, watch, from, executed, budget)               \
+  if ((state).registers.PC <= (from)) {                                        \
+    (executed) += idle_fast_forward((state), (watch), (executed), (budget));   \
+  }
+#endif
+
+// Executes the next instruction and returns `stop_reason_after` for it.
+template <typename Quirks>
+static POT8TO_FORCE_INLINE StopReason step(State &state, Instruction &scratch) {
+  const Instruction &inst = fetch_decoded_instruction(state, scratch);
+  uint8_t sound_before = state.registers.T.sound;
+  execute_decoded_instruction<Quirks>(state, inst);
+  return stop_reason_after(state, inst, sound_before);
+}
+
+static POT8TO_FORCE_INLINE StopReason step(State &state, Instruction &scratch) {
+  return step<DefaultQuirks>(state, scratch);
+}
+
+// Runs up to `budget` instructions through the switch in
+// `execute_decoded_instruction`, returning early after any instruction the
+// host may want to react to.
+template <typename Quirks> RunResult run_switch(State &state, size_t budget) {
+  if (state.waiting_for_key) {
+    return wait_for_key(budget);
+  }
+  POT8TO_CLEAR_FAULT(state);
+  Instruction scratch;
+  IdleWatch watch;
+  idle_watch_reset(watch);
+  state.idle_period = 0;
+  RunResult result = {STOP_BUDGET_EXHAUSTED, 0};
+  while (result.executed < budget) {
+    uint16_t from = state.registers.PC;
+    StopReason reason = step<Quirks>(state, scratch);
+    result.executed++;
+    if (reason != STOP_NONE) {
+      result.reason = reason;
+      break;
+    }
+    POT8TO_IDLE_CHECK(state, watch, from, result.executed, budget);
+  }
+  return result;
+}
+
+// Threaded dispatch: every handler fetches the next instruction and jumps
+// straight to its handler, so each opcode gets its own indirect branch
+// instead of all of them sharing the one in the switch. Uses computed goto
+// where the compiler has it and a handler table everywhere else. Stops
+// exactly like `run_switch`.
+template <typename Quirks> RunResult run_threaded(State &state, size_t budget) {
+  if (state.waiting_for_key) {
+    return wait_for_key(budget);
+  }
+  POT8TO_CLEAR_FAULT(state);
+  IdleWatch watch;
+  idle_watch_reset(watch);
+  state.idle_period = 0;
+  RunResult result = {STOP_BUDGET_EXHAUSTED, 0};
+#if defined(__GNUC__)
+  // Same order as `InstructionIdentifier`.
+  static void *const handlers[] = {
+      &&do_00E0, &&do_00EE, &&do_1NNN, &&do_2NNN, &&do_3XNN, &&do_4XNN,
+      &&do_5XY0, &&do_6XNN, &&do_7XNN, &&do_8XY0, &&do_8XY1, &&do_8XY2,
+      &&do_8XY3, &&do_8XY4, &&do_8XY5, &&do_8XY6, &&do_8XY7, &&do_8XYE,
+      &&do_9XY0, &&do_ANNN, &&do_BNNN, &&do_CXNN, &&do_DXYN, &&do_EX9E,
+      &&do_EXA1, &&do_FX07, &&do_FX0A, &&do_FX15, &&do_FX18, &&do_FX1E,
+      &&do_FX29, &&do_FX33, &&do_FX55, &&do_FX65, &&do_00CN, &&do_00FB,
+      &&do_00FC, &&do_00FD, &&do_00FE, &&do_00FF, &&do_FX30, &&do_FX75,
+      &&do_FX85, &&do_00DN, &&do_FN01, &&do_UNKNOWN};
+  static_assert(sizeof(handlers) / sizeof(handlers[0]) == INST_UNKNOWN + 1,
+                "handlers must cover every InstructionIdentifier");
+
+  Instruction scratch;
+  const Instruction *inst;
+#ifdef POT8TO_GUARD
+#define POT8TO_STOP_ON_FAULT()                                                 \
+  if (state.fault != FAULT_NONE) {                                             \
+    result.reason = STOP_FAULT;                                                \
+    return result;                                                             \
+  }
+#else
+#define POT8TO_STOP_ON_FAULT() ((void)0)
+#endif
+#define POT8TO_DISPATCH()                                                      \
+  POT8TO_STOP_ON_FAULT();                                                      \
+  if (result.executed == budget) {                                             \
+    return result;                                                             \
+  }                                                                            \
+  result.executed++;                                                           \
+  inst = &fetch_decoded_instruction(state, scratch);                           \
+  goto *handlers[inst->identifier]
+#define POT8TO_HANDLER(name)                                                   \
+  do_##name : op_##name(state, *inst);                                         \
+  POT8TO_DISPATCH()
+#define POT8TO_QUIRK_HANDLER(name)                                             \
+  do_##name : op_##name<Quirks>(state, *inst);                                 \
+  POT8TO_DISPATCH()
+#define POT8TO_QUIRK_STOPPING_HANDLER(name, stop_reason)                       \
+  do_##name : op_##name<Quirks>(state, *inst);                                 \
+  result.reason = stop_reason;                                                 \
+  return result
+#define POT8TO_STOPPING_HANDLER(name, stop_reason)                             \
+  do_##name : op_##name(state, *inst);                                         \
+  POT8TO_STOP_ON_FAULT();                                                      \
+  result.reason = stop_reason;                                                 \
+  return result
+// Instructions that can go backward, see `idle_fast_forward`. The PC has
+// already moved past the instruction when its handler runs.
+#define POT8TO_JUMP_HANDLER(name, op)                                          \
+  do_##name : {                                                                \
+    uint16_t from = (uint16_t)(state.registers.PC - 2);                        \
+    op(state, *inst);                                                          \
+    POT8TO_IDLE_CHECK(state, watch, from, result.executed, budget);            \
+  }                                                                            \
+  POT8TO_DISPATCH()
+
+  POT8TO_DISPATCH();
+  POT8TO_STOPPING_HANDLER(00E0, STOP_DISPLAY_CHANGED);
+  POT8TO_JUMP_HANDLER(00EE, op_00EE);
+  POT8TO_JUMP_HANDLER(1NNN, op_1NNN);
+  POT8TO_JUMP_HANDLER(2NNN, op_2NNN);
+  POT8TO_HANDLER(3XNN);
+  POT8TO_HANDLER(4XNN);
+  POT8TO_HANDLER(5XY0);
+  POT8TO_HANDLER(6XNN);
+  POT8TO_HANDLER(7XNN);
+  POT8TO_HANDLER(8XY0);
+  POT8TO_QUIRK_HANDLER(8XY1);
+  POT8TO_QUIRK_HANDLER(8XY2);
+  POT8TO_QUIRK_HANDLER(8XY3);
+  POT8TO_HANDLER(8XY4);
+  POT8TO_HANDLER(8XY5);
+  POT8TO_QUIRK_HANDLER(8XY6);
+  POT8TO_HANDLER(8XY7);
+  POT8TO_QUIRK_HANDLER(8XYE);
+  POT8TO_HANDLER(9XY0);
+  POT8TO_HANDLER(ANNN);
+  POT8TO_JUMP_HANDLER(BNNN, op_BNNN<Quirks>);
+  POT8TO_HANDLER(CXNN);
+  POT8TO_QUIRK_STOPPING_HANDLER(DXYN, STOP_DISPLAY_CHANGED);
+  POT8TO_HANDLER(EX9E);
+  POT8TO_HANDLER(EXA1);
+  POT8TO_HANDLER(FX07);
+  POT8TO_STOPPING_HANDLER(FX0A, STOP_WAITING_FOR_KEY);
+  POT8TO_HANDLER(FX15);
+do_FX18 : {
+  bool silent = state.registers.T.sound == 0;
+  op_FX18(state, *inst);
+  if (silent && state.registers.T.sound != 0) {
+    result.reason = STOP_SOUND_STARTED;
+    return result;
+  }
+}
+  POT8TO_DISPATCH();
+  POT8TO_HANDLER(FX1E);
+  POT8TO_HANDLER(FX29);
+  POT8TO_HANDLER(FX33);
+  POT8TO_QUIRK_HANDLER(FX55);
+  POT8TO_QUIRK_HANDLER(FX65);
+  POT8TO_STOPPING_HANDLER(00CN, STOP_DISPLAY_CHANGED);
+  POT8TO_STOPPING_HANDLER(00FB, STOP_DISPLAY_CHANGED);
+  POT8TO_STOPPING_HANDLER(00FC, STOP_DISPLAY_CHANGED);
+  POT8TO_JUMP_HANDLER(00FD, op_00FD);
+  POT8TO_STOPPING_HANDLER(00FE, STOP_DISPLAY_CHANGED);
+  POT8TO_STOPPING_HANDLER(00FF, STOP_DISPLAY_CHANGED);
+  POT8TO_HANDLER(FX30);
+  POT8TO_HANDLER(FX75);
+  POT8TO_HANDLER(FX85);
+  POT8TO_STOPPING_HANDLER(00DN, STOP_DISPLAY_CHANGED);
+  POT8TO_HANDLER(FN01);
+  POT8TO_STOPPING_HANDLER(UNKNOWN, STOP_UNKNOWN_INSTRUCTION);
+#undef POT8TO_JUMP_HANDLER
+#undef POT8TO_QUIRK_STOPPING_HANDLER
+#undef POT8TO_QUIRK_HANDLER
+#undef POT8TO_STOPPING_HANDLER
+#undef POT8TO_HANDLER
+#undef POT8TO_DISPATCH
+#undef POT8TO_STOP_ON_FAULT
+#else
+  typedef void (*Handler)(State &, const Instruction &);
+  // Same order as `InstructionIdentifier`.
+  static const Handler handlers[] = {
+      op_00E0,         op_00EE,         op_1NNN,         op_2NNN,
+      op_3XNN,         op_4XNN,         op_5XY0,         op_6XNN,
+      op_7XNN,         op_8XY0,         op_8XY1<Quirks>, op_8XY2<Quirks>,
+      op_8XY3<Quirks>, op_8XY4,         op_8XY5,         op_8XY6<Quirks>,
+      op_8XY7,         op_8XYE<Quirks>, op_9XY0,         op_ANNN,
+      op_BNNN<Quirks>, op_CXNN,         op_DXYN<Quirks>, op_EX9E,
+      op_EXA1,         op_FX07,         op_FX0A,         op_FX15,
+      op_FX18,         op_FX1E,         op_FX29,         op_FX33,
+      op_FX55<Quirks>, op_FX65<Quirks>, op_00CN,         op_00FB,
+      op_00FC,         op_00FD,         op_00FE,         op_00FF,
+      op_FX30,         op_FX75,         op_FX85,         op_00DN,
+      op_FN01,         op_UNKNOWN};
+  static_assert(sizeof(handlers) / sizeof(handlers[0]) == INST_UNKNOWN + 1,
+                "handlers must cover every InstructionIdentifier");
+
+  Instruction scratch;
+  while (result.executed < budget) {
+    uint16_t from = state.registers.PC;
+    const Instruction &inst = fetch_decoded_instruction(state, scratch);
+    uint8_t sound_before = state.registers.T.sound;
+    handlers[inst.identifier](state, inst);
+    result.executed++;
+    StopReason reason = stop_reason_after(state, inst, sound_before);
+    if (reason != STOP_NONE) {
+      result.reason = reason;
+      break;
+    }
+    POT8TO_IDLE_CHECK(state, watch, from, result.executed, budget);
+  }
+#endif
+  return result;
+}
+
+// Runs up to `budget` instructions on the interpreter core picked at build
+// time (define POT8TO_THREADED_DISPATCH for `run_threaded`). Returns after
+// the budget is spent or right after an instruction the host may want to
+// react to, see `StopReason`.
+template <typename Quirks> RunResult run(State &state, size_t budget) {
+#ifdef POT8TO_THREADED_DISPATCH
+  return run_threaded<Quirks>(state, budget);
+#else
+  return run_switch<Quirks>(state, budget);
+#endif
+}
+
+// The cores for this interpreter's own behaviour, see `DefaultQuirks`.
+RunResult run_switch(State &state, size_t budget) {
+  return run_switch<DefaultQuirks>(state, budget);
+}
+
+RunResult run_threaded(State &state, size_t budget) {
+  return run_threaded<DefaultQuirks>(state, budget);
+}
+
+RunResult run(State &state, size_t budget) {
+  return run<DefaultQuirks>(state, budget);
+}
+
+enum QuirkProfile {
+  QUIRKS_DEFAULT,
+  QUIRKS_COSMAC_VIP,
+  QUIRKS_CHIP48,
+  QUIRKS_SUPER_CHIP
+};
+
+typedef RunResult (*RunFunction)(State &state, size_t budget);
+
+// `run` specialised for `profile`. Look it up once per ROM and keep calling
+// the result, the choice costs nothing per instruction.
+RunFunction select_run(QuirkProfile profile) {
+  switch (profile) {
+  case QUIRKS_COSMAC_VIP:
+    return run<CosmacVipQuirks>;
+  case QUIRKS_CHIP48:
+    return run<Chip48Quirks>;
+  case QUIRKS_SUPER_CHIP:
+    return run<SuperChipQuirks>;
+  default:
+    return run<DefaultQuirks>;
+  }
 }
 
 void decrement_timers(State &state) {
+  POT8TO_PROFILE_FRAME(state);
   state.registers.T.delay =
       state.registers.T.delay > 0 ? state.registers.T.delay - 1 : 0;
 
@@ -529,4 +2056,134 @@ void decrement_timers(State &state) {
       state.registers.T.sound > 0 ? state.registers.T.sound - 1 : 0;
 }
 
+// Hosts report keys through these rather than writing `keyboard`, so
+// FX0A can finish. Like on the COSMAC VIP the wait ends when a key goes up
+// again, not when it goes down.
+void press_key(State &state, uint8_t key) {
+  state.keyboard[key & 0xF] = true;
+}
+
+void release_key(State &state, uint8_t key) {
+  key &= 0xF;
+  bool was_down = state.keyboard[key];
+  state.keyboard[key] = false;
+  if (state.waiting_for_key && was_down) {
+    state.registers.V[state.key_register] = key;
+    state.waiting_for_key = false;
+  }
+}
+
+void set_key(State &state, uint8_t key, bool down) {
+  if (down) {
+    press_key(state, key);
+  } else {
+    release_key(state, key);
+  }
+}
+
+// True if the last `run` ended in a loop that neither reads nor sets a
+// timer, or is waiting in FX0A, so it will keep spinning the same way until
+// a key changes. Hosts can sleep until then, or skip the frames with
+// `skip_idle_frames`.
+bool idle_until_input(const State &state) {
+  return state.waiting_for_key ||
+         (state.idle_period != 0 && !state.idle_on_timers);
+}
+
+// Counts `frames` frames of `instructions_per_frame` instructions as run,
+// with `decrement_timers` after each, and returns how many instructions
+// (less than one pass of the loop) still have to run on the same core to
+// end up in the state running them all would have. Only valid while
+// `idle_until_input` holds and the keys haven't changed since that run.
+uint64_t skip_idle_frames(State &state, uint64_t frames,
+                          size_t instructions_per_frame) {
+  uint8_t &delay = state.registers.T.delay;
+  uint8_t &sound = state.registers.T.sound;
+  delay = frames < delay ? (uint8_t)(delay - frames) : 0;
+  sound = frames < sound ? (uint8_t)(sound - frames) : 0;
+  if (state.waiting_for_key) {
+    return 0;
+  }
+  return frames * instructions_per_frame % state.idle_period;
+}
+
+// Compares everything a program can observe, ignoring caches.
+bool same_emulated_state(const State &a, const State &b) {
+  return memcmp(a.memory, b.memory, sizeof(a.memory)) == 0 &&
+         memcmp(a.keyboard, b.keyboard, sizeof(a.keyboard)) == 0 &&
+         a.waiting_for_key == b.waiting_for_key &&
+         a.key_register == b.key_register &&
+         memcmp(a.stack, b.stack, sizeof(a.stack)) == 0 &&
+         memcmp(a.display, b.display, sizeof(a.display)) == 0 &&
+         memcmp(a.registers.V, b.registers.V, sizeof(a.registers.V)) == 0 &&
+         a.registers.I == b.registers.I &&
+         a.registers.T.sound == b.registers.T.sound &&
+         a.registers.T.delay == b.registers.T.delay &&
+         a.registers.PC == b.registers.PC && a.registers.SP == b.registers.SP &&
+         a.rng == b.rng && a.hires == b.hires && a.planes == b.planes &&
+         memcmp(a.flags, b.flags, sizeof(a.flags)) == 0;
+}
+
+// True if any row changed since the last `take_dirty_rows`, hosts can skip
+// presenting the frame otherwise.
+bool frame_changed(const State &state) { return state.dirty_rows != 0; }
+
+// Returns the rows changed since the last call (bit y for row y) and marks
+// them all clean. Hosts repaint just those rows.
+uint64_t take_dirty_rows(State &state) {
+  uint64_t rows = state.dirty_rows;
+  state.dirty_rows = 0;
+  return rows;
+}
+
+// The display as the host draws it, at the current resolution.
+Platform::Frame display_frame(const State &state) {
+  Platform::Frame frame;
+  for (size_t plane = 0; plane < POT8TO_DISPLAY_PLANES; plane++) {
+    frame.planes[plane] = state.display[plane];
+  }
+  frame.width = display_width(state);
+  frame.height = display_height(state);
+  return frame;
+}
+
+// Colour of the pixel at (`x`, `y`): bit p is set if it's lit on plane p.
+static inline uint8_t pixel_colour(const State &state, size_t x, size_t y) {
+  size_t word = (y << row_word_shift(state)) + x / 64;
+  uint8_t colour = 0;
+  for (size_t plane = 0; plane < POT8TO_DISPLAY_PLANES; plane++) {
+    colour |= ((state.display[plane][word] >> (63 - x % 64)) & 1) << plane;
+  }
+  return colour;
+}
+
+// Expands the packed display to one colour byte per pixel (see
+// `pixel_colour`), `display_width` pixels per row for `display_height` rows.
+void unpack_display(const State &state,
+                    uint8_t pixels[POT8TO_HIRES_DISPLAY_WIDTH *
+                                   POT8TO_HIRES_DISPLAY_HEIGHT]) {
+  size_t width = display_width(state);
+  size_t height = display_height(state);
+  for (size_t y = 0; y < height; y++) {
+    for (size_t x = 0; x < width; x++) {
+      pixels[y * width + x] = pixel_colour(state, x, y);
+    }
+  }
+}
+
+// FNV-1a over the display, one byte per pixel so checksums stay comparable
+// with the old unpacked display. Cheap enough to compare runs frame by frame.
+uint64_t display_hash(const State &state) {
+  uint64_t hash = 0xCBF29CE484222325ull;
+  size_t width = display_width(state);
+  size_t height = display_height(state);
+  for (size_t y = 0; y < height; y++) {
+    for (size_t x = 0; x < width; x++) {
+      hash ^= pixel_colour(state, x, y);
+      hash *= 0x100000001B3ull;
+    }
+  }
+  return hash;
+}
+
 } // namespace Pot8to
@@ -0,0 +1,607 @@
+#pragma once
+// Ahead-of-time recompiler: turns ROMs into C++ that is built into the host.
+//
+// `aot_translate` follows the control flow of a ROM from 0x200 with the
+// core's own decoder and splits it into basic blocks. Each ROM becomes one
+// function with a label per block, every operand is a constant and blocks
+// whose successor is known jump straight to it. Only the default behaviour
+// is translated, like the JIT.
+//
+// The generated function has the same contract as `run`. Anything it can't
+// know ahead of time goes back through the interpreter one instruction at a
+// time: addresses no block starts at, which 00EE and BNNN often land on,
+// blocks that don't fit in the budget left, and blocks whose bytes were
+// overwritten since (FX33, FX55). Instructions that stop a run end their
+// block and return, and jumps go through the same idle loop check as the
+// interpreter, so the resulting state is the interpreter's.
+//
+// build/linux_aot.sh recompiles roms/ and checks each one with --verify.
+#include "pot8to.cpp"
+#include <cstdarg>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+namespace Pot8to {
+
+// One recompiled ROM, as listed by the generated file.
+struct AotProgram {
+  // File name of the ROM.
+  const char *name;
+  // The ROM's bytes, which the code was made from.
+  const uint8_t *rom;
+  size_t size;
+  RunFunction run;
+};
+
+// Used by generated code: true if the `length` bytes at `address` are still
+// the ROM's. Only the `pages` written to since the program started can
+// differ, see `State::written_pages`.
+static POT8TO_FORCE_INLINE bool aot_code_intact(const State &state,
+                                                const uint8_t *rom,
+                                                uint64_t pages, size_t address,
+                                                size_t length) {
+  return (state.written_pages & pages) == 0 ||
+         memcmp(state.memory + address,
+                rom + (address - POT8TO_PROGRAM_MEMORY_INITIAL_POSITION),
+                length) == 0;
+}
+
+// The program recompiled from exactly these bytes, NULL if there is none.
+const AotProgram *aot_find(const AotProgram *programs, size_t count,
+                           const Platform::Program &rom) {
+  for (size_t i = 0; i < count; i++) {
+    if (programs[i].size == rom.size &&
+        memcmp(programs[i].rom, rom.buffer, rom.size) == 0) {
+      return &programs[i];
+    }
+  }
+  return NULL;
+}
+
+// How an instruction ends its block, if it does.
+enum AotExit {
+  AOT_NEXT,
+  // Skips the next instruction or not.
+  AOT_SKIP,
+  // 1NNN, and 00FD which jumps to itself.
+  AOT_JUMP,
+  AOT_CALL,
+  // 00EE and BNNN, the target is only known at run time.
+  AOT_DYNAMIC,
+  // Writes memory, possibly the code right after it.
+  AOT_WRITE,
+  // May stop the run, see `stop_reason_after`.
+  AOT_STOP
+};
+
+static AotExit aot_exit(InstructionIdentifier identifier) {
+  switch (identifier) {
+  case INST_3XNN:
+  case INST_4XNN:
+  case INST_5XY0:
+  case INST_9XY0:
+  case INST_EX9E:
+  case INST_EXA1:
+    return AOT_SKIP;
+  case INST_1NNN:
+  case INST_00FD:
+    return AOT_JUMP;
+  case INST_2NNN:
+    return AOT_CALL;
+  case INST_00EE:
+  case INST_BNNN:
+    return AOT_DYNAMIC;
+  case INST_FX33:
+  case INST_FX55:
+    return AOT_WRITE;
+  case INST_00E0:
+  case INST_DXYN:
+  case INST_00CN:
+  case INST_00DN:
+  case INST_00FB:
+  case INST_00FC:
+  case INST_00FE:
+  case INST_00FF:
+  case INST_FX0A:
+  case INST_FX18:
+  case INST_UNKNOWN:
+    return AOT_STOP;
+  default:
+    return AOT_NEXT;
+  }
+}
+
+// Blocks longer than this are split, so one still fits in a frame's budget
+// most of the time.
+constexpr size_t POT8TO_AOT_MAX_BLOCK_INSTRUCTIONS = 64;
+
+// What `aot_translate` found, for the tool to report.
+struct AotStats {
+  size_t blocks;
+  size_t instructions;
+};
+
+static bool aot_fetch(const Platform::Program &rom, size_t address,
+                      uint16_t &raw) {
+  if (address < POT8TO_PROGRAM_MEMORY_INITIAL_POSITION ||
+      address + 2 > POT8TO_PROGRAM_MEMORY_INITIAL_POSITION + rom.size) {
+    return false;
+  }
+  size_t offset = address - POT8TO_PROGRAM_MEMORY_INITIAL_POSITION;
+  raw = (uint16_t)((rom.buffer[offset] << 8) | rom.buffer[offset + 1]);
+  return true;
+}
+
+static void aot_append(std::string &out, const char *format, ...) {
+  char line[256];
+  va_list args;
+  va_start(args, format);
+  vsnprintf(line, sizeof(line), format, args);
+  va_end(args);
+  out += line;
+}
+
+// Follows every path from 0x200 and marks the addresses blocks start at:
+// jump, call and skip targets, and whatever follows an instruction that
+// ends a block.
+static std::vector<bool> aot_find_blocks(const Platform::Program &rom) {
+  std::vector<bool> leader(POT8TO_MAX_MEMORY, false);
+  std::vector<bool> visited(POT8TO_MAX_MEMORY, false);
+  std::vector<size_t> work;
+  work.push_back(POT8TO_PROGRAM_MEMORY_INITIAL_POSITION);
+  leader[POT8TO_PROGRAM_MEMORY_INITIAL_POSITION] = true;
+  while (!work.empty()) {
+    size_t address = work.back();
+    work.pop_back();
+    uint16_t raw;
+    if (!aot_fetch(rom, address, raw) || visited[address]) {
+      continue;
+    }
+    visited[address] = true;
+    Instruction inst = decode_instruction(raw);
+    size_t targets[2];
+    size_t count = 0;
+    switch (aot_exit(inst.identifier)) {
+    case AOT_NEXT:
+      work.push_back(address + 2);
+      break;
+    case AOT_SKIP:
+      targets[count++] = address + 2;
+      targets[count++] = address + 4;
+      break;
+    case AOT_JUMP:
+      targets[count++] = inst.identifier == INST_1NNN ? inst.address.NNN
+                                                      : address;
+      break;
+    case AOT_CALL:
+      targets[count++] = inst.address.NNN;
+      // Where 00EE comes back to.
+      targets[count++] = address + 2;
+      break;
+    case AOT_DYNAMIC:
+      if (inst.identifier == INST_BNNN) {
+        // Jump tables: a run of 1NNN from NNN on.
+        for (size_t at = inst.address.NNN;
+             at < (size_t)inst.address.NNN + 256 && aot_fetch(rom, at, raw) &&
+             decode_instruction(raw).identifier == INST_1NNN;
+             at += 2) {
+          leader[at] = true;
+          work.push_back(at);
+        }
+      }
+      break;
+    case AOT_WRITE:
+    case AOT_STOP:
+      targets[count++] = address + 2;
+      break;
+    }
+    for (size_t i = 0; i < count; i++) {
+      if (targets[i] < POT8TO_MAX_MEMORY) {
+        leader[targets[i]] = true;
+        work.push_back(targets[i]);
+      }
+    }
+  }
+  // Only addresses with an instruction to run make a block.
+  for (size_t address = 0; address < POT8TO_MAX_MEMORY; address++) {
+    leader[address] = leader[address] && visited[address];
+  }
+  return leader;
+}
+
+// Continues at `address`: straight into its block if it has one, through
+// the dispatch switch otherwise.
+static void aot_goto(std::string &out, const std::vector<bool> &leader,
+                     size_t address, const char *indent = "  ") {
+  if (address < POT8TO_MAX_MEMORY && leader[address]) {
+    aot_append(out, "%sgoto block_%03zx;\n", indent, address);
+  } else {
+    aot_append(out, "%sgoto dispatch;\n", indent);
+  }
+}
+
+// The part of `inst` that doesn't touch the PC, with `V` pointing at the
+// registers.
+static void aot_emit_body(std::string &out, const Instruction &inst,
+                          uint16_t raw) {
+  unsigned x = inst.registers.vx;
+  unsigned y = inst.registers.vy;
+  unsigned nn = inst.address.NN;
+  unsigned shift_source = DefaultQuirks::shift_vy ? y : x;
+  switch (inst.identifier) {
+  case INST_6XNN:
+    aot_append(out, "  V[0x%X] = 0x%02X;\n", x, nn);
+    break;
+  case INST_7XNN:
+    aot_append(out, "  V[0x%X] += 0x%02X;\n", x, nn);
+    break;
+  case INST_8XY0:
+    aot_append(out, "  V[0x%X] = V[0x%X];\n", x, y);
+    break;
+  case INST_8XY1:
+  case INST_8XY2:
+  case INST_8XY3: {
+    const char *op = inst.identifier == INST_8XY1   ? "|="
+                     : inst.identifier == INST_8XY2 ? "&="
+                                                    : "^=";
+    aot_append(out, "  V[0x%X] %s V[0x%X];\n", x, op, y);
+    if (DefaultQuirks::logic_resets_vf) {
+      out += "  V[0xF] = 0;\n";
+    }
+    break;
+  }
+  case INST_8XY4:
+    aot_append(out,
+               "  {\n    unsigned sum = V[0x%X] + V[0x%X];\n"
+               "    V[0x%X] = (uint8_t)sum;\n    V[0xF] = sum > 255;\n  }\n",
+               x, y, x);
+    break;
+  case INST_8XY5:
+  case INST_8XY7: {
+    unsigned a = inst.identifier == INST_8XY5 ? x : y;
+    unsigned b = inst.identifier == INST_8XY5 ? y : x;
+    aot_append(out,
+               "  {\n    int difference = V[0x%X] - V[0x%X];\n"
+               "    V[0x%X] = (uint8_t)difference;\n"
+               "    V[0xF] = difference >= 0;\n  }\n",
+               a, b, x);
+    break;
+  }
+  case INST_8XY6:
+    aot_append(out,
+               "  {\n    uint8_t source = V[0x%X];\n"
+               "    V[0x%X] = source >> 1;\n    V[0xF] = source & 1;\n  }\n",
+               shift_source, x);
+    break;
+  case INST_8XYE:
+    aot_append(out,
+               "  {\n    uint8_t source = V[0x%X];\n"
+               "    V[0x%X] = (uint8_t)(source << 1);\n"
+               "    V[0xF] = source >> 7;\n  }\n",
+               shift_source, x);
+    break;
+  case INST_ANNN:
+    aot_append(out, "  state.registers.I = 0x%03X;\n", inst.address.NNN);
+    break;
+  case INST_CXNN:
+    aot_append(out, "  V[0x%X] = next_random(state.rng) & 0x%02X;\n", x, nn);
+    break;
+  case INST_FX07:
+    aot_append(out,
+               "  V[0x%X] = state.registers.T.delay;\n"
+               "  state.timer_accesses++;\n",
+               x);
+    break;
+  case INST_FX15:
+    aot_append(out,
+               "  state.registers.T.delay = V[0x%X];\n"
+               "  state.timer_accesses++;\n",
+               x);
+    break;
+  case INST_FX1E:
+    aot_append(out, "  state.registers.I += V[0x%X];\n", x);
+    break;
+  case INST_FX29:
+    aot_append(out, "  state.registers.I = V[0x%X] * 5;\n", x);
+    break;
+  case INST_FX30:
+    aot_append(out,
+               "  state.registers.I = POT8TO_BIG_FONT_ADDRESS + "
+               "(V[0x%X] & 0xF) * 10;\n",
+               x);
+    break;
+  case INST_FX65:
+    for (unsigned i = 0; i <= x; i++) {
+      aot_append(out, "  V[0x%X] = state.memory[state.registers.I + %u];\n",
+                 i, i);
+    }
+    if (DefaultQuirks::index_increment != INDEX_UNCHANGED) {
+      aot_append(out, "  state.registers.I += %u;\n",
+                 DefaultQuirks::index_increment == INDEX_PLUS_X ? x : x + 1);
+    }
+    break;
+  case INST_FX75:
+    for (unsigned i = 0; i <= x; i++) {
+      aot_append(out, "  state.flags[0x%X] = V[0x%X];\n", i, i);
+    }
+    break;
+  case INST_FX85:
+    for (unsigned i = 0; i <= x; i++) {
+      aot_append(out, "  V[0x%X] = state.flags[0x%X];\n", i, i);
+    }
+    break;
+  case INST_FN01:
+    aot_append(out, "  state.planes = 0x%X;\n",
+               inst.address.N & ((1u << POT8TO_DISPLAY_PLANES) - 1));
+    break;
+  case INST_FX33:
+    aot_append(out, "  op_FX33(state, decode_instruction(0x%04X));\n", raw);
+    break;
+  case INST_FX55:
+    aot_append(out,
+               "  op_FX55<DefaultQuirks>(state, decode_instruction(0x%04X));\n",
+               raw);
+    break;
+  default:
+    break;
+  }
+}
+
+// Condition under which a skip instruction skips.
+static void aot_skip_condition(char *condition, size_t size,
+                               const Instruction &inst) {
+  unsigned x = inst.registers.vx;
+  unsigned y = inst.registers.vy;
+  switch (inst.identifier) {
+  case INST_3XNN:
+    snprintf(condition, size, "V[0x%X] == 0x%02X", x, inst.address.NN);
+    break;
+  case INST_4XNN:
+    snprintf(condition, size, "V[0x%X] != 0x%02X", x, inst.address.NN);
+    break;
+  case INST_5XY0:
+    snprintf(condition, size, "V[0x%X] == V[0x%X]", x, y);
+    break;
+  case INST_9XY0:
+    snprintf(condition, size, "V[0x%X] != V[0x%X]", x, y);
+    break;
+  // Same keyboard indexing as `op_EX9E` and `op_EXA1`.
+  case INST_EX9E:
+    snprintf(condition, size, "state.keyboard[0x%X]", x);
+    break;
+  default:
+    snprintf(condition, size, "!state.keyboard[0x%X]", x);
+    break;
+  }
+}
+
+// Name of the interpreter function for a stopping instruction, with its
+// stop reason.
+static const char *aot_stop_call(InstructionIdentifier identifier,
+                                 const char *&reason) {
+  reason = "STOP_DISPLAY_CHANGED";
+  switch (identifier) {
+  case INST_00E0:
+    return "op_00E0";
+  case INST_DXYN:
+    return "op_DXYN<DefaultQuirks>";
+  case INST_00CN:
+    return "op_00CN";
+  case INST_00DN:
+    return "op_00DN";
+  case INST_00FB:
+    return "op_00FB";
+  case INST_00FC:
+    return "op_00FC";
+  case INST_00FE:
+    return "op_00FE";
+  case INST_00FF:
+    return "op_00FF";
+  case INST_FX0A:
+    reason = "STOP_WAITING_FOR_KEY";
+    return "op_FX0A";
+  default:
+    reason = "STOP_UNKNOWN_INSTRUCTION";
+    return "op_UNKNOWN";
+  }
+}
+
+// The PC ends up at `next`, through a jump back to `from` the idle loop
+// check gets a look.
+static void aot_emit_jump(std::string &out, const std::vector<bool> &leader,
+                          size_t from, size_t next, bool dynamic) {
+  if (!dynamic) {
+    aot_append(out, "  state.registers.PC = 0x%03zX;\n", next);
+  }
+  aot_append(out,
+             "  POT8TO_IDLE_CHECK(state, watch, 0x%03zX, result.executed, "
+             "budget);\n",
+             from);
+  if (dynamic) {
+    out += "  goto dispatch;\n";
+  } else {
+    aot_goto(out, leader, next);
+  }
+}
+
+static void aot_emit_block(std::string &out, const Platform::Program &rom,
+                           const std::vector<bool> &leader, size_t index,
+                           size_t start, AotStats &stats) {
+  // Instructions up to and including the one that ends the block.
+  std::vector<Instruction> insts;
+  std::vector<uint16_t> raws;
+  size_t address = start;
+  AotExit exit = AOT_NEXT;
+  uint16_t raw;
+  while (insts.size() < POT8TO_AOT_MAX_BLOCK_INSTRUCTIONS &&
+         (address == start || !leader[address]) &&
+         aot_fetch(rom, address, raw)) {
+    Instruction inst = decode_instruction(raw);
+    insts.push_back(inst);
+    raws.push_back(raw);
+    address += 2;
+    exit = aot_exit(inst.identifier);
+    if (exit != AOT_NEXT) {
+      break;
+    }
+  }
+  size_t count = insts.size();
+  size_t last = start + 2 * (count - 1);
+  uint64_t pages = 0;
+  for (size_t a = start; a < address; a++) {
+    pages |= 1ull << (a / POT8TO_CODE_PAGE_SIZE);
+  }
+  stats.blocks++;
+  stats.instructions += count;
+
+  aot_append(out, "block_%03zx:\n", start);
+  aot_append(out,
+             "  if (budget - result.executed < %zu ||\n"
+             "      !aot_code_intact(state, aot_rom_%zu, 0x%llxull, 0x%03zX, "
+             "%zu)) {\n"
+             "    goto interpret;\n  }\n",
+             count, index, (unsigned long long)pages, start, address - start);
+  for (size_t i = 0; i + 1 < count; i++) {
+    aot_emit_body(out, insts[i], raws[i]);
+  }
+  const Instruction &end = insts[count - 1];
+  if (exit == AOT_NEXT || exit == AOT_WRITE) {
+    aot_emit_body(out, end, raws[count - 1]);
+  }
+  aot_append(out, "  result.executed += %zu;\n", count);
+
+  switch (exit) {
+  case AOT_NEXT:
+  case AOT_WRITE:
+    aot_append(out, "  state.registers.PC = 0x%03zX;\n", address);
+    aot_goto(out, leader, address);
+    break;
+  case AOT_SKIP: {
+    char condition[64];
+    aot_skip_condition(condition, sizeof(condition), end);
+    aot_append(out, "  if (%s) {\n    state.registers.PC = 0x%03zX;\n",
+               condition, last + 4);
+    aot_goto(out, leader, last + 4, "    ");
+    out += "  }\n";
+    aot_append(out, "  state.registers.PC = 0x%03zX;\n", last + 2);
+    aot_goto(out, leader, last + 2);
+    break;
+  }
+  case AOT_JUMP:
+    aot_emit_jump(out, leader, last,
+                  end.identifier == INST_1NNN ? end.address.NNN : last, false);
+    break;
+  case AOT_CALL:
+    aot_append(out,
+               "  state.stack[state.registers.SP] = 0x%03zX;\n"
+               "  state.registers.SP++;\n",
+               last + 2);
+    aot_emit_jump(out, leader, last, end.address.NNN, false);
+    break;
+  case AOT_DYNAMIC:
+    if (end.identifier == INST_00EE) {
+      out += "  state.registers.SP--;\n"
+             "  state.registers.PC = state.stack[state.registers.SP];\n";
+    } else {
+      aot_append(out,
+                 "  op_BNNN<DefaultQuirks>(state, decode_instruction(0x%04X));"
+                 "\n",
+                 raws[count - 1]);
+    }
+    aot_emit_jump(out, leader, last, 0, true);
+    break;
+  case AOT_STOP:
+    aot_append(out, "  state.registers.PC = 0x%03zX;\n", last + 2);
+    if (end.identifier == INST_FX18) {
+      // Only stops when the sound starts.
+      aot_append(out,
+                 "  {\n"
+                 "    bool silent = state.registers.T.sound == 0;\n"
+                 "    op_FX18(state, decode_instruction(0x%04X));\n"
+                 "    if (silent && state.registers.T.sound != 0) {\n"
+                 "      result.reason = STOP_SOUND_STARTED;\n"
+                 "      return result;\n"
+                 "    }\n"
+                 "  }\n",
+                 raws[count - 1]);
+      aot_goto(out, leader, last + 2);
+    } else {
+      const char *reason;
+      const char *call = aot_stop_call(end.identifier, reason);
+      aot_append(out,
+                 "  %s(state, decode_instruction(0x%04X));\n"
+                 "  result.reason = %s;\n  return result;\n",
+                 call, raws[count - 1], reason);
+    }
+    break;
+  }
+}
+
+// Appends `rom` recompiled into `RunResult aot_run_<index>(State &, size_t)`
+// and its bytes as `aot_rom_<index>`.
+void aot_translate(const Platform::Program &rom, const char *name,
+                   size_t index, std::string &out, AotStats &stats) {
+  stats.blocks = 0;
+  stats.instructions = 0;
+  std::vector<bool> leader = aot_find_blocks(rom);
+
+  aot_append(out, "// %s\nstatic const uint8_t aot_rom_%zu[] = {", name,
+             index);
+  for (size_t i = 0; i < rom.size; i++) {
+    aot_append(out, i % 12 == 0 ? "\n    0x%02x," : " 0x%02x,", rom.buffer[i]);
+  }
+  out += "\n};\n\n";
+
+  aot_append(out, "static RunResult aot_run_%zu(State &state, size_t budget) "
+                  "{\n",
+             index);
+  std::string blocks;
+  for (size_t address = 0; address < POT8TO_MAX_MEMORY; address++) {
+    if (leader[address]) {
+      aot_emit_block(blocks, rom, leader, index, address, stats);
+    }
+  }
+
+  out += "  if (state.waiting_for_key) {\n"
+         "    return wait_for_key(budget);\n"
+         "  }\n";
+  if (blocks.find("V[") != std::string::npos) {
+    out += "  uint8_t *const V = state.registers.V;\n";
+  }
+  out += "  Instruction scratch;\n"
+         "  IdleWatch watch;\n"
+         "  idle_watch_reset(watch);\n"
+         "  state.idle_period = 0;\n"
+         "  RunResult result = {STOP_BUDGET_EXHAUSTED, 0};\n"
+         "dispatch:\n"
+         "  switch (state.registers.PC) {\n";
+  for (size_t address = 0; address < POT8TO_MAX_MEMORY; address++) {
+    if (leader[address]) {
+      aot_append(out, "  case 0x%03zX:\n    goto block_%03zx;\n", address,
+                 address);
+    }
+  }
+  out += "  default:\n"
+         "    break;\n"
+         "  }\n"
+         "interpret:\n"
+         "  if (result.executed >= budget) {\n"
+         "    return result;\n"
+         "  }\n"
+         "  {\n"
+         "    uint16_t from = state.registers.PC;\n"
+         "    StopReason reason = step(state, scratch);\n"
+         "    result.executed++;\n"
+         "    if (reason != STOP_NONE) {\n"
+         "      result.reason = reason;\n"
+         "      return result;\n"
+         "    }\n"
+         "    POT8TO_IDLE_CHECK(state, watch, from, result.executed, budget);\n"
+         "  }\n"
+         "  goto dispatch;\n";
+  out += blocks;
+  out += "}\n\n";
+}
+
+} // namespace Pot8to
@@ -0,0 +1,134 @@
+#pragma once
+// Sound as a stream of samples instead of a blocking beep.
+//
+// Once per frame the emulation thread renders what the sound timer says,
+// a square wave while it is non-zero and silence otherwise, into an
+// `AudioRing`. The host's audio thread drains the ring at its own pace. The
+// ring is single-producer single-consumer and lock-free, neither side ever
+// waits for the other: a full ring drops the newest samples, an empty one
+// plays silence.
+//
+// Samples are mono signed 16-bit at POT8TO_AUDIO_SAMPLE_RATE.
+#include "pot8to.cpp"
+#include <atomic>
+
+namespace Pot8to {
+
+constexpr uint32_t POT8TO_AUDIO_SAMPLE_RATE = 44100;
+// One 1/60 s frame of samples.
+constexpr size_t POT8TO_AUDIO_FRAME_SAMPLES = POT8TO_AUDIO_SAMPLE_RATE / 60;
+// Must be a power of two. Around 0.19 s, enough to ride out a late frame.
+constexpr size_t POT8TO_AUDIO_RING_SAMPLES = 8192;
+constexpr int16_t POT8TO_AUDIO_AMPLITUDE = 0x1800;
+constexpr size_t POT8TO_WAV_HEADER_SIZE = 44;
+
+struct AudioRing {
+  // Samples written and read so far, the difference is what is buffered.
+  // Each counter is written by one side only and sits on its own cache
+  // line.
+  alignas(64) std::atomic<size_t> written;
+  alignas(64) std::atomic<size_t> read;
+  alignas(64) int16_t samples[POT8TO_AUDIO_RING_SAMPLES];
+};
+
+void audio_ring_reset(AudioRing &ring) {
+  ring.written.store(0, std::memory_order_relaxed);
+  ring.read.store(0, std::memory_order_relaxed);
+}
+
+// Producer side. Copies as many of the `count` samples as fit and returns
+// how many that was.
+size_t audio_ring_write(AudioRing &ring, const int16_t *samples,
+                        size_t count) {
+  size_t written = ring.written.load(std::memory_order_relaxed);
+  size_t free = POT8TO_AUDIO_RING_SAMPLES -
+                (written - ring.read.load(std::memory_order_acquire));
+  if (count > free) {
+    count = free;
+  }
+  for (size_t i = 0; i < count; i++) {
+    ring.samples[(written + i) & (POT8TO_AUDIO_RING_SAMPLES - 1)] = samples[i];
+  }
+  ring.written.store(written + count, std::memory_order_release);
+  return count;
+}
+
+// Consumer side. Copies up to `count` buffered samples into `out` and
+// returns how many that was.
+size_t audio_ring_read(AudioRing &ring, int16_t *out, size_t count) {
+  size_t read = ring.read.load(std::memory_order_relaxed);
+  size_t buffered = ring.written.load(std::memory_order_acquire) - read;
+  if (count > buffered) {
+    count = buffered;
+  }
+  for (size_t i = 0; i < count; i++) {
+    out[i] = ring.samples[(read + i) & (POT8TO_AUDIO_RING_SAMPLES - 1)];
+  }
+  ring.read.store(read + count, std::memory_order_release);
+  return count;
+}
+
+// The tone's phase carries over between frames so it doesn't click at
+// frame boundaries.
+struct SquareWave {
+  // 32-bit fixed point fraction of a period, the top bit picks the half.
+  uint32_t phase;
+  uint32_t step;
+};
+
+void square_wave_begin(SquareWave &wave, uint32_t frequency) {
+  wave.phase = 0;
+  wave.step =
+      (uint32_t)(((uint64_t)frequency << 32) / POT8TO_AUDIO_SAMPLE_RATE);
+}
+
+// Renders one frame of what `state` sounds like into `out`. Call it after
+// the frame's instructions ran and before `decrement_timers`, so FX18 with
+// N sounds for exactly N frames.
+void audio_render_frame(SquareWave &wave, const State &state,
+                        int16_t out[POT8TO_AUDIO_FRAME_SAMPLES]) {
+  if (state.registers.T.sound == 0) {
+    memset(out, 0, POT8TO_AUDIO_FRAME_SAMPLES * sizeof(out[0]));
+    wave.phase = 0;
+    return;
+  }
+  for (size_t i = 0; i < POT8TO_AUDIO_FRAME_SAMPLES; i++) {
+    out[i] = (wave.phase & 0x80000000u) != 0 ? -POT8TO_AUDIO_AMPLITUDE
+                                             : POT8TO_AUDIO_AMPLITUDE;
+    wave.phase += wave.step;
+  }
+}
+
+// `audio_render_frame` straight into `ring`. Returns false if the ring was
+// too full to take all of it, the consumer is falling behind.
+bool audio_push_frame(SquareWave &wave, const State &state, AudioRing &ring) {
+  int16_t frame[POT8TO_AUDIO_FRAME_SAMPLES];
+  audio_render_frame(wave, state, frame);
+  return audio_ring_write(ring, frame, POT8TO_AUDIO_FRAME_SAMPLES) ==
+         POT8TO_AUDIO_FRAME_SAMPLES;
+}
+
+// Header of a canonical mono 16-bit PCM WAV file holding `samples` samples,
+// the samples follow it little-endian.
+void wav_header(uint8_t header[POT8TO_WAV_HEADER_SIZE], size_t samples) {
+  uint32_t data_size = (uint32_t)(samples * 2);
+  const uint32_t fields[] = {36 + data_size,
+                             16,
+                             1 | (1 << 16),
+                             POT8TO_AUDIO_SAMPLE_RATE,
+                             POT8TO_AUDIO_SAMPLE_RATE * 2,
+                             2 | (16 << 16),
+                             data_size};
+  memcpy(header, "RIFF", 4);
+  memcpy(header + 8, "WAVEfmt ", 8);
+  memcpy(header + 36, "data", 4);
+  // Offsets of `fields`, in order.
+  const size_t offsets[] = {4, 16, 20, 24, 28, 32, 40};
+  for (size_t i = 0; i < 7; i++) {
+    for (size_t b = 0; b < 4; b++) {
+      header[offsets[i] + b] = (uint8_t)(fields[i] >> (8 * b));
+    }
+  }
+}
+
+} // namespace Pot8to
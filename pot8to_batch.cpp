@@ -0,0 +1,147 @@
+#pragma once
+// Runs many independent `State`s to completion across all cores.
+//
+// Every instance lives in one contiguous arena. Each worker thread owns a
+// contiguous slice of it and claims instances from the front of that slice.
+// Once its slice is empty it steals from the other workers' slices the same
+// way, so the only shared writes are those claim counters, and each one
+// sits on its own cache line.
+#include "pot8to.cpp"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+namespace Pot8to {
+
+struct BatchJob {
+  const Platform::Program *program;
+  // Keys held down for the whole run, bit N is key N.
+  uint16_t keys;
+  // See `seed`.
+  uint32_t seed;
+};
+
+struct BatchConfig {
+  uint64_t frames;
+  // Instructions per 1/60 s of emulated time, `decrement_timers` runs
+  // between frames.
+  size_t instructions_per_frame;
+  // 0 uses every hardware thread.
+  size_t threads;
+};
+
+struct BatchResult {
+  uint64_t display_hash;
+  uint64_t instructions;
+  // STOP_BUDGET_EXHAUSTED when every frame ran, STOP_UNKNOWN_INSTRUCTION if
+  // the instance was cut short by one.
+  StopReason stop_reason;
+};
+
+struct alignas(64) BatchWorkerSlice {
+  std::atomic<size_t> next;
+  size_t end;
+};
+
+static void batch_run_instance(State &state, const BatchConfig &config,
+                               BatchResult &result) {
+  result.instructions = 0;
+  result.stop_reason = STOP_BUDGET_EXHAUSTED;
+  for (uint64_t frame = 0; frame < config.frames; frame++) {
+    size_t budget = config.instructions_per_frame;
+    while (budget > 0) {
+      RunResult run_result = run(state, budget);
+      budget -= run_result.executed;
+      result.instructions += run_result.executed;
+      if (run_result.reason == STOP_UNKNOWN_INSTRUCTION) {
+        result.stop_reason = STOP_UNKNOWN_INSTRUCTION;
+        result.display_hash = display_hash(state);
+        return;
+      }
+    }
+    decrement_timers(state);
+    if (idle_until_input(state)) {
+      // The keys never change, so the instance spins like this, or waits
+      // in FX0A, until the end. Only the leftover part of a pass through
+      // its loop has to run.
+      uint64_t frames = config.frames - frame - 1;
+      uint64_t left =
+          skip_idle_frames(state, frames, config.instructions_per_frame);
+      result.instructions += frames * config.instructions_per_frame;
+      while (left > 0) {
+        left -= run(state, left).executed;
+      }
+      break;
+    }
+  }
+  result.display_hash = display_hash(state);
+}
+
+static void batch_worker(std::vector<State> &states,
+                         const std::vector<BatchJob> &jobs,
+                         const BatchConfig &config,
+                         std::vector<BatchResult> &results,
+                         BatchWorkerSlice *slices, size_t slice_count,
+                         size_t self) {
+  // Drain our own slice first, then go around the others.
+  for (size_t k = 0; k < slice_count; k++) {
+    BatchWorkerSlice &slice = slices[(self + k) % slice_count];
+    while (true) {
+      size_t i = slice.next.fetch_add(1, std::memory_order_relaxed);
+      if (i >= slice.end) {
+        break;
+      }
+      states[i] = initialize(*jobs[i].program);
+      seed(states[i], jobs[i].seed);
+      for (uint8_t key = 0; key < 16; key++) {
+        if ((jobs[i].keys >> key) & 1) {
+          press_key(states[i], key);
+        }
+      }
+      batch_run_instance(states[i], config, results[i]);
+    }
+  }
+}
+
+// Runs every job for `config.frames` frames and returns one result per job,
+// in the same order.
+std::vector<BatchResult> run_batch(const std::vector<BatchJob> &jobs,
+                                   const BatchConfig &config) {
+  std::vector<State> states(jobs.size());
+  std::vector<BatchResult> results(jobs.size());
+
+  size_t thread_count = config.threads;
+  if (thread_count == 0) {
+    thread_count = std::thread::hardware_concurrency();
+  }
+  if (thread_count == 0) {
+    thread_count = 1;
+  }
+  if (thread_count > jobs.size() && !jobs.empty()) {
+    thread_count = jobs.size();
+  }
+
+  std::vector<BatchWorkerSlice> slices(thread_count);
+  for (size_t t = 0; t < thread_count; t++) {
+    slices[t].next.store(jobs.size() * t / thread_count);
+    slices[t].end = jobs.size() * (t + 1) / thread_count;
+  }
+
+  std::vector<std::thread> workers;
+  for (size_t t = 1; t < thread_count; t++) {
+    workers.push_back(std::thread(batch_worker, std::ref(states),
+                                  std::cref(jobs), std::cref(config),
+                                  std::ref(results), slices.data(),
+                                  thread_count, t));
+  }
+  batch_worker(states, jobs, config, results, slices.data(), thread_count, 0);
+  for (size_t t = 0; t < workers.size(); t++) {
+    workers[t].join();
+  }
+
+  return results;
+}
+
+} // namespace Pot8to
@@ -0,0 +1,1162 @@
+#pragma once
+// Dynamic recompiler for x86-64 hosts.
+//
+// Basic blocks are translated into native code that ends at the first jump
+// (1NNN, 2NNN, 00EE, BNNN), skip, or instruction the blocks hand to the
+// interpreter's handlers (DXYN, FX0A, FX33, FX55...). While a block runs, the
+// V registers it touches and I live in host registers. The PC, the budget
+// left, the `State *` and the block table stay in host registers from one
+// block to the next: every block jumps straight on to the block at its
+// successor through `Jit::entries`, and only comes back to `jit_run` when
+// the budget runs out, the next address has no block yet, a handler stops
+// the run or writes over translated code.
+#include "pot8to.cpp"
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define POT8TO_HAS_JIT 1
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+namespace Pot8to {
+
+constexpr size_t POT8TO_JIT_CODE_SIZE = 1 << 20;
+constexpr size_t POT8TO_JIT_MAX_BLOCK_INSTRUCTIONS = 32;
+
+// Why the native code handed control back, on top of the `StopReason`s a
+// handler can stop with. `jit_run` carries on after these two.
+// The PC has no block yet, or the budget left doesn't cover its block.
+constexpr uint32_t JIT_EXIT_LOOKUP = STOP_FAULT + 1;
+// A handler wrote to a page holding translated code.
+constexpr uint32_t JIT_EXIT_WRITTEN = STOP_FAULT + 2;
+
+struct Jit;
+
+// What `jit_run` hands the native code, and gets back from it.
+struct JitRun {
+  State *state;
+  uint8_t *const *entries;
+  Jit *jit;
+  // Budget left, counted down by the blocks.
+  uint64_t left;
+  // The whole budget of the run, for the idle loop check.
+  uint64_t budget;
+  // A `StopReason` or JIT_EXIT_*.
+  uint32_t reason;
+  IdleWatch watch;
+};
+
+typedef void (*JitEnter)(JitRun *run);
+
+// Translations are made from the memory of one `State`, reuse a `Jit` for a
+// different program only after `jit_reset`.
+struct Jit {
+  uint8_t *code;
+  size_t used;
+  // Where native code goes on at every address: the block starting there,
+  // or `lookup`, which hands the address back to `jit_run`.
+  uint8_t *entries[POT8TO_MAX_MEMORY];
+  // Instructions in the block at every address, 0 if none was translated.
+  uint8_t lengths[POT8TO_MAX_MEMORY];
+  // Pages holding translated code, matched against `State::written_pages`.
+  uint64_t translated_pages;
+  // Emitted at the start of `code`: `enter` saves the host's registers and
+  // jumps to the block at the PC, `leave` stores the PC, budget and reason
+  // and returns from `enter`, `lookup` leaves with JIT_EXIT_LOOKUP.
+  JitEnter enter;
+  uint8_t *leave;
+  uint8_t *lookup;
+};
+
+namespace JitX64 {
+enum Reg {
+  RAX,
+  RCX,
+  RDX,
+  RBX,
+  RSP,
+  RBP,
+  RSI,
+  RDI,
+  R8,
+  R9,
+  R10,
+  R11,
+  R12,
+  R13,
+  R14,
+  R15
+};
+
+// Kept across blocks: R15 holds the `State *`, RBX `Jit::entries`, R12 the
+// budget left and R13 the PC. Inside a block R14 holds I and RDI is
+// scratch, the rest are handed out to the V registers the block uses.
+const Reg STATE = R15;
+const Reg ENTRIES = RBX;
+const Reg LEFT = R12;
+const Reg PC = R13;
+const Reg REG_I = R14;
+const Reg SCRATCH = RDI;
+const Reg V_POOL[] = {RAX, RCX, RDX, RBP, RSI, R8, R9, R10, R11};
+const size_t V_POOL_SIZE = sizeof(V_POOL) / sizeof(V_POOL[0]);
+
+// Registers `enter` saves, covers the callee-saved registers of both the
+// System V and the Windows ABI.
+const Reg SAVED[] = {RBX, RBP, RSI, RDI, R12, R13, R14, R15};
+const size_t SAVED_COUNT = sizeof(SAVED) / sizeof(SAVED[0]);
+
+#ifdef _WIN32
+const Reg ARG0 = RCX;
+const Reg ARG1 = RDX;
+#else
+const Reg ARG0 = RDI;
+const Reg ARG1 = RSI;
+#endif
+// Below the saved registers `enter` keeps the Windows shadow space and the
+// `JitRun *`, which also leaves RSP 16-byte aligned for the handler calls.
+const uint8_t FRAME_SIZE = 40;
+const uint8_t FRAME_RUN = 32;
+
+enum AluOp { ADD = 0, OR = 1, AND = 4, SUB = 5, XOR = 6, CMP = 7 };
+
+enum Condition {
+  CC_B = 0x2,
+  CC_AE = 0x3,
+  CC_E = 0x4,
+  CC_NE = 0x5,
+  CC_A = 0x7
+};
+
+const uint32_t OFFSET_MEMORY = offsetof(State, memory);
+const uint32_t OFFSET_V = offsetof(State, registers.V);
+const uint32_t OFFSET_I = offsetof(State, registers.I);
+const uint32_t OFFSET_PC = offsetof(State, registers.PC);
+const uint32_t OFFSET_SP = offsetof(State, registers.SP);
+const uint32_t OFFSET_STACK = offsetof(State, stack);
+const uint32_t OFFSET_DELAY = offsetof(State, registers.T.delay);
+const uint32_t OFFSET_KEYBOARD = offsetof(State, keyboard);
+const uint32_t OFFSET_RNG = offsetof(State, rng);
+const uint32_t OFFSET_TIMER_ACCESSES = offsetof(State, timer_accesses);
+const uint32_t OFFSET_IDLE_PERIOD = offsetof(State, idle_period);
+const uint32_t OFFSET_IDLE_ON_TIMERS = offsetof(State, idle_on_timers);
+
+struct Emitter {
+  uint8_t *out;
+  uint8_t *end;
+  bool overflow;
+};
+
+static void emit8(Emitter &e, uint8_t byte) {
+  if (e.out >= e.end) {
+    e.overflow = true;
+    return;
+  }
+  *e.out++ = byte;
+}
+
+static void emit16(Emitter &e, uint16_t value) {
+  emit8(e, value & 0xFF);
+  emit8(e, value >> 8);
+}
+
+static void emit32(Emitter &e, uint32_t value) {
+  for (int i = 0; i < 4; i++) {
+    emit8(e, (value >> (8 * i)) & 0xFF);
+  }
+}
+
+static void emit64(Emitter &e, uint64_t value) {
+  emit32(e, (uint32_t)value);
+  emit32(e, (uint32_t)(value >> 32));
+}
+
+// REX prefix, only emitted when some bit is set unless `force` (byte
+// registers SPL/BPL/SIL/DIL need an empty one).
+static void rex(Emitter &e, bool w, Reg r, Reg b, bool force = false) {
+  uint8_t byte = 0x40 | (w << 3) | ((r >> 3) << 2) | (b >> 3);
+  if (byte != 0x40 || force) {
+    emit8(e, byte);
+  }
+}
+
+// REX prefix for a [base + index] operand.
+static void rex_indexed(Emitter &e, bool w, Reg r, Reg base, Reg index) {
+  uint8_t byte =
+      0x40 | (w << 3) | ((r >> 3) << 2) | ((index >> 3) << 1) | (base >> 3);
+  if (byte != 0x40) {
+    emit8(e, byte);
+  }
+}
+
+static void modrm_reg(Emitter &e, Reg r, Reg b) {
+  emit8(e, 0xC0 | ((r & 7) << 3) | (b & 7));
+}
+
+// [R15 + disp32], R15 never needs a SIB byte.
+static void modrm_state(Emitter &e, uint8_t r, uint32_t disp) {
+  emit8(e, 0x80 | ((r & 7) << 3) | (STATE & 7));
+  emit32(e, disp);
+}
+
+// [base + disp32], RSP and R12 need a SIB byte.
+static void modrm_base(Emitter &e, uint8_t r, Reg base, uint32_t disp) {
+  emit8(e, 0x80 | ((r & 7) << 3) | (base & 7));
+  if ((base & 7) == RSP) {
+    emit8(e, 0x24);
+  }
+  emit32(e, disp);
+}
+
+// [base + index << scale + disp32]
+static void modrm_indexed(Emitter &e, uint8_t r, Reg base, Reg index,
+                          uint8_t scale, uint32_t disp) {
+  emit8(e, 0x84 | ((r & 7) << 3));
+  emit8(e, (scale << 6) | ((index & 7) << 3) | (base & 7));
+  emit32(e, disp);
+}
+
+static void push(Emitter &e, Reg r) {
+  rex(e, false, RAX, r);
+  emit8(e, 0x50 + (r & 7));
+}
+
+static void pop(Emitter &e, Reg r) {
+  rex(e, false, RAX, r);
+  emit8(e, 0x58 + (r & 7));
+}
+
+// mov dst32, src32 (or the full 64 bits when `wide`)
+static void mov_rr(Emitter &e, Reg dst, Reg src, bool wide = false) {
+  rex(e, wide, src, dst);
+  emit8(e, 0x89);
+  modrm_reg(e, src, dst);
+}
+
+// mov dst32, imm32
+static void mov_ri(Emitter &e, Reg dst, uint32_t imm) {
+  rex(e, false, RAX, dst);
+  emit8(e, 0xB8 + (dst & 7));
+  emit32(e, imm);
+}
+
+// mov dst64, imm64
+static void mov_ri64(Emitter &e, Reg dst, uint64_t imm) {
+  rex(e, true, RAX, dst);
+  emit8(e, 0xB8 + (dst & 7));
+  emit64(e, imm);
+}
+
+// <op> dst, src
+static void alu_rr(Emitter &e, AluOp op, Reg dst, Reg src, bool wide = false) {
+  rex(e, wide, src, dst);
+  emit8(e, (op << 3) | 0x01);
+  modrm_reg(e, src, dst);
+}
+
+// <op> dst, imm32
+static void alu_ri(Emitter &e, AluOp op, Reg dst, uint32_t imm,
+                   bool wide = false) {
+  rex(e, wide, RAX, dst);
+  emit8(e, 0x81);
+  modrm_reg(e, (Reg)op, dst);
+  emit32(e, imm);
+}
+
+// test a, b
+static void test_rr(Emitter &e, Reg a, Reg b, bool wide = false) {
+  rex(e, wide, b, a);
+  emit8(e, 0x85);
+  modrm_reg(e, b, a);
+}
+
+// shr/shl dst32, imm8
+static void shr_ri(Emitter &e, Reg dst, uint8_t imm) {
+  rex(e, false, RAX, dst);
+  emit8(e, 0xC1);
+  modrm_reg(e, (Reg)5, dst);
+  emit8(e, imm);
+}
+
+static void shl_ri(Emitter &e, Reg dst, uint8_t imm) {
+  rex(e, false, RAX, dst);
+  emit8(e, 0xC1);
+  modrm_reg(e, (Reg)4, dst);
+  emit8(e, imm);
+}
+
+// imul dst32, src32, imm8
+static void imul_rri(Emitter &e, Reg dst, Reg src, uint8_t imm) {
+  rex(e, false, dst, src);
+  emit8(e, 0x6B);
+  modrm_reg(e, dst, src);
+  emit8(e, imm);
+}
+
+// movzx dst32, byte [state + disp]
+static void load8(Emitter &e, Reg dst, uint32_t disp) {
+  rex(e, false, dst, STATE);
+  emit8(e, 0x0F);
+  emit8(e, 0xB6);
+  modrm_state(e, dst, disp);
+}
+
+// movzx dst32, word [state + disp]
+static void load16(Emitter &e, Reg dst, uint32_t disp) {
+  rex(e, false, dst, STATE);
+  emit8(e, 0x0F);
+  emit8(e, 0xB7);
+  modrm_state(e, dst, disp);
+}
+
+// mov dst32, dword [state + disp]
+static void load32(Emitter &e, Reg dst, uint32_t disp) {
+  rex(e, false, dst, STATE);
+  emit8(e, 0x8B);
+  modrm_state(e, dst, disp);
+}
+
+// mov byte [state + disp], src8
+static void store8(Emitter &e, uint32_t disp, Reg src) {
+  rex(e, false, src, STATE, true);
+  emit8(e, 0x88);
+  modrm_state(e, src, disp);
+}
+
+// mov word [state + disp], src16
+static void store16(Emitter &e, uint32_t disp, Reg src) {
+  emit8(e, 0x66);
+  rex(e, false, src, STATE);
+  emit8(e, 0x89);
+  modrm_state(e, src, disp);
+}
+
+// mov dword [state + disp], src32
+static void store32(Emitter &e, uint32_t disp, Reg src) {
+  rex(e, false, src, STATE);
+  emit8(e, 0x89);
+  modrm_state(e, src, disp);
+}
+
+// mov byte/dword [state + disp], imm
+static void store8_imm(Emitter &e, uint32_t disp, uint8_t imm) {
+  rex(e, false, RAX, STATE);
+  emit8(e, 0xC6);
+  modrm_state(e, 0, disp);
+  emit8(e, imm);
+}
+
+static void store32_imm(Emitter &e, uint32_t disp, uint32_t imm) {
+  rex(e, false, RAX, STATE);
+  emit8(e, 0xC7);
+  modrm_state(e, 0, disp);
+  emit32(e, imm);
+}
+
+// inc dword [state + disp]
+static void inc32(Emitter &e, uint32_t disp) {
+  rex(e, false, RAX, STATE);
+  emit8(e, 0xFF);
+  modrm_state(e, 0, disp);
+}
+
+// inc/dec byte [state + disp]
+static void inc8(Emitter &e, uint32_t disp) {
+  rex(e, false, RAX, STATE);
+  emit8(e, 0xFE);
+  modrm_state(e, 0, disp);
+}
+
+static void dec8(Emitter &e, uint32_t disp) {
+  rex(e, false, RAX, STATE);
+  emit8(e, 0xFE);
+  modrm_state(e, 1, disp);
+}
+
+// cmp byte [state + disp], imm8
+static void cmp8_imm(Emitter &e, uint32_t disp, uint8_t imm) {
+  rex(e, false, RAX, STATE);
+  emit8(e, 0x80);
+  modrm_state(e, 7, disp);
+  emit8(e, imm);
+}
+
+// movzx dst32, byte [state + index + disp]
+static void load8_indexed(Emitter &e, Reg dst, Reg index, uint32_t disp) {
+  rex_indexed(e, false, dst, STATE, index);
+  emit8(e, 0x0F);
+  emit8(e, 0xB6);
+  modrm_indexed(e, dst, STATE, index, 0, disp);
+}
+
+// movzx dst32, word [state + index * 2 + disp]
+static void load16_indexed(Emitter &e, Reg dst, Reg index, uint32_t disp) {
+  rex_indexed(e, false, dst, STATE, index);
+  emit8(e, 0x0F);
+  emit8(e, 0xB7);
+  modrm_indexed(e, dst, STATE, index, 1, disp);
+}
+
+// mov word [state + index * 2 + disp], imm16
+static void store16_imm_indexed(Emitter &e, Reg index, uint32_t disp,
+                                uint16_t imm) {
+  emit8(e, 0x66);
+  rex_indexed(e, false, RAX, STATE, index);
+  emit8(e, 0xC7);
+  modrm_indexed(e, 0, STATE, index, 1, disp);
+  emit16(e, imm);
+}
+
+// mov dst64, [base + disp] and mov [base + disp], src (64 or 32 bits)
+static void load_base(Emitter &e, Reg dst, Reg base, uint32_t disp) {
+  rex(e, true, dst, base);
+  emit8(e, 0x8B);
+  modrm_base(e, dst, base, disp);
+}
+
+static void store_base(Emitter &e, Reg base, uint32_t disp, Reg src,
+                       bool wide) {
+  rex(e, wide, src, base);
+  emit8(e, 0x89);
+  modrm_base(e, src, base, disp);
+}
+
+// call reg
+static void call_r(Emitter &e, Reg target) {
+  rex(e, false, RAX, target);
+  emit8(e, 0xFF);
+  modrm_reg(e, (Reg)2, target);
+}
+
+// j<cc>/jmp to `target` anywhere in the code buffer.
+static void jcc_to(Emitter &e, Condition cc, const uint8_t *target) {
+  emit8(e, 0x0F);
+  emit8(e, 0x80 + cc);
+  emit32(e, (uint32_t)(target - (e.out + 4)));
+}
+
+static void jmp_to(Emitter &e, const uint8_t *target) {
+  emit8(e, 0xE9);
+  emit32(e, (uint32_t)(target - (e.out + 4)));
+}
+
+// j<cc> over code emitted until `jcc_short_end`, at most 127 bytes.
+static uint8_t *jcc_short_begin(Emitter &e, Condition cc) {
+  emit8(e, 0x70 + cc);
+  emit8(e, 0);
+  return e.out;
+}
+
+static void jcc_short_end(Emitter &e, uint8_t *from) {
+  if (!e.overflow) {
+    from[-1] = (uint8_t)(e.out - from);
+  }
+}
+
+// jmp [entries + pc * 8]: on to the block at the PC.
+static void dispatch(Emitter &e) {
+  rex_indexed(e, false, RAX, ENTRIES, PC);
+  emit8(e, 0xFF);
+  modrm_indexed(e, 4, ENTRIES, PC, 3, 0);
+}
+
+// Instructions with native code. The rest run through `jit_execute`, and end
+// their block.
+static bool translatable(const Instruction &inst) {
+  switch (inst.identifier) {
+  case INST_00EE:
+  case INST_1NNN:
+  case INST_2NNN:
+  case INST_3XNN:
+  case INST_4XNN:
+  case INST_5XY0:
+  case INST_6XNN:
+  case INST_7XNN:
+  case INST_8XY0:
+  case INST_8XY1:
+  case INST_8XY2:
+  case INST_8XY3:
+  case INST_8XY4:
+  case INST_8XY5:
+  case INST_8XY6:
+  case INST_8XY7:
+  case INST_8XYE:
+  case INST_9XY0:
+  case INST_ANNN:
+  case INST_BNNN:
+  case INST_CXNN:
+  case INST_EX9E:
+  case INST_EXA1:
+  case INST_FX07:
+  case INST_FX15:
+  case INST_FX1E:
+  case INST_FX29:
+    return true;
+  case INST_FX65:
+    // Needs a host register for each of V0 to VX.
+    return inst.registers.vx < V_POOL_SIZE;
+  default:
+    return false;
+  }
+}
+
+static bool is_skip(const Instruction &inst) {
+  switch (inst.identifier) {
+  case INST_3XNN:
+  case INST_4XNN:
+  case INST_5XY0:
+  case INST_9XY0:
+  case INST_EX9E:
+  case INST_EXA1:
+    return true;
+  default:
+    return false;
+  }
+}
+
+static bool ends_block(const Instruction &inst) {
+  switch (inst.identifier) {
+  case INST_00EE:
+  case INST_1NNN:
+  case INST_2NNN:
+  case INST_BNNN:
+    return true;
+  default:
+    return is_skip(inst) || !translatable(inst);
+  }
+}
+
+// V registers read or written by the native code of `inst`, as a bitmask.
+static uint16_t registers_used(const Instruction &inst) {
+  uint16_t vx = 1 << inst.registers.vx;
+  uint16_t vy = 1 << inst.registers.vy;
+  switch (inst.identifier) {
+  case INST_3XNN:
+  case INST_4XNN:
+  case INST_6XNN:
+  case INST_7XNN:
+  case INST_CXNN:
+  case INST_FX07:
+  case INST_FX15:
+  case INST_FX1E:
+  case INST_FX29:
+    return vx;
+  case INST_5XY0:
+  case INST_8XY0:
+  case INST_8XY1:
+  case INST_8XY2:
+  case INST_8XY3:
+  case INST_9XY0:
+    return vx | vy;
+  case INST_8XY4:
+  case INST_8XY5:
+  case INST_8XY6:
+  case INST_8XY7:
+  case INST_8XYE:
+    return vx | vy | 0x8000;
+  case INST_BNNN:
+    return 1;
+  case INST_FX65:
+    return (uint16_t)((2u << inst.registers.vx) - 1);
+  default:
+    return 0;
+  }
+}
+
+static uint16_t registers_written(const Instruction &inst) {
+  uint16_t vx = 1 << inst.registers.vx;
+  switch (inst.identifier) {
+  case INST_6XNN:
+  case INST_7XNN:
+  case INST_8XY0:
+  case INST_8XY1:
+  case INST_8XY2:
+  case INST_8XY3:
+  case INST_CXNN:
+  case INST_FX07:
+    return vx;
+  case INST_8XY4:
+  case INST_8XY5:
+  case INST_8XY6:
+  case INST_8XY7:
+  case INST_8XYE:
+    return vx | 0x8000;
+  case INST_FX65:
+    return registers_used(inst);
+  default:
+    return 0;
+  }
+}
+
+static bool uses_i(const Instruction &inst) {
+  return inst.identifier == INST_ANNN || inst.identifier == INST_FX1E ||
+         inst.identifier == INST_FX29 || inst.identifier == INST_FX65;
+}
+
+static bool writes_i(const Instruction &inst) {
+  return inst.identifier == INST_ANNN || inst.identifier == INST_FX1E ||
+         inst.identifier == INST_FX29;
+}
+
+// Writes `Vx = (a - b) & 0xFF, VF = a >= b`.
+static void emit_subtract(Emitter &e, Reg x, Reg a, Reg b, Reg vf) {
+  mov_rr(e, SCRATCH, a);
+  alu_rr(e, SUB, SCRATCH, b);
+  mov_rr(e, x, SCRATCH);
+  alu_ri(e, AND, x, 0xFF);
+  shr_ri(e, SCRATCH, 31);
+  alu_ri(e, XOR, SCRATCH, 1);
+  mov_rr(e, vf, SCRATCH);
+}
+
+// Native code for the instructions that don't end a block, and the compare
+// of a skip.
+static void emit_instruction(Emitter &e, const Instruction &inst,
+                             const Reg host[16]) {
+  Reg x = host[inst.registers.vx];
+  Reg y = host[inst.registers.vy];
+  Reg vf = host[0xF];
+
+  switch (inst.identifier) {
+  case INST_3XNN:
+  case INST_4XNN:
+    alu_ri(e, CMP, x, inst.address.NN);
+    break;
+  case INST_5XY0:
+  case INST_9XY0:
+    alu_rr(e, CMP, x, y);
+    break;
+  case INST_EX9E:
+    cmp8_imm(e, OFFSET_KEYBOARD + inst.registers.vx, 1);
+    break;
+  case INST_EXA1:
+    cmp8_imm(e, OFFSET_KEYBOARD + inst.registers.vx, 0);
+    break;
+  case INST_6XNN:
+    mov_ri(e, x, inst.address.NN);
+    break;
+  case INST_7XNN:
+    alu_ri(e, ADD, x, inst.address.NN);
+    alu_ri(e, AND, x, 0xFF);
+    break;
+  case INST_8XY0:
+    mov_rr(e, x, y);
+    break;
+  case INST_8XY1:
+    alu_rr(e, OR, x, y);
+    break;
+  case INST_8XY2:
+    alu_rr(e, AND, x, y);
+    break;
+  case INST_8XY3:
+    alu_rr(e, XOR, x, y);
+    break;
+  case INST_8XY4:
+    mov_rr(e, SCRATCH, x);
+    alu_rr(e, ADD, SCRATCH, y);
+    mov_rr(e, x, SCRATCH);
+    alu_ri(e, AND, x, 0xFF);
+    shr_ri(e, SCRATCH, 8);
+    mov_rr(e, vf, SCRATCH);
+    break;
+  case INST_8XY5:
+    emit_subtract(e, x, x, y, vf);
+    break;
+  case INST_8XY7:
+    emit_subtract(e, x, y, x, vf);
+    break;
+  case INST_8XY6:
+    mov_rr(e, SCRATCH, x);
+    alu_ri(e, AND, SCRATCH, 1);
+    shr_ri(e, x, 1);
+    mov_rr(e, vf, SCRATCH);
+    break;
+  case INST_8XYE:
+    mov_rr(e, SCRATCH, x);
+    shr_ri(e, SCRATCH, 7);
+    shl_ri(e, x, 1);
+    alu_ri(e, AND, x, 0xFF);
+    mov_rr(e, vf, SCRATCH);
+    break;
+  case INST_ANNN:
+    mov_ri(e, REG_I, inst.address.NNN);
+    break;
+  case INST_CXNN:
+    // `next_random`, with VX as the second scratch register.
+    load32(e, SCRATCH, OFFSET_RNG);
+    mov_rr(e, x, SCRATCH);
+    shl_ri(e, x, 13);
+    alu_rr(e, XOR, SCRATCH, x);
+    mov_rr(e, x, SCRATCH);
+    shr_ri(e, x, 17);
+    alu_rr(e, XOR, SCRATCH, x);
+    mov_rr(e, x, SCRATCH);
+    shl_ri(e, x, 5);
+    alu_rr(e, XOR, SCRATCH, x);
+    store32(e, OFFSET_RNG, SCRATCH);
+    mov_rr(e, x, SCRATCH);
+    alu_ri(e, AND, x, inst.address.NN);
+    break;
+  case INST_FX1E:
+    alu_rr(e, ADD, REG_I, x);
+    alu_ri(e, AND, REG_I, 0xFFFF);
+    break;
+  case INST_FX29:
+    imul_rri(e, REG_I, x, 5);
+    break;
+  case INST_FX65:
+    for (size_t v = 0; v <= inst.registers.vx; v++) {
+      load8_indexed(e, host[v], REG_I, OFFSET_MEMORY + (uint32_t)v);
+    }
+    break;
+  case INST_FX07:
+    load8(e, x, OFFSET_DELAY);
+    inc32(e, OFFSET_TIMER_ACCESSES);
+    break;
+  case INST_FX15:
+    store8(e, OFFSET_DELAY, x);
+    inc32(e, OFFSET_TIMER_ACCESSES);
+    break;
+  default:
+    break;
+  }
+}
+} // namespace JitX64
+
+// Runs an instruction the blocks have no native code for, with the PC
+// already past it. Called from native code.
+static uint32_t jit_execute(JitRun *run, uint32_t raw) {
+  State &state = *run->state;
+  Instruction inst = decode_instruction((uint16_t)raw);
+  uint8_t sound_before = state.registers.T.sound;
+  execute_decoded_instruction(state, inst);
+  StopReason reason = stop_reason_after(state, inst, sound_before);
+  if (reason != STOP_NONE) {
+    return reason;
+  }
+  if ((state.written_pages & run->jit->translated_pages) != 0) {
+    return JIT_EXIT_WRITTEN;
+  }
+  return STOP_NONE;
+}
+
+#ifndef POT8TO_NO_IDLE_SKIP
+// `idle_fast_forward` for the blocks, called after every backward jump
+// with the PC stored. Returns how much more of the budget is used up.
+static uint64_t jit_idle_check(JitRun *run, uint64_t left) {
+  return idle_fast_forward(*run->state, run->watch,
+                           (size_t)(run->budget - left), (size_t)run->budget);
+}
+#endif
+
+static void jit_make_writable(Jit &jit, bool writable) {
+#ifdef _WIN32
+  DWORD old;
+  VirtualProtect(jit.code, POT8TO_JIT_CODE_SIZE,
+                 writable ? PAGE_READWRITE : PAGE_EXECUTE_READ, &old);
+#else
+  mprotect(jit.code, POT8TO_JIT_CODE_SIZE,
+           writable ? PROT_READ | PROT_WRITE : PROT_READ | PROT_EXEC);
+#endif
+}
+
+// Emits `enter`, `leave` and `lookup` at the start of the code buffer.
+static void jit_emit_stubs(Jit &jit) {
+  using namespace JitX64;
+  jit_make_writable(jit, true);
+  Emitter e = {jit.code, jit.code + POT8TO_JIT_CODE_SIZE, false};
+
+  jit.enter = (JitEnter)(void *)e.out;
+  for (size_t i = 0; i < SAVED_COUNT; i++) {
+    push(e, SAVED[i]);
+  }
+  alu_ri(e, SUB, RSP, FRAME_SIZE, true);
+  store_base(e, RSP, FRAME_RUN, ARG0, true);
+  load_base(e, STATE, ARG0, offsetof(JitRun, state));
+  load_base(e, ENTRIES, ARG0, offsetof(JitRun, entries));
+  load_base(e, LEFT, ARG0, offsetof(JitRun, left));
+  load16(e, PC, OFFSET_PC);
+  dispatch(e);
+
+  // With the reason in EAX.
+  jit.leave = e.out;
+  store16(e, OFFSET_PC, PC);
+  load_base(e, SCRATCH, RSP, FRAME_RUN);
+  store_base(e, SCRATCH, offsetof(JitRun, left), LEFT, true);
+  store_base(e, SCRATCH, offsetof(JitRun, reason), RAX, false);
+  alu_ri(e, ADD, RSP, FRAME_SIZE, true);
+  for (size_t i = SAVED_COUNT; i > 0; i--) {
+    pop(e, SAVED[i - 1]);
+  }
+  emit8(e, 0xC3); // ret
+
+  jit.lookup = e.out;
+  mov_ri(e, RAX, JIT_EXIT_LOOKUP);
+  jmp_to(e, jit.leave);
+
+  jit_make_writable(jit, false);
+  jit.used = e.out - jit.code;
+}
+
+void jit_reset(Jit &jit) {
+  memset(jit.lengths, 0, sizeof(jit.lengths));
+  jit.used = 0;
+  jit.translated_pages = 0;
+  if (jit.code == NULL) {
+    return;
+  }
+  jit_emit_stubs(jit);
+  for (size_t a = 0; a < POT8TO_MAX_MEMORY; a++) {
+    jit.entries[a] = jit.lookup;
+  }
+}
+
+bool jit_create(Jit &jit) {
+#ifdef _WIN32
+  jit.code = (uint8_t *)VirtualAlloc(NULL, POT8TO_JIT_CODE_SIZE,
+                                     MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+#else
+  void *code = mmap(NULL, POT8TO_JIT_CODE_SIZE, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  jit.code = code == MAP_FAILED ? NULL : (uint8_t *)code;
+#endif
+  jit_reset(jit);
+  return jit.code != NULL;
+}
+
+void jit_destroy(Jit &jit) {
+  if (jit.code == NULL) {
+    return;
+  }
+#ifdef _WIN32
+  VirtualFree(jit.code, 0, MEM_RELEASE);
+#else
+  munmap(jit.code, POT8TO_JIT_CODE_SIZE);
+#endif
+  jit.code = NULL;
+}
+
+namespace JitX64 {
+
+// A call to `function(JitRun *, arg)`, RAX holds what it returns. Every
+// register but the ones kept across blocks is gone afterwards.
+static void emit_call(Emitter &e, const void *function, Reg arg, uint32_t imm,
+                      bool use_imm) {
+  if (use_imm) {
+    mov_ri(e, ARG1, imm);
+  } else if (arg != ARG1) {
+    mov_rr(e, ARG1, arg, true);
+  }
+  load_base(e, ARG0, RSP, FRAME_RUN);
+  mov_ri64(e, RAX, (uint64_t)(uintptr_t)function);
+  call_r(e, RAX);
+}
+
+// Goes on to the block at the PC in R13. `from` is the address of the
+// instruction that set it: a jump back to it or before gets the idle loop
+// check, unless `backward` says it can't be one. With `dynamic` the PC
+// isn't known until run time, and may be past the end of memory.
+static void emit_continue(Emitter &e, const Jit &jit, uint16_t from,
+                          bool backward, bool dynamic) {
+#ifndef POT8TO_NO_IDLE_SKIP
+  if (backward) {
+    uint8_t *forward = NULL;
+    if (dynamic) {
+      alu_ri(e, CMP, PC, from);
+      forward = jcc_short_begin(e, CC_A);
+    }
+    store16(e, OFFSET_PC, PC);
+    emit_call(e, (const void *)jit_idle_check, LEFT, 0, false);
+    alu_rr(e, SUB, LEFT, RAX, true);
+    if (dynamic) {
+      jcc_short_end(e, forward);
+    }
+  }
+#else
+  (void)from;
+  (void)backward;
+#endif
+  if (dynamic) {
+    alu_ri(e, CMP, PC, POT8TO_MAX_MEMORY);
+    jcc_to(e, CC_AE, jit.lookup);
+  }
+  dispatch(e);
+}
+
+// Same with a PC known when translating.
+static void emit_continue_at(Emitter &e, const Jit &jit, uint16_t from,
+                             uint16_t to) {
+  mov_ri(e, PC, to);
+  if (to >= POT8TO_MAX_MEMORY) {
+    jmp_to(e, jit.lookup);
+    return;
+  }
+  emit_continue(e, jit, from, to <= from, false);
+}
+
+} // namespace JitX64
+
+// Translates the block starting at `pc`. Leaves `lengths[pc]` at 0 when
+// there is nothing to translate there.
+static void jit_translate(Jit &jit, const State &state, uint16_t pc) {
+  using namespace JitX64;
+
+  // Find how far the block goes: up to and including a jump, a skip or an
+  // instruction without native code, or until we run out of host
+  // registers.
+  Instruction insts[POT8TO_JIT_MAX_BLOCK_INSTRUCTIONS];
+  uint16_t raws[POT8TO_JIT_MAX_BLOCK_INSTRUCTIONS];
+  size_t length = 0;
+  uint16_t used = 0;
+  uint16_t written = 0;
+  bool needs_i = false;
+  bool writes_index = false;
+  bool ended = false;
+  uint16_t address = pc;
+  while (!ended && length < POT8TO_JIT_MAX_BLOCK_INSTRUCTIONS &&
+         (size_t)address + 1 < POT8TO_MAX_MEMORY) {
+    uint16_t raw = (state.memory[address] << 8) | state.memory[address + 1];
+    Instruction inst = decode_instruction(raw);
+    uint16_t now_used = used | registers_used(inst);
+    size_t count = 0;
+    for (uint16_t m = now_used; m != 0; m &= m - 1) {
+      count++;
+    }
+    if (count > V_POOL_SIZE) {
+      break;
+    }
+    used = now_used;
+    written |= registers_written(inst);
+    needs_i = needs_i || uses_i(inst);
+    writes_index = writes_index || writes_i(inst);
+    ended = ends_block(inst);
+    insts[length] = inst;
+    raws[length] = raw;
+    length++;
+    address += 2;
+  }
+  if (length == 0) {
+    return;
+  }
+
+  // Leave room for the largest block we can emit, flushing everything when
+  // the buffer is full.
+  const size_t max_block_bytes = 256 + 96 * length;
+  if (jit.used + max_block_bytes > POT8TO_JIT_CODE_SIZE) {
+    jit_reset(jit);
+  }
+
+  Reg host[16];
+  size_t next_reg = 0;
+  for (size_t v = 0; v < 16; v++) {
+    host[v] = (used >> v) & 1 ? V_POOL[next_reg++] : SCRATCH;
+  }
+
+  jit_make_writable(jit, true);
+  uint8_t *start = jit.code + jit.used;
+  Emitter e = {start, jit.code + POT8TO_JIT_CODE_SIZE, false};
+
+  // The whole block comes out of the budget up front, `jit_run` interprets
+  // what doesn't fit.
+  alu_ri(e, CMP, LEFT, (uint32_t)length, true);
+  jcc_to(e, CC_B, jit.lookup);
+  alu_ri(e, SUB, LEFT, (uint32_t)length, true);
+  for (size_t v = 0; v < 16; v++) {
+    if ((used >> v) & 1) {
+      load8(e, host[v], OFFSET_V + (uint32_t)v);
+    }
+  }
+  if (needs_i) {
+    load16(e, REG_I, OFFSET_I);
+  }
+
+  const Instruction &end = insts[length - 1];
+  uint16_t end_pc = (uint16_t)(pc + 2 * (length - 1));
+  // A skip's compare goes with the body, the other block ends are emitted
+  // after the stores.
+  size_t body = ended && !is_skip(end) ? length - 1 : length;
+  for (size_t i = 0; i < body; i++) {
+    emit_instruction(e, insts[i], host);
+  }
+  // Everything after this has the registers back in the state.
+  for (size_t v = 0; v < 16; v++) {
+    if ((written >> v) & 1) {
+      store8(e, OFFSET_V + (uint32_t)v, host[v]);
+    }
+  }
+  if (writes_index) {
+    store16(e, OFFSET_I, REG_I);
+  }
+
+  uint16_t next = (uint16_t)(end_pc + 2);
+  // Jumps to itself and does nothing else: what `idle_fast_forward` finds
+  // on the second pass, without the snapshots.
+  bool spins = length == 1 && end.identifier == INST_1NNN &&
+               end.address.NNN == pc;
+#ifdef POT8TO_NO_IDLE_SKIP
+  spins = false;
+#endif
+  if (spins) {
+    test_rr(e, LEFT, LEFT, true);
+    uint8_t *last = jcc_short_begin(e, CC_E);
+    store32_imm(e, OFFSET_IDLE_PERIOD, 1);
+    store8_imm(e, OFFSET_IDLE_ON_TIMERS, 0);
+    mov_ri(e, LEFT, 0);
+    jcc_short_end(e, last);
+    mov_ri(e, PC, pc);
+    jmp_to(e, jit.lookup);
+  } else if (!ended) {
+    emit_continue_at(e, jit, end_pc, address);
+  } else if (is_skip(end)) {
+    // The compare was emitted last, the stores above leave the flags.
+    Condition no_skip =
+        end.identifier == INST_4XNN || end.identifier == INST_9XY0 ? CC_E
+                                                                    : CC_NE;
+    uint16_t skipped = (uint16_t)(end_pc + 4);
+    uint8_t *over = jcc_short_begin(e, no_skip);
+    emit_continue_at(e, jit, end_pc, skipped);
+    jcc_short_end(e, over);
+    emit_continue_at(e, jit, end_pc, next);
+  } else {
+    switch (end.identifier) {
+    case INST_1NNN:
+      emit_continue_at(e, jit, end_pc, end.address.NNN);
+      break;
+    case INST_2NNN:
+      load8(e, SCRATCH, OFFSET_SP);
+      store16_imm_indexed(e, SCRATCH, OFFSET_STACK, next);
+      inc8(e, OFFSET_SP);
+      emit_continue_at(e, jit, end_pc, end.address.NNN);
+      break;
+    case INST_00EE:
+      dec8(e, OFFSET_SP);
+      load8(e, SCRATCH, OFFSET_SP);
+      load16_indexed(e, PC, SCRATCH, OFFSET_STACK);
+      emit_continue(e, jit, end_pc, true, true);
+      break;
+    case INST_BNNN:
+      mov_rr(e, PC, host[0]);
+      alu_ri(e, ADD, PC, end.address.NNN);
+      emit_continue(e, jit, end_pc, true, true);
+      break;
+    default:
+      // The interpreter's handler, which can stop the run or move the PC.
+      mov_ri(e, SCRATCH, next);
+      store16(e, OFFSET_PC, SCRATCH);
+      emit_call(e, (const void *)jit_execute, RAX, raws[length - 1], true);
+      load16(e, PC, OFFSET_PC);
+      test_rr(e, RAX, RAX);
+      jcc_to(e, CC_NE, jit.leave);
+      emit_continue(e, jit, end_pc, true, true);
+      break;
+    }
+  }
+  jit_make_writable(jit, false);
+
+  if (e.overflow) {
+    return;
+  }
+  jit.used += e.out - start;
+  jit.entries[pc] = start;
+  jit.lengths[pc] = (uint8_t)length;
+  for (uint16_t a = pc; a < address; a += POT8TO_CODE_PAGE_SIZE) {
+    jit.translated_pages |= 1ull << (a / POT8TO_CODE_PAGE_SIZE);
+  }
+  jit.translated_pages |= 1ull << ((address - 1) / POT8TO_CODE_PAGE_SIZE);
+}
+
+// Drops every block overlapping a page the program wrote to.
+static void jit_invalidate_written(Jit &jit, State &state) {
+  uint64_t pages = state.written_pages & jit.translated_pages;
+  state.written_pages = 0;
+  for (size_t page = 0; pages != 0; page++, pages >>= 1) {
+    if ((pages & 1) == 0) {
+      continue;
+    }
+    size_t begin = page * POT8TO_CODE_PAGE_SIZE;
+    size_t end = begin + POT8TO_CODE_PAGE_SIZE;
+    size_t first = begin >= 2 * POT8TO_JIT_MAX_BLOCK_INSTRUCTIONS
+                       ? begin - 2 * POT8TO_JIT_MAX_BLOCK_INSTRUCTIONS
+                       : 0;
+    for (size_t a = first; a < end; a++) {
+      if (a + 2 * jit.lengths[a] > begin) {
+        jit.entries[a] = jit.lookup;
+        jit.lengths[a] = 0;
+      }
+    }
+  }
+}
+
+// Same contract as `run`. Native code runs block after block until the
+// budget left doesn't cover the next one, which is then interpreted one
+// instruction at a time like any address without a block.
+RunResult jit_run(Jit &jit, State &state, size_t budget) {
+  if (state.waiting_for_key) {
+    return wait_for_key(budget);
+  }
+  POT8TO_CLEAR_FAULT(state);
+  state.idle_period = 0;
+  JitRun run;
+  run.state = &state;
+  run.entries = jit.entries;
+  run.jit = &jit;
+  run.budget = budget;
+  idle_watch_reset(run.watch);
+#if defined(POT8TO_GUARD)
+  // Blocks don't check for faults.
+  const bool native = false;
+#elif defined(POT8TO_PROFILE) && defined(POT8TO_TRACE)
+  bool native = state.profile == nullptr && state.trace == nullptr;
+#elif defined(POT8TO_PROFILE)
+  // Blocks don't stop between instructions to be counted or recorded.
+  bool native = state.profile == nullptr;
+#elif defined(POT8TO_TRACE)
+  bool native = state.trace == nullptr;
+#else
+  const bool native = true;
+#endif
+  Instruction scratch;
+  RunResult result = {STOP_BUDGET_EXHAUSTED, 0};
+  while (result.executed < budget) {
+    // Memory can change under translated code through the interpreter's
+    // handlers, and through the host between runs (`load_state`,
+    // `reset_state`...).
+    if ((state.written_pages & jit.translated_pages) != 0) {
+      jit_invalidate_written(jit, state);
+    }
+    uint16_t pc = state.registers.PC;
+    size_t left = budget - result.executed;
+    if (native && pc < POT8TO_MAX_MEMORY) {
+      if (jit.lengths[pc] == 0) {
+        jit_translate(jit, state, pc);
+      }
+      if (jit.lengths[pc] != 0 && jit.lengths[pc] <= left) {
+        run.left = left;
+        jit.enter(&run);
+        result.executed = budget - (size_t)run.left;
+        if (run.reason == JIT_EXIT_LOOKUP || run.reason == JIT_EXIT_WRITTEN) {
+          continue;
+        }
+        result.reason = (StopReason)run.reason;
+        break;
+      }
+    }
+
+    StopReason reason = step(state, scratch);
+    result.executed++;
+    if (reason != STOP_NONE) {
+      result.reason = reason;
+      break;
+    }
+    POT8TO_IDLE_CHECK(state, run.watch, pc, result.executed, budget);
+  }
+  return result;
+}
+
+} // namespace Pot8to
+#endif
@@ -0,0 +1,766 @@
+#pragma once
+// Lane-parallel interpreter: `POT8TO_LANES` instances of one ROM stored
+// structure-of-arrays and stepped in lockstep, one opcode at a time for every
+// lane sitting at the same PC.
+//
+// Each step runs the instruction at the lowest PC among the lanes with budget
+// left, for all lanes at that PC. Lanes that branch elsewhere simply stop
+// matching, and because the laggards always go first the group merges back
+// as soon as they catch up.
+#include "pot8to.cpp"
+
+// Define POT8TO_LANES_SCALAR to build the portable fallback on x86 too.
+#if !defined(POT8TO_LANES_SCALAR) &&                                           \
+    (defined(__SSE2__) || defined(_M_X64) ||                                   \
+     (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define POT8TO_LANES_SSE2
+#include <emmintrin.h>
+#endif
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace Pot8to {
+
+// One SSE2 register of bytes.
+constexpr size_t POT8TO_LANES = 16;
+
+struct Lanes {
+  // Everything per lane is stored lane-minor, `V[3][n]` is V3 of lane n.
+  uint8_t V[16][POT8TO_LANES];
+  uint16_t I[POT8TO_LANES];
+  uint16_t PC[POT8TO_LANES];
+  uint8_t delay[POT8TO_LANES];
+  uint8_t sound[POT8TO_LANES];
+  uint8_t SP[POT8TO_LANES];
+  uint32_t rng[POT8TO_LANES];
+  uint16_t stack[16][POT8TO_LANES];
+  uint8_t keyboard[16][POT8TO_LANES];
+  uint64_t display[POT8TO_DISPLAY_HEIGHT][POT8TO_LANES];
+  // Instructions left in the current `run_lanes` chunk.
+  uint16_t budget[POT8TO_LANES];
+  // Lanes that ran into an unknown instruction, bit N is lane N. Like the
+  // interpreter they carry on past it. Lanes only model the original
+  // 64x32 single-plane machine, SUPER-CHIP and XO-CHIP instructions count
+  // as unknown here.
+  uint32_t unknown;
+  // Lanes waiting in FX0A like `State::waiting_for_key`, bit N is lane N.
+  // They sit out their budget until `lanes_set_keys` releases a key.
+  uint32_t waiting;
+  uint8_t key_register[POT8TO_LANES];
+  uint8_t memory[POT8TO_LANES][POT8TO_MAX_MEMORY];
+  // One bit per `POT8TO_CODE_PAGE_SIZE` bytes any lane has written. All
+  // other pages still hold the same bytes in every lane, so code there is
+  // fetched and decoded once for the whole group.
+  uint64_t written_pages;
+  // Decoded instructions of unwritten pages, one per even address.
+  Instruction decoded[POT8TO_MAX_MEMORY / 2];
+  uint64_t decoded_valid[POT8TO_MAX_MEMORY / 2 / 64];
+};
+
+// Lane-wise bytes (registers, timers, masks) and words (PC, I, budgets).
+// Masks have every bit of a lane set or clear.
+#ifdef POT8TO_LANES_SSE2
+typedef __m128i LaneBytes;
+struct LaneWords {
+  __m128i lo, hi;
+};
+
+static inline LaneBytes lane_load(const uint8_t *p) {
+  return _mm_loadu_si128((const __m128i *)p);
+}
+static inline void lane_store(uint8_t *p, LaneBytes v) {
+  _mm_storeu_si128((__m128i *)p, v);
+}
+static inline LaneBytes lane_splat(uint8_t x) {
+  return _mm_set1_epi8((char)x);
+}
+static inline LaneBytes lane_add(LaneBytes a, LaneBytes b) {
+  return _mm_add_epi8(a, b);
+}
+static inline LaneBytes lane_sub(LaneBytes a, LaneBytes b) {
+  return _mm_sub_epi8(a, b);
+}
+static inline LaneBytes lane_and(LaneBytes a, LaneBytes b) {
+  return _mm_and_si128(a, b);
+}
+static inline LaneBytes lane_or(LaneBytes a, LaneBytes b) {
+  return _mm_or_si128(a, b);
+}
+static inline LaneBytes lane_xor(LaneBytes a, LaneBytes b) {
+  return _mm_xor_si128(a, b);
+}
+// `b` where `mask` is set, `a` elsewhere.
+static inline LaneBytes lane_select(LaneBytes mask, LaneBytes a, LaneBytes b) {
+  return _mm_or_si128(_mm_andnot_si128(mask, a), _mm_and_si128(mask, b));
+}
+static inline LaneBytes lane_eq(LaneBytes a, LaneBytes b) {
+  return _mm_cmpeq_epi8(a, b);
+}
+// Unsigned a >= b.
+static inline LaneBytes lane_ge(LaneBytes a, LaneBytes b) {
+  return _mm_cmpeq_epi8(_mm_max_epu8(a, b), a);
+}
+// 1 where a + b overflows, 0 elsewhere.
+static inline LaneBytes lane_carry(LaneBytes a, LaneBytes b) {
+  return _mm_andnot_si128(
+      _mm_cmpeq_epi8(_mm_adds_epu8(a, b), _mm_add_epi8(a, b)), lane_splat(1));
+}
+static inline LaneBytes lane_shr(LaneBytes v, int n) {
+  return _mm_and_si128(_mm_srli_epi16(v, n), lane_splat(0xFF >> n));
+}
+static inline LaneBytes lane_decrement_saturated(LaneBytes v) {
+  return _mm_subs_epu8(v, lane_splat(1));
+}
+static inline uint32_t lane_bits(LaneBytes mask) {
+  return (uint32_t)_mm_movemask_epi8(mask);
+}
+
+static inline LaneWords lane_load_words(const uint16_t *p) {
+  LaneWords v = {_mm_loadu_si128((const __m128i *)p),
+                 _mm_loadu_si128((const __m128i *)(p + 8))};
+  return v;
+}
+static inline void lane_store_words(uint16_t *p, LaneWords v) {
+  _mm_storeu_si128((__m128i *)p, v.lo);
+  _mm_storeu_si128((__m128i *)(p + 8), v.hi);
+}
+static inline LaneWords lane_splat_words(uint16_t x) {
+  LaneWords v = {_mm_set1_epi16((short)x), _mm_set1_epi16((short)x)};
+  return v;
+}
+static inline LaneWords lane_add_words(LaneWords a, LaneWords b) {
+  LaneWords v = {_mm_add_epi16(a.lo, b.lo), _mm_add_epi16(a.hi, b.hi)};
+  return v;
+}
+static inline LaneWords lane_and_words(LaneWords a, LaneWords b) {
+  LaneWords v = {_mm_and_si128(a.lo, b.lo), _mm_and_si128(a.hi, b.hi)};
+  return v;
+}
+static inline LaneWords lane_andnot_words(LaneWords mask, LaneWords b) {
+  LaneWords v = {_mm_andnot_si128(mask.lo, b.lo),
+                 _mm_andnot_si128(mask.hi, b.hi)};
+  return v;
+}
+static inline LaneWords lane_select_words(LaneWords mask, LaneWords a,
+                                          LaneWords b) {
+  LaneWords v = {_mm_or_si128(_mm_andnot_si128(mask.lo, a.lo),
+                              _mm_and_si128(mask.lo, b.lo)),
+                 _mm_or_si128(_mm_andnot_si128(mask.hi, a.hi),
+                              _mm_and_si128(mask.hi, b.hi))};
+  return v;
+}
+static inline LaneWords lane_eq_words(LaneWords a, LaneWords b) {
+  LaneWords v = {_mm_cmpeq_epi16(a.lo, b.lo), _mm_cmpeq_epi16(a.hi, b.hi)};
+  return v;
+}
+static inline LaneWords lane_shl_words(LaneWords a, int n) {
+  LaneWords v = {_mm_slli_epi16(a.lo, n), _mm_slli_epi16(a.hi, n)};
+  return v;
+}
+// Zero-extends every byte.
+static inline LaneWords lane_widen(LaneBytes v) {
+  LaneWords w = {_mm_unpacklo_epi8(v, _mm_setzero_si128()),
+                 _mm_unpackhi_epi8(v, _mm_setzero_si128())};
+  return w;
+}
+static inline LaneWords lane_widen_mask(LaneBytes mask) {
+  LaneWords w = {_mm_unpacklo_epi8(mask, mask),
+                 _mm_unpackhi_epi8(mask, mask)};
+  return w;
+}
+static inline LaneBytes lane_narrow_mask(LaneWords mask) {
+  return _mm_packs_epi16(mask.lo, mask.hi);
+}
+static inline uint16_t lane_min_words(LaneWords v) {
+  // SSE2 only has a signed 16-bit min, flip the sign bits around it.
+  const __m128i bias = _mm_set1_epi16((short)0x8000);
+  __m128i m =
+      _mm_min_epi16(_mm_xor_si128(v.lo, bias), _mm_xor_si128(v.hi, bias));
+  m = _mm_min_epi16(m, _mm_srli_si128(m, 8));
+  m = _mm_min_epi16(m, _mm_srli_si128(m, 4));
+  m = _mm_min_epi16(m, _mm_srli_si128(m, 2));
+  return (uint16_t)(_mm_cvtsi128_si32(m) ^ 0x8000);
+}
+#else
+struct LaneBytes {
+  uint8_t b[POT8TO_LANES];
+};
+struct LaneWords {
+  uint16_t w[POT8TO_LANES];
+};
+
+#define POT8TO_LANE_MAP(type, field, expression)                               \
+  type out;                                                                    \
+  for (size_t n = 0; n < POT8TO_LANES; n++) {                                  \
+    out.field[n] = expression;                                                 \
+  }                                                                            \
+  return out
+
+static inline LaneBytes lane_load(const uint8_t *p) {
+  POT8TO_LANE_MAP(LaneBytes, b, p[n]);
+}
+static inline void lane_store(uint8_t *p, LaneBytes v) {
+  memcpy(p, v.b, sizeof(v.b));
+}
+static inline LaneBytes lane_splat(uint8_t x) {
+  POT8TO_LANE_MAP(LaneBytes, b, x);
+}
+static inline LaneBytes lane_add(LaneBytes a, LaneBytes b) {
+  POT8TO_LANE_MAP(LaneBytes, b, (uint8_t)(a.b[n] + b.b[n]));
+}
+static inline LaneBytes lane_sub(LaneBytes a, LaneBytes b) {
+  POT8TO_LANE_MAP(LaneBytes, b, (uint8_t)(a.b[n] - b.b[n]));
+}
+static inline LaneBytes lane_and(LaneBytes a, LaneBytes b) {
+  POT8TO_LANE_MAP(LaneBytes, b, a.b[n] & b.b[n]);
+}
+static inline LaneBytes lane_or(LaneBytes a, LaneBytes b) {
+  POT8TO_LANE_MAP(LaneBytes, b, a.b[n] | b.b[n]);
+}
+static inline LaneBytes lane_xor(LaneBytes a, LaneBytes b) {
+  POT8TO_LANE_MAP(LaneBytes, b, a.b[n] ^ b.b[n]);
+}
+static inline LaneBytes lane_select(LaneBytes mask, LaneBytes a, LaneBytes b) {
+  POT8TO_LANE_MAP(LaneBytes, b, mask.b[n] ? b.b[n] : a.b[n]);
+}
+static inline LaneBytes lane_eq(LaneBytes a, LaneBytes b) {
+  POT8TO_LANE_MAP(LaneBytes, b, a.b[n] == b.b[n] ? 0xFF : 0);
+}
+static inline LaneBytes lane_ge(LaneBytes a, LaneBytes b) {
+  POT8TO_LANE_MAP(LaneBytes, b, a.b[n] >= b.b[n] ? 0xFF : 0);
+}
+static inline LaneBytes lane_carry(LaneBytes a, LaneBytes b) {
+  POT8TO_LANE_MAP(LaneBytes, b, a.b[n] + b.b[n] > 0xFF);
+}
+static inline LaneBytes lane_shr(LaneBytes v, int n_bits) {
+  POT8TO_LANE_MAP(LaneBytes, b, v.b[n] >> n_bits);
+}
+static inline LaneBytes lane_decrement_saturated(LaneBytes v) {
+  POT8TO_LANE_MAP(LaneBytes, b, v.b[n] > 0 ? v.b[n] - 1 : 0);
+}
+static inline uint32_t lane_bits(LaneBytes mask) {
+  uint32_t bits = 0;
+  for (size_t n = 0; n < POT8TO_LANES; n++) {
+    bits |= (uint32_t)(mask.b[n] >> 7) << n;
+  }
+  return bits;
+}
+
+static inline LaneWords lane_load_words(const uint16_t *p) {
+  POT8TO_LANE_MAP(LaneWords, w, p[n]);
+}
+static inline void lane_store_words(uint16_t *p, LaneWords v) {
+  memcpy(p, v.w, sizeof(v.w));
+}
+static inline LaneWords lane_splat_words(uint16_t x) {
+  POT8TO_LANE_MAP(LaneWords, w, x);
+}
+static inline LaneWords lane_add_words(LaneWords a, LaneWords b) {
+  POT8TO_LANE_MAP(LaneWords, w, (uint16_t)(a.w[n] + b.w[n]));
+}
+static inline LaneWords lane_and_words(LaneWords a, LaneWords b) {
+  POT8TO_LANE_MAP(LaneWords, w, a.w[n] & b.w[n]);
+}
+static inline LaneWords lane_andnot_words(LaneWords mask, LaneWords b) {
+  POT8TO_LANE_MAP(LaneWords, w, (uint16_t)(~mask.w[n] & b.w[n]));
+}
+static inline LaneWords lane_select_words(LaneWords mask, LaneWords a,
+                                          LaneWords b) {
+  POT8TO_LANE_MAP(LaneWords, w, mask.w[n] ? b.w[n] : a.w[n]);
+}
+static inline LaneWords lane_eq_words(LaneWords a, LaneWords b) {
+  POT8TO_LANE_MAP(LaneWords, w, a.w[n] == b.w[n] ? 0xFFFF : 0);
+}
+static inline LaneWords lane_shl_words(LaneWords a, int n_bits) {
+  POT8TO_LANE_MAP(LaneWords, w, (uint16_t)(a.w[n] << n_bits));
+}
+static inline LaneWords lane_widen(LaneBytes v) {
+  POT8TO_LANE_MAP(LaneWords, w, v.b[n]);
+}
+static inline LaneWords lane_widen_mask(LaneBytes mask) {
+  POT8TO_LANE_MAP(LaneWords, w, mask.b[n] ? 0xFFFF : 0);
+}
+static inline LaneBytes lane_narrow_mask(LaneWords mask) {
+  POT8TO_LANE_MAP(LaneBytes, b, mask.w[n] ? 0xFF : 0);
+}
+static inline uint16_t lane_min_words(LaneWords v) {
+  uint16_t m = v.w[0];
+  for (size_t n = 1; n < POT8TO_LANES; n++) {
+    m = v.w[n] < m ? v.w[n] : m;
+  }
+  return m;
+}
+#undef POT8TO_LANE_MAP
+#endif
+
+static inline LaneBytes lane_not(LaneBytes mask) {
+  return lane_xor(mask, lane_splat(0xFF));
+}
+
+// 0 or 1 for every lane of a mask.
+static inline LaneBytes lane_flag(LaneBytes mask) {
+  return lane_and(mask, lane_splat(1));
+}
+
+static inline LaneBytes lane_mask_from_bits(uint32_t bits) {
+  uint8_t mask[POT8TO_LANES];
+  for (size_t n = 0; n < POT8TO_LANES; n++) {
+    mask[n] = (bits >> n) & 1 ? 0xFF : 0;
+  }
+  return lane_load(mask);
+}
+
+static inline size_t lowest_lane(uint32_t bits) {
+#if defined(__GNUC__)
+  return (size_t)__builtin_ctz(bits);
+#elif defined(_MSC_VER)
+  unsigned long index;
+  _BitScanForward(&index, bits);
+  return index;
+#else
+  size_t index = 0;
+  while ((bits & 1) == 0) {
+    bits >>= 1;
+    index++;
+  }
+  return index;
+#endif
+}
+
+static inline size_t lane_count(uint32_t bits) {
+  size_t count = 0;
+  for (; bits != 0; bits &= bits - 1) {
+    count++;
+  }
+  return count;
+}
+
+// Visits every lane set in `bits`.
+#define POT8TO_FOR_EACH_LANE(lane, bits)                                       \
+  for (uint32_t lane##_rest = (bits), lane = 0;                                \
+       lane##_rest != 0 && ((lane = lowest_lane(lane##_rest)), true);          \
+       lane##_rest &= lane##_rest - 1)
+
+static void set_lane(Lanes &lanes, size_t lane, const State &state) {
+  for (size_t i = 0; i < 16; i++) {
+    lanes.V[i][lane] = state.registers.V[i];
+    lanes.stack[i][lane] = state.stack[i];
+    lanes.keyboard[i][lane] = state.keyboard[i];
+  }
+  lanes.I[lane] = state.registers.I;
+  lanes.PC[lane] = state.registers.PC;
+  lanes.delay[lane] = state.registers.T.delay;
+  lanes.sound[lane] = state.registers.T.sound;
+  lanes.SP[lane] = state.registers.SP;
+  lanes.rng[lane] = state.rng;
+  lanes.waiting = (lanes.waiting & ~(1u << lane)) |
+                  ((uint32_t)state.waiting_for_key << lane);
+  lanes.key_register[lane] = state.key_register;
+  for (size_t y = 0; y < POT8TO_DISPLAY_HEIGHT; y++) {
+    lanes.display[y][lane] = state.display[0][y];
+  }
+  memcpy(lanes.memory[lane], state.memory, sizeof(state.memory));
+}
+
+// Every lane starts from `initialize(program)` with no keys held and the
+// default seed.
+void lanes_initialize(Lanes &lanes, const Platform::Program &program) {
+  State state = initialize(program);
+  lanes.waiting = 0;
+  for (size_t lane = 0; lane < POT8TO_LANES; lane++) {
+    set_lane(lanes, lane, state);
+    lanes.budget[lane] = 0;
+  }
+  lanes.unknown = 0;
+  lanes.written_pages = 0;
+  memset(lanes.decoded_valid, 0, sizeof(lanes.decoded_valid));
+}
+
+// Holds down the keys set in `keys` (bit N is key N) and releases the rest,
+// in key order through `set_key`'s rules.
+void lanes_set_keys(Lanes &lanes, size_t lane, uint16_t keys) {
+  for (size_t key = 0; key < 16; key++) {
+    uint8_t down = (keys >> key) & 1;
+    if (!down && lanes.keyboard[key][lane] && (lanes.waiting >> lane) & 1) {
+      lanes.V[lanes.key_register[lane]][lane] = (uint8_t)key;
+      lanes.waiting &= ~(1u << lane);
+    }
+    lanes.keyboard[key][lane] = down;
+  }
+}
+
+// `seed` for one lane.
+void lanes_seed(Lanes &lanes, size_t lane, uint32_t value) {
+  lanes.rng[lane] = value != 0 ? value : POT8TO_DEFAULT_SEED;
+}
+
+// Copies one lane out into a regular `State`.
+State lanes_extract(const Lanes &lanes, size_t lane) {
+  State state = State{};
+  for (size_t i = 0; i < 16; i++) {
+    state.registers.V[i] = lanes.V[i][lane];
+    state.stack[i] = lanes.stack[i][lane];
+    state.keyboard[i] = lanes.keyboard[i][lane] != 0;
+  }
+  state.registers.I = lanes.I[lane];
+  state.registers.PC = lanes.PC[lane];
+  state.registers.T.delay = lanes.delay[lane];
+  state.registers.T.sound = lanes.sound[lane];
+  state.registers.SP = lanes.SP[lane];
+  state.rng = lanes.rng[lane];
+  state.waiting_for_key = (lanes.waiting >> lane) & 1;
+  state.key_register = lanes.key_register[lane];
+  for (size_t y = 0; y < POT8TO_DISPLAY_HEIGHT; y++) {
+    state.display[0][y] = lanes.display[y][lane];
+  }
+  memcpy(state.memory, lanes.memory[lane], sizeof(state.memory));
+  state.written_pages = ~0ull;
+  return state;
+}
+
+static void lanes_mark_written(Lanes &lanes, size_t address, size_t length) {
+  for (size_t a = address; a < address + length; a++) {
+    lanes.written_pages |=
+        1ull << ((a % POT8TO_MAX_MEMORY) / POT8TO_CODE_PAGE_SIZE);
+  }
+}
+
+static inline void lanes_write_V(Lanes &lanes, size_t x, LaneBytes active,
+                                 LaneBytes value) {
+  lane_store(lanes.V[x], lane_select(active, lane_load(lanes.V[x]), value));
+}
+
+// Skips the next instruction in every lane set in `condition`.
+static inline void lanes_skip_if(Lanes &lanes, LaneBytes condition) {
+  LaneWords pc = lane_load_words(lanes.PC);
+  LaneWords skip =
+      lane_and_words(lane_widen_mask(condition), lane_splat_words(2));
+  lane_store_words(lanes.PC, lane_add_words(pc, skip));
+}
+
+// The instruction at `pc` for the lanes in `bits`. Lanes whose memory holds a
+// different opcode there are dropped from `bits`, they get their own step.
+static inline Instruction lanes_fetch(Lanes &lanes, uint16_t pc,
+                                      uint32_t &bits) {
+  size_t leader = lowest_lane(bits);
+  size_t first = pc % POT8TO_MAX_MEMORY;
+  size_t second = (pc + 1) % POT8TO_MAX_MEMORY;
+  uint64_t pages = (1ull << (first / POT8TO_CODE_PAGE_SIZE)) |
+                   (1ull << (second / POT8TO_CODE_PAGE_SIZE));
+  bool shared = (lanes.written_pages & pages) == 0;
+  if (shared && (first & 1) == 0) {
+    size_t slot = first >> 1;
+    if ((lanes.decoded_valid[slot >> 6] & (1ull << (slot & 63))) == 0) {
+      lanes.decoded[slot] = decode_instruction(
+          (uint16_t)(lanes.memory[leader][first] << 8 |
+                     lanes.memory[leader][second]));
+      lanes.decoded_valid[slot >> 6] |= 1ull << (slot & 63);
+    }
+    return lanes.decoded[slot];
+  }
+
+  uint8_t high = lanes.memory[leader][first];
+  uint8_t low = lanes.memory[leader][second];
+  if (!shared) {
+    POT8TO_FOR_EACH_LANE(lane, bits) {
+      if (lanes.memory[lane][first] != high ||
+          lanes.memory[lane][second] != low) {
+        bits &= ~(1u << lane);
+      }
+    }
+  }
+  return decode_instruction((uint16_t)(high << 8 | low));
+}
+
+struct LanesRunResult {
+  // Instructions executed, summed over all lanes. As in `RunResult`, the
+  // budget of a lane waiting for a key counts too.
+  uint64_t executed;
+  // The part of `executed` lanes spent waiting for a key.
+  uint64_t waited;
+  // Group steps. `executed / (steps * POT8TO_LANES)` is how full the lanes
+  // ran.
+  uint64_t steps;
+};
+
+// Runs `instruction` for the lanes in `bits` (`active` as a mask), whose PCs
+// have already moved past it.
+static void lanes_execute(Lanes &lanes, const Instruction &instruction,
+                          uint32_t bits, LaneBytes active) {
+  size_t x = instruction.registers.vx;
+  size_t y = instruction.registers.vy;
+  LaneBytes vx = lane_load(lanes.V[x]);
+  LaneBytes vy = lane_load(lanes.V[y]);
+  LaneBytes nn = lane_splat(instruction.address.NN);
+
+  switch (instruction.identifier) {
+  case INST_00E0:
+    POT8TO_FOR_EACH_LANE(lane, bits) {
+      for (size_t row = 0; row < POT8TO_DISPLAY_HEIGHT; row++) {
+        lanes.display[row][lane] = 0;
+      }
+    }
+    break;
+  case INST_00EE:
+    POT8TO_FOR_EACH_LANE(lane, bits) {
+      lanes.SP[lane]--;
+      lanes.PC[lane] = lanes.stack[lanes.SP[lane] % 16][lane];
+    }
+    break;
+  case INST_1NNN: {
+    LaneWords pc = lane_load_words(lanes.PC);
+    LaneWords target = lane_splat_words(instruction.address.NNN);
+    lane_store_words(lanes.PC,
+                     lane_select_words(lane_widen_mask(active), pc, target));
+    break;
+  }
+  case INST_2NNN:
+    POT8TO_FOR_EACH_LANE(lane, bits) {
+      lanes.stack[lanes.SP[lane] % 16][lane] = lanes.PC[lane];
+      lanes.SP[lane]++;
+      lanes.PC[lane] = instruction.address.NNN;
+    }
+    break;
+  case INST_3XNN:
+    lanes_skip_if(lanes, lane_and(active, lane_eq(vx, nn)));
+    break;
+  case INST_4XNN:
+    lanes_skip_if(lanes, lane_and(active, lane_not(lane_eq(vx, nn))));
+    break;
+  case INST_5XY0:
+    lanes_skip_if(lanes, lane_and(active, lane_eq(vx, vy)));
+    break;
+  case INST_6XNN:
+    lanes_write_V(lanes, x, active, nn);
+    break;
+  case INST_7XNN:
+    lanes_write_V(lanes, x, active, lane_add(vx, nn));
+    break;
+  case INST_8XY0:
+    lanes_write_V(lanes, x, active, vy);
+    break;
+  case INST_8XY1:
+    lanes_write_V(lanes, x, active, lane_or(vx, vy));
+    break;
+  case INST_8XY2:
+    lanes_write_V(lanes, x, active, lane_and(vx, vy));
+    break;
+  case INST_8XY3:
+    lanes_write_V(lanes, x, active, lane_xor(vx, vy));
+    break;
+  case INST_8XY4:
+    lanes_write_V(lanes, x, active, lane_add(vx, vy));
+    lanes_write_V(lanes, 0xF, active, lane_carry(vx, vy));
+    break;
+  case INST_8XY5:
+    lanes_write_V(lanes, x, active, lane_sub(vx, vy));
+    lanes_write_V(lanes, 0xF, active, lane_flag(lane_ge(vx, vy)));
+    break;
+  case INST_8XY6:
+    lanes_write_V(lanes, x, active, lane_shr(vx, 1));
+    lanes_write_V(lanes, 0xF, active, lane_and(vx, lane_splat(1)));
+    break;
+  case INST_8XY7:
+    lanes_write_V(lanes, x, active, lane_sub(vy, vx));
+    lanes_write_V(lanes, 0xF, active, lane_flag(lane_ge(vy, vx)));
+    break;
+  case INST_8XYE:
+    lanes_write_V(lanes, x, active, lane_add(vx, vx));
+    lanes_write_V(lanes, 0xF, active, lane_shr(vx, 7));
+    break;
+  case INST_9XY0:
+    lanes_skip_if(lanes, lane_and(active, lane_not(lane_eq(vx, vy))));
+    break;
+  case INST_ANNN: {
+    LaneWords i = lane_load_words(lanes.I);
+    LaneWords target = lane_splat_words(instruction.address.NNN);
+    lane_store_words(lanes.I,
+                     lane_select_words(lane_widen_mask(active), i, target));
+    break;
+  }
+  case INST_BNNN: {
+    LaneWords pc = lane_load_words(lanes.PC);
+    LaneWords v0 = lane_widen(lane_load(lanes.V[0]));
+    LaneWords target =
+        lane_add_words(v0, lane_splat_words(instruction.address.NNN));
+    lane_store_words(lanes.PC,
+                     lane_select_words(lane_widen_mask(active), pc, target));
+    break;
+  }
+  case INST_CXNN:
+    POT8TO_FOR_EACH_LANE(lane, bits) {
+      lanes.V[x][lane] = next_random(lanes.rng[lane]) & instruction.address.NN;
+    }
+    break;
+  case INST_DXYN:
+    // DXY0 draws nothing and clears VF, as in `DefaultQuirks`.
+    POT8TO_FOR_EACH_LANE(lane, bits) {
+      uint64_t collision = 0;
+      unsigned shift = lanes.V[x][lane] % 64;
+      size_t top = lanes.V[y][lane];
+      for (size_t i = 0; i < instruction.address.N; i++) {
+        size_t address = (lanes.I[lane] + i) % POT8TO_MAX_MEMORY;
+        uint64_t sprite = (uint64_t)lanes.memory[lane][address] << 56;
+        sprite = (sprite >> shift) | (sprite << ((64 - shift) % 64));
+        uint64_t &row = lanes.display[(top + i) % POT8TO_DISPLAY_HEIGHT][lane];
+        collision |= row & sprite;
+        row ^= sprite;
+      }
+      lanes.V[0xF][lane] = collision != 0;
+    }
+    break;
+  case INST_EX9E: {
+    LaneBytes keys = lane_load(lanes.keyboard[x]);
+    // Indexes the keyboard by register number, like `op_EX9E`.
+    lanes_skip_if(lanes, lane_and(active, lane_eq(keys, lane_splat(1))));
+    break;
+  }
+  case INST_EXA1: {
+    LaneBytes keys = lane_load(lanes.keyboard[x]);
+    lanes_skip_if(lanes, lane_and(active, lane_eq(keys, lane_splat(0))));
+    break;
+  }
+  case INST_FX07:
+    lanes_write_V(lanes, x, active, lane_load(lanes.delay));
+    break;
+  case INST_FX0A:
+    lanes.waiting |= bits;
+    POT8TO_FOR_EACH_LANE(lane, bits) {
+      lanes.key_register[lane] = (uint8_t)x;
+    }
+    break;
+  case INST_FX15:
+    lane_store(lanes.delay, lane_select(active, lane_load(lanes.delay), vx));
+    break;
+  case INST_FX18:
+    lane_store(lanes.sound, lane_select(active, lane_load(lanes.sound), vx));
+    break;
+  case INST_FX1E: {
+    LaneWords i = lane_load_words(lanes.I);
+    lane_store_words(lanes.I,
+                     lane_add_words(i, lane_widen(lane_and(active, vx))));
+    break;
+  }
+  case INST_FX29: {
+    LaneWords i = lane_load_words(lanes.I);
+    LaneWords wide = lane_widen(vx);
+    LaneWords sprite = lane_add_words(lane_shl_words(wide, 2), wide);
+    lane_store_words(lanes.I,
+                     lane_select_words(lane_widen_mask(active), i, sprite));
+    break;
+  }
+  case INST_FX33:
+    POT8TO_FOR_EACH_LANE(lane, bits) {
+      uint8_t val = lanes.V[x][lane];
+      uint8_t *memory = lanes.memory[lane];
+      memory[lanes.I[lane] % POT8TO_MAX_MEMORY] = val / 100;
+      memory[(lanes.I[lane] + 1) % POT8TO_MAX_MEMORY] = (val / 10) % 10;
+      memory[(lanes.I[lane] + 2) % POT8TO_MAX_MEMORY] = val % 10;
+      lanes_mark_written(lanes, lanes.I[lane], 3);
+    }
+    break;
+  case INST_FX55:
+    POT8TO_FOR_EACH_LANE(lane, bits) {
+      for (size_t i = 0; i <= x; i++) {
+        lanes.memory[lane][(lanes.I[lane] + i) % POT8TO_MAX_MEMORY] =
+            lanes.V[i][lane];
+      }
+      lanes_mark_written(lanes, lanes.I[lane], x + 1);
+    }
+    break;
+  case INST_FX65:
+    POT8TO_FOR_EACH_LANE(lane, bits) {
+      for (size_t i = 0; i <= x; i++) {
+        lanes.V[i][lane] =
+            lanes.memory[lane][(lanes.I[lane] + i) % POT8TO_MAX_MEMORY];
+      }
+    }
+    break;
+  case INST_00CN:
+  case INST_00DN:
+  case INST_00FB:
+  case INST_00FC:
+  case INST_00FD:
+  case INST_00FE:
+  case INST_00FF:
+  case INST_FX30:
+  case INST_FX75:
+  case INST_FX85:
+  case INST_FN01:
+  case INST_UNKNOWN:
+    Platform::except_unknown_inst();
+    lanes.unknown |= bits;
+    break;
+  }
+}
+
+// Takes the budget away from the lanes waiting for a key and returns how
+// much it was.
+static uint64_t lanes_sit_out_wait(Lanes &lanes) {
+  uint64_t taken = 0;
+  POT8TO_FOR_EACH_LANE(lane, lanes.waiting) {
+    taken += lanes.budget[lane];
+    lanes.budget[lane] = 0;
+  }
+  return taken;
+}
+
+// Runs `budget` instructions on every lane, lanes waiting for a key run
+// none.
+LanesRunResult run_lanes(Lanes &lanes, size_t budget) {
+  LanesRunResult result = {0, 0, 0};
+  while (budget > 0) {
+    uint16_t chunk = budget > 0xFFFF ? 0xFFFF : (uint16_t)budget;
+    budget -= chunk;
+    for (size_t lane = 0; lane < POT8TO_LANES; lane++) {
+      lanes.budget[lane] = chunk;
+    }
+    result.waited += lanes_sit_out_wait(lanes);
+
+    while (true) {
+      LaneWords left = lane_load_words(lanes.budget);
+      LaneWords pc = lane_load_words(lanes.PC);
+      LaneWords idle = lane_eq_words(left, lane_splat_words(0));
+      // Lanes without budget can't hold the minimum back.
+      uint16_t group_pc = lane_min_words(
+          lane_select_words(idle, pc, lane_splat_words(0xFFFF)));
+      LaneWords at_pc = lane_andnot_words(
+          idle, lane_eq_words(pc, lane_splat_words(group_pc)));
+      uint32_t bits = lane_bits(lane_narrow_mask(at_pc));
+      if (bits == 0) {
+        break;
+      }
+
+      uint32_t fetched = bits;
+      Instruction instruction = lanes_fetch(lanes, group_pc, bits);
+      if (bits != fetched) {
+        at_pc = lane_widen_mask(lane_mask_from_bits(bits));
+      }
+
+      // PC += 2 and budget -= 1 for the lanes going ahead.
+      LaneWords advance = lane_and_words(at_pc, lane_splat_words(2));
+      lane_store_words(lanes.PC, lane_add_words(pc, advance));
+      lane_store_words(lanes.budget, lane_add_words(left, at_pc));
+      lanes_execute(lanes, instruction, bits, lane_narrow_mask(at_pc));
+      if (instruction.identifier == INST_FX0A) {
+        result.waited += lanes_sit_out_wait(lanes);
+      }
+
+      result.executed += lane_count(bits);
+      result.steps++;
+    }
+  }
+  result.executed += result.waited;
+  return result;
+}
+
+// `decrement_timers` for every lane.
+void lanes_decrement_timers(Lanes &lanes) {
+  lane_store(lanes.delay, lane_decrement_saturated(lane_load(lanes.delay)));
+  lane_store(lanes.sound, lane_decrement_saturated(lane_load(lanes.sound)));
+}
+
+#undef POT8TO_FOR_EACH_LANE
+
+} // namespace Pot8to
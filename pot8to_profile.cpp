@@ -0,0 +1,87 @@
+#pragma once
+// Export for the profile the cores fill in when built with POT8TO_PROFILE,
+// see `Profile`. Without the flag this file is empty.
+#include "pot8to.cpp"
+
+#ifdef POT8TO_PROFILE
+#include <algorithm>
+#include <stdio.h>
+#include <vector>
+
+namespace Pot8to {
+
+// Same order as `InstructionIdentifier`.
+static const char *const instruction_names[] = {
+    "00E0", "00EE", "1NNN", "2NNN", "3XNN", "4XNN", "5XY0", "6XNN", "7XNN",
+    "8XY0", "8XY1", "8XY2", "8XY3", "8XY4", "8XY5", "8XY6", "8XY7", "8XYE",
+    "9XY0", "ANNN", "BNNN", "CXNN", "DXYN", "EX9E", "EXA1", "FX07", "FX0A",
+    "FX15", "FX18", "FX1E", "FX29", "FX33", "FX55", "FX65", "00CN", "00FB",
+    "00FC", "00FD", "00FE", "00FF", "FX30", "FX75", "FX85", "00DN", "FN01",
+    "UNKNOWN"};
+static_assert(sizeof(instruction_names) / sizeof(instruction_names[0]) ==
+                  INST_UNKNOWN + 1,
+              "instruction_names must cover every InstructionIdentifier");
+
+// Writes `profile` as one JSON object. Hotspots list every address that ran
+// at least once, hottest first, with the opcode currently at that address in
+// `state`. Returns false if writing failed.
+bool profile_write_json(const Profile &profile, const State &state,
+                        FILE *out) {
+  fprintf(out, "{\n  \"instructions\": %llu,\n",
+          (unsigned long long)profile.instructions);
+  fprintf(out, "  \"dxyn_pixels\": %llu,\n",
+          (unsigned long long)profile.dxyn_pixels);
+
+  fprintf(out, "  \"frames\": {\n    \"count\": %llu,\n",
+          (unsigned long long)profile.frames);
+  fprintf(out, "    \"min_instructions\": %llu,\n",
+          (unsigned long long)profile.frame_min);
+  fprintf(out, "    \"max_instructions\": %llu,\n",
+          (unsigned long long)profile.frame_max);
+  // Instructions per frame -> frames, the last bucket also holds longer ones.
+  fprintf(out, "    \"instructions_histogram\": {");
+  const char *separator = "";
+  for (size_t i = 0; i < POT8TO_PROFILE_FRAME_BUCKETS; i++) {
+    if (profile.by_frame_length[i] != 0) {
+      fprintf(out, "%s\"%zu\": %llu", separator, i,
+              (unsigned long long)profile.by_frame_length[i]);
+      separator = ", ";
+    }
+  }
+  fprintf(out, "}\n  },\n");
+
+  fprintf(out, "  \"opcodes\": {\n");
+  for (size_t i = 0; i <= INST_UNKNOWN; i++) {
+    fprintf(out, "    \"%s\": %llu%s\n", instruction_names[i],
+            (unsigned long long)profile.by_identifier[i],
+            i < INST_UNKNOWN ? "," : "");
+  }
+  fprintf(out, "  },\n");
+
+  std::vector<uint16_t> hot;
+  for (size_t pc = 0; pc < POT8TO_MAX_MEMORY; pc++) {
+    if (profile.by_pc[pc] != 0) {
+      hot.push_back((uint16_t)pc);
+    }
+  }
+  std::stable_sort(hot.begin(), hot.end(), [&](uint16_t a, uint16_t b) {
+    return profile.by_pc[a] > profile.by_pc[b];
+  });
+  fprintf(out, "  \"hotspots\": [");
+  for (size_t i = 0; i < hot.size(); i++) {
+    uint16_t pc = hot[i];
+    uint16_t raw = (uint16_t)((state.memory[pc] << 8) |
+                              state.memory[(pc + 1) % POT8TO_MAX_MEMORY]);
+    fprintf(out,
+            "%s\n    {\"pc\": \"0x%03X\", \"opcode\": \"%04X\", \"kind\": "
+            "\"%s\", \"hits\": %llu}",
+            i > 0 ? "," : "", pc, raw,
+            instruction_names[decode_instruction(raw).identifier],
+            (unsigned long long)profile.by_pc[pc]);
+  }
+  fprintf(out, "\n  ]\n}\n");
+  return ferror(out) == 0;
+}
+
+} // namespace Pot8to
+#endif
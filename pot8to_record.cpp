@@ -0,0 +1,174 @@
+#pragma once
+// Input recordings: the seed a run started from plus every key change,
+// stamped with the number of instructions executed before it. Replaying one
+// on the same ROM reproduces the run exactly, at whatever speed the host
+// drives the core.
+//
+// Layout: "P8RC", u16 version, u32 instructions per frame, u32 seed, u64
+// FNV-1a of the ROM, all little-endian, then the events. An event is the
+// instruction count since the previous event as LEB128, then one byte:
+// 0x10 | key for a press, key for a release, 0xFF for the end of the run.
+#include "pot8to.cpp"
+#include <vector>
+
+namespace Pot8to {
+
+constexpr uint16_t POT8TO_RECORDING_VERSION = 1;
+constexpr size_t POT8TO_RECORDING_HEADER_SIZE = 4 + 2 + 4 + 4 + 8;
+constexpr uint8_t POT8TO_RECORDING_END = 0xFF;
+
+static uint64_t rom_hash(const Platform::Program &program) {
+  uint64_t hash = 0xCBF29CE484222325ull;
+  for (size_t i = 0; i < program.size; i++) {
+    hash ^= program.buffer[i];
+    hash *= 0x100000001B3ull;
+  }
+  return hash;
+}
+
+static void put_bytes_le(std::vector<uint8_t> &out, uint64_t value,
+                         size_t bytes) {
+  for (size_t i = 0; i < bytes; i++) {
+    out.push_back((uint8_t)(value >> (8 * i)));
+  }
+}
+
+struct Recorder {
+  std::vector<uint8_t> bytes;
+  // Instruction count of the last event written.
+  uint64_t last;
+};
+
+// Starts a recording of a run of `program` that was seeded with `seed` and
+// ticks the timers every `instructions_per_frame` instructions.
+void record_begin(Recorder &recorder, const Platform::Program &program,
+                  uint32_t seed, uint32_t instructions_per_frame) {
+  recorder.bytes.clear();
+  recorder.last = 0;
+  for (size_t i = 0; i < 4; i++) {
+    recorder.bytes.push_back((uint8_t)"P8RC"[i]);
+  }
+  put_bytes_le(recorder.bytes, POT8TO_RECORDING_VERSION, 2);
+  put_bytes_le(recorder.bytes, instructions_per_frame, 4);
+  put_bytes_le(recorder.bytes, seed, 4);
+  put_bytes_le(recorder.bytes, rom_hash(program), 8);
+}
+
+static void record_event(Recorder &recorder, uint64_t instruction,
+                         uint8_t event) {
+  uint64_t delta = instruction - recorder.last;
+  do {
+    uint8_t byte = delta & 0x7F;
+    delta >>= 7;
+    recorder.bytes.push_back(delta != 0 ? byte | 0x80 : byte);
+  } while (delta != 0);
+  recorder.bytes.push_back(event);
+  recorder.last = instruction;
+}
+
+// Logs `key` going down or up before instruction number `instruction` (0 is
+// the first one) runs. Instructions must not go backwards.
+void record_key(Recorder &recorder, uint64_t instruction, uint8_t key,
+                bool down) {
+  record_event(recorder, instruction, (uint8_t)((down ? 0x10 : 0) | key));
+}
+
+// Closes the recording after `instruction` instructions ran in total.
+void record_end(Recorder &recorder, uint64_t instruction) {
+  record_event(recorder, instruction, POT8TO_RECORDING_END);
+}
+
+struct Replay {
+  const uint8_t *data;
+  size_t size;
+  // Offset of the event after `event`.
+  size_t cursor;
+  uint32_t seed;
+  uint32_t instructions_per_frame;
+  // Instructions in the whole run.
+  uint64_t end;
+  // Instruction the pending event happens before, and what it is.
+  uint64_t next;
+  uint8_t event;
+};
+
+static bool read_event(const uint8_t *data, size_t size, size_t &cursor,
+                       uint64_t &instruction, uint8_t &event) {
+  uint64_t delta = 0;
+  for (unsigned shift = 0;; shift += 7) {
+    if (cursor >= size || shift > 63) {
+      return false;
+    }
+    uint8_t byte = data[cursor++];
+    delta |= (uint64_t)(byte & 0x7F) << shift;
+    if ((byte & 0x80) == 0) {
+      break;
+    }
+  }
+  if (cursor >= size) {
+    return false;
+  }
+  event = data[cursor++];
+  instruction += delta;
+  return event == POT8TO_RECORDING_END || event < 0x20;
+}
+
+// Opens a recording made on `program`. `data` must outlive the replay.
+// Returns false unless the whole recording is well formed and ends with an
+// end event.
+bool replay_open(Replay &replay, const uint8_t *data, size_t size,
+                 const Platform::Program &program) {
+  if (size < POT8TO_RECORDING_HEADER_SIZE || memcmp(data, "P8RC", 4) != 0) {
+    return false;
+  }
+  uint64_t header[4];
+  const size_t widths[4] = {2, 4, 4, 8};
+  size_t offset = 4;
+  for (size_t field = 0; field < 4; field++) {
+    header[field] = 0;
+    for (size_t i = 0; i < widths[field]; i++) {
+      header[field] |= (uint64_t)data[offset++] << (8 * i);
+    }
+  }
+  if (header[0] != POT8TO_RECORDING_VERSION || header[1] == 0 ||
+      header[3] != rom_hash(program)) {
+    return false;
+  }
+
+  size_t cursor = offset;
+  uint64_t instruction = 0;
+  uint8_t event = 0;
+  do {
+    if (!read_event(data, size, cursor, instruction, event)) {
+      return false;
+    }
+  } while (event != POT8TO_RECORDING_END);
+  if (cursor != size) {
+    return false;
+  }
+
+  replay.data = data;
+  replay.size = size;
+  replay.cursor = offset;
+  replay.instructions_per_frame = (uint32_t)header[1];
+  replay.seed = (uint32_t)header[2];
+  replay.end = instruction;
+  replay.next = 0;
+  read_event(data, size, replay.cursor, replay.next, replay.event);
+  return true;
+}
+
+// Applies every key change due before instruction `instruction` runs and
+// returns how many instructions can run before the next one. Returns 0 once
+// the recording is over.
+uint64_t replay_advance(Replay &replay, State &state, uint64_t instruction) {
+  while (replay.next <= instruction &&
+         replay.event != POT8TO_RECORDING_END) {
+    set_key(state, replay.event & 0xF, (replay.event & 0x10) != 0);
+    read_event(replay.data, replay.size, replay.cursor, replay.next,
+               replay.event);
+  }
+  return replay.next > instruction ? replay.next - instruction : 0;
+}
+
+} // namespace Pot8to
@@ -0,0 +1,87 @@
+#pragma once
+// Run-ahead: hides the frames a program takes to show a key press. Most
+// programs read the keys once a frame and draw the answer a frame or two
+// later, so after every real frame the host copies the state, runs the copy
+// a few frames further with the keys as they are now and shows that
+// display instead. The real state never sees the copy, which is thrown away
+// and made again from scratch next frame: nothing is ever rolled back.
+//
+// The copy lives in a preallocated `RunAhead` and is made with
+// `reset_state`, so a frame of run-ahead costs one copy of the state plus
+// the frames run, and allocates nothing.
+#include "pot8to.cpp"
+
+namespace Pot8to {
+
+struct RunAhead {
+  // The copy run ahead, overwritten every frame. The host shows its display.
+  State ahead;
+  // The display the last `run_ahead` left, to tell which rows changed.
+  uint64_t shown[POT8TO_DISPLAY_PLANES][POT8TO_DISPLAY_WORDS];
+  bool shown_hires;
+  // Whether `shown` holds a frame the host has drawn.
+  bool has_shown;
+};
+
+// Forgets what was shown, the next `run_ahead` repaints every row.
+void run_ahead_reset(RunAhead &runahead) { runahead.has_shown = false; }
+
+// Rows of `state`'s display that differ from `shown`, which is then updated.
+static uint64_t run_ahead_changed_rows(RunAhead &runahead,
+                                       const State &state) {
+  if (!runahead.has_shown || runahead.shown_hires != state.hires) {
+    memcpy(runahead.shown, state.display, sizeof(runahead.shown));
+    runahead.shown_hires = state.hires;
+    runahead.has_shown = true;
+    return POT8TO_ALL_ROWS;
+  }
+  unsigned word_shift = row_word_shift(state);
+  size_t words = display_height(state) << word_shift;
+  uint64_t rows = 0;
+  for (size_t plane = 0; plane < POT8TO_DISPLAY_PLANES; plane++) {
+    for (size_t i = 0; i < words; i++) {
+      if (runahead.shown[plane][i] != state.display[plane][i]) {
+        rows |= 1ull << (i >> word_shift);
+        runahead.shown[plane][i] = state.display[plane][i];
+      }
+    }
+  }
+  return rows;
+}
+
+// Copies `state`, which has just finished a frame, and runs the copy
+// `frames` more frames of `instructions_per_frame` on `run`, ticking the
+// timers after each. Returns the rows to repaint from
+// `display_frame(runahead.ahead)` since the last call. With `frames` 0 the
+// copy is just `state`.
+uint64_t run_ahead(RunAhead &runahead, const State &state, RunFunction run,
+                   size_t instructions_per_frame, uint64_t frames) {
+  State &ahead = runahead.ahead;
+  reset_state(ahead, state);
+#ifdef POT8TO_PROFILE
+  // Speculative frames would count twice.
+  ahead.profile = nullptr;
+#endif
+#ifdef POT8TO_TRACE
+  ahead.trace = nullptr;
+#endif
+  for (uint64_t frame = 0; frame < frames; frame++) {
+    size_t budget = instructions_per_frame;
+    while (budget > 0) {
+      budget -= run(ahead, budget).executed;
+    }
+    decrement_timers(ahead);
+    if (idle_until_input(ahead)) {
+      // Nothing changes until a key does, and the keys are held.
+      budget = (size_t)skip_idle_frames(ahead, frames - frame - 1,
+                                        instructions_per_frame);
+      while (budget > 0) {
+        budget -= run(ahead, budget).executed;
+      }
+      break;
+    }
+  }
+  return run_ahead_changed_rows(runahead, ahead);
+}
+
+} // namespace Pot8to
@@ -0,0 +1,202 @@
+#pragma once
+// Runs a `State` on a thread of its own, so a slow renderer can't stall the
+// emulation and the renderer never reads a display that is being drawn.
+//
+// Finished frames go out through a triple buffer of display snapshots. The
+// emulation thread always has a slot of its own to copy the next frame
+// into, the renderer always has one to read, and the third holds the
+// newest finished frame. Handing a slot over is one atomic exchange on
+// either side, nobody waits and a frame is never torn. Keys come back in as
+// a 16-bit mask the emulation thread applies before every frame.
+#include "pot8to.cpp"
+#include "pot8to_audio.cpp"
+#include "pot8to_scheduler.cpp"
+#include <atomic>
+#include <functional>
+#include <thread>
+
+namespace Pot8to {
+
+struct DisplaySnapshot {
+  uint64_t display[POT8TO_DISPLAY_PLANES][POT8TO_DISPLAY_WORDS];
+  bool hires;
+  // Frames the runner had finished when it was taken.
+  uint64_t frame;
+};
+
+Platform::Frame snapshot_frame(const DisplaySnapshot &snapshot) {
+  Platform::Frame frame;
+  for (size_t plane = 0; plane < POT8TO_DISPLAY_PLANES; plane++) {
+    frame.planes[plane] = snapshot.display[plane];
+  }
+  frame.width =
+      snapshot.hires ? POT8TO_HIRES_DISPLAY_WIDTH : POT8TO_DISPLAY_WIDTH;
+  frame.height =
+      snapshot.hires ? POT8TO_HIRES_DISPLAY_HEIGHT : POT8TO_DISPLAY_HEIGHT;
+  return frame;
+}
+
+// Set in `TripleBuffer::middle` while it holds a frame the renderer hasn't
+// taken yet.
+constexpr uint8_t POT8TO_SNAPSHOT_FRESH = 4;
+
+struct TripleBuffer {
+  DisplaySnapshot slots[3];
+  // Slot index between the two threads, with POT8TO_SNAPSHOT_FRESH.
+  alignas(64) std::atomic<uint8_t> middle;
+  // Rows changed by frames published since the renderer last asked. Kept
+  // apart from the slots because the renderer may skip frames.
+  alignas(64) std::atomic<uint64_t> rows;
+  // Each side's own slot.
+  alignas(64) uint8_t back;
+  alignas(64) uint8_t front;
+};
+
+void triple_buffer_reset(TripleBuffer &buffer) {
+  memset(buffer.slots, 0, sizeof(buffer.slots));
+  buffer.back = 0;
+  buffer.middle.store(1, std::memory_order_relaxed);
+  buffer.front = 2;
+  buffer.rows.store(POT8TO_ALL_ROWS, std::memory_order_relaxed);
+}
+
+// Emulation side: fill `triple_buffer_back`, then publish it with the rows
+// it changed.
+DisplaySnapshot &triple_buffer_back(TripleBuffer &buffer) {
+  return buffer.slots[buffer.back];
+}
+
+void triple_buffer_publish(TripleBuffer &buffer, uint64_t rows) {
+  buffer.back = buffer.middle.exchange(buffer.back | POT8TO_SNAPSHOT_FRESH,
+                                       std::memory_order_acq_rel) &
+                3;
+  // After the frame, so rows the renderer sees are always in a frame it
+  // can take.
+  buffer.rows.fetch_or(rows, std::memory_order_release);
+}
+
+// Renderer side: returns the newest frame and sets `rows` to the rows to
+// repaint from it. The frame stays valid until the next call.
+const DisplaySnapshot &triple_buffer_take(TripleBuffer &buffer,
+                                          uint64_t &rows) {
+  // Rows first: any frame they came from is published by now.
+  rows = buffer.rows.exchange(0, std::memory_order_acquire);
+  if (buffer.middle.load(std::memory_order_relaxed) & POT8TO_SNAPSHOT_FRESH) {
+    buffer.front =
+        buffer.middle.exchange(buffer.front, std::memory_order_acq_rel) & 3;
+  }
+  return buffer.slots[buffer.front];
+}
+
+struct RunnerConfig {
+  RunFunction core;
+  SchedulerConfig schedule;
+  // Paces the frames. With a null `now` they run back to back as fast as
+  // the core goes.
+  Clock clock;
+  // Gets one frame of samples per frame unless null.
+  AudioRing *audio;
+  // The thread finishes by itself after this many frames.
+  uint64_t frames;
+};
+
+struct Runner {
+  // The emulation thread's alone from `runner_start` to `runner_join`.
+  State state;
+  RunnerConfig config;
+  TripleBuffer display;
+  // Key N is bit N, read before every frame.
+  alignas(64) std::atomic<uint32_t> keys;
+  std::atomic<bool> stopping;
+  // Set once the thread ran its last frame.
+  std::atomic<bool> finished;
+  std::thread thread;
+};
+
+static void runner_main(Runner &runner) {
+  State &state = runner.state;
+  const RunnerConfig &config = runner.config;
+  Scheduler scheduler;
+  bool paced = config.clock.now != nullptr;
+  if (paced) {
+    scheduler_start(scheduler, config.schedule, config.clock);
+  } else {
+    // Only hands out frame sizes.
+    scheduler.config = config.schedule;
+    scheduler.frames = 0;
+  }
+  SquareWave tone;
+  square_wave_begin(tone, 440);
+
+  uint64_t frame = 0;
+  while (frame < config.frames &&
+         !runner.stopping.load(std::memory_order_relaxed)) {
+    uint64_t due = 1;
+    if (paced) {
+      scheduler_wait(scheduler);
+      due = scheduler_due_frames(scheduler);
+    }
+    for (; due > 0 && frame < config.frames; due--) {
+      uint32_t keys = runner.keys.load(std::memory_order_relaxed);
+      for (uint8_t key = 0; key < 16; key++) {
+        set_key(state, key, (keys >> key) & 1);
+      }
+      size_t budget = scheduler_next_frame(scheduler);
+      while (budget > 0) {
+        budget -= config.core(state, budget).executed;
+      }
+      if (config.audio != nullptr) {
+        audio_push_frame(tone, state, *config.audio);
+      }
+      decrement_timers(state);
+      frame++;
+
+      uint64_t rows = take_dirty_rows(state);
+      if (rows != 0) {
+        DisplaySnapshot &snapshot = triple_buffer_back(runner.display);
+        memcpy(snapshot.display, state.display, sizeof(snapshot.display));
+        snapshot.hires = state.hires;
+        snapshot.frame = frame;
+        triple_buffer_publish(runner.display, rows);
+      }
+    }
+  }
+  runner.finished.store(true, std::memory_order_release);
+}
+
+// Starts running `runner.state` on a new thread. The runner must stay put
+// until `runner_join`.
+void runner_start(Runner &runner, const RunnerConfig &config) {
+  runner.config = config;
+  triple_buffer_reset(runner.display);
+  // The renderer starts out with the display as it is now.
+  DisplaySnapshot &first = runner.display.slots[runner.display.front];
+  memcpy(first.display, runner.state.display, sizeof(first.display));
+  first.hires = runner.state.hires;
+  runner.keys.store(0, std::memory_order_relaxed);
+  runner.stopping.store(false, std::memory_order_relaxed);
+  runner.finished.store(false, std::memory_order_relaxed);
+  runner.thread = std::thread(runner_main, std::ref(runner));
+}
+
+void runner_set_key(Runner &runner, uint8_t key, bool down) {
+  if (down) {
+    runner.keys.fetch_or(1u << key, std::memory_order_relaxed);
+  } else {
+    runner.keys.fetch_and(~(1u << key), std::memory_order_relaxed);
+  }
+}
+
+// Asks the thread to stop after the frame it is on.
+void runner_stop(Runner &runner) {
+  runner.stopping.store(true, std::memory_order_relaxed);
+}
+
+// Waits for the thread to end, `runner.state` is the caller's again after.
+void runner_join(Runner &runner) {
+  if (runner.thread.joinable()) {
+    runner.thread.join();
+  }
+}
+
+} // namespace Pot8to
@@ -0,0 +1,376 @@
+#pragma once
+// Save states and rewind.
+//
+// A snapshot is everything a program can observe, packed into a fixed
+// little-endian image by `pack_snapshot`. Both save states and the rewind
+// ring store that image XOR-ed against a base and run-length encoded: a save
+// state against all zeroes, a rewind entry against the frame after it.
+#include "pot8to.cpp"
+
+namespace Pot8to {
+
+// Bump whenever the snapshot layout changes.
+constexpr uint16_t POT8TO_SAVE_STATE_VERSION = 4;
+
+constexpr size_t POT8TO_SNAPSHOT_SIZE =
+    POT8TO_MAX_MEMORY + POT8TO_DISPLAY_PLANES * POT8TO_DISPLAY_WORDS * 8 +
+    16 * 2 + 16 + 1 /* waiting_for_key */ + 1 /* key_register */ + 16 +
+    2 /* I */ + 2 /* PC */ + 1 /* SP */ + 1 /* delay */ +
+    1 /* sound */ + 4 /* rng */ + 1 /* hires */ + 1 /* planes */ +
+    16 /* flags */;
+// Worst case of `encode_delta` over a snapshot, one control byte for every
+// 128 literal bytes.
+constexpr size_t POT8TO_DELTA_MAX_SIZE =
+    POT8TO_SNAPSHOT_SIZE + (POT8TO_SNAPSHOT_SIZE + 127) / 128;
+// "P8TO", version, payload size.
+constexpr size_t POT8TO_SAVE_STATE_HEADER_SIZE = 4 + 2 + 4;
+constexpr size_t POT8TO_SAVE_STATE_MAX_SIZE =
+    POT8TO_SAVE_STATE_HEADER_SIZE + POT8TO_DELTA_MAX_SIZE;
+
+static inline void put_le(uint8_t *&p, uint64_t value, size_t bytes) {
+  for (size_t i = 0; i < bytes; i++) {
+    *p++ = (uint8_t)(value >> (8 * i));
+  }
+}
+
+static inline uint64_t get_le(const uint8_t *&p, size_t bytes) {
+  uint64_t value = 0;
+  for (size_t i = 0; i < bytes; i++) {
+    value |= (uint64_t)*p++ << (8 * i);
+  }
+  return value;
+}
+
+void pack_snapshot(const State &state, uint8_t image[POT8TO_SNAPSHOT_SIZE]) {
+  uint8_t *p = image;
+  memcpy(p, state.memory, POT8TO_MAX_MEMORY);
+  p += POT8TO_MAX_MEMORY;
+  for (size_t plane = 0; plane < POT8TO_DISPLAY_PLANES; plane++) {
+    for (size_t i = 0; i < POT8TO_DISPLAY_WORDS; i++) {
+      put_le(p, state.display[plane][i], 8);
+    }
+  }
+  for (size_t i = 0; i < 16; i++) {
+    put_le(p, state.stack[i], 2);
+  }
+  for (size_t i = 0; i < 16; i++) {
+    *p++ = state.keyboard[i];
+  }
+  *p++ = state.waiting_for_key;
+  *p++ = state.key_register;
+  memcpy(p, state.registers.V, 16);
+  p += 16;
+  put_le(p, state.registers.I, 2);
+  put_le(p, state.registers.PC, 2);
+  *p++ = state.registers.SP;
+  *p++ = state.registers.T.delay;
+  *p++ = state.registers.T.sound;
+  put_le(p, state.rng, 4);
+  *p++ = state.hires;
+  *p++ = state.planes;
+  memcpy(p, state.flags, 16);
+}
+
+// Inverse of `pack_snapshot`. Drops the decode cache and marks every page
+// written, since whatever was cached came from different memory. Rows that
+// differ from the current display are marked dirty, all of them if the
+// resolution changed.
+void unpack_snapshot(const uint8_t image[POT8TO_SNAPSHOT_SIZE], State &state) {
+  const uint8_t *p = image;
+  memcpy(state.memory, p, POT8TO_MAX_MEMORY);
+  p += POT8TO_MAX_MEMORY;
+  uint64_t changed[POT8TO_DISPLAY_WORDS] = {};
+  for (size_t plane = 0; plane < POT8TO_DISPLAY_PLANES; plane++) {
+    for (size_t i = 0; i < POT8TO_DISPLAY_WORDS; i++) {
+      uint64_t word = get_le(p, 8);
+      changed[i] |= word ^ state.display[plane][i];
+      state.display[plane][i] = word;
+    }
+  }
+  for (size_t i = 0; i < 16; i++) {
+    state.stack[i] = (uint16_t)get_le(p, 2);
+  }
+  for (size_t i = 0; i < 16; i++) {
+    state.keyboard[i] = *p++ != 0;
+  }
+  state.waiting_for_key = *p++ != 0;
+  state.key_register = *p++ & 0xF;
+  memcpy(state.registers.V, p, 16);
+  p += 16;
+  state.registers.I = (uint16_t)get_le(p, 2);
+  state.registers.PC = (uint16_t)get_le(p, 2);
+  state.registers.SP = *p++;
+  state.registers.T.delay = *p++;
+  state.registers.T.sound = *p++;
+  state.rng = (uint32_t)get_le(p, 4);
+  bool hires = *p++ != 0;
+  state.planes = *p++ & ((1u << POT8TO_DISPLAY_PLANES) - 1);
+  memcpy(state.flags, p, 16);
+
+  if (hires != state.hires) {
+    state.hires = hires;
+    state.dirty_rows = POT8TO_ALL_ROWS;
+  } else {
+    unsigned word_shift = row_word_shift(state);
+    for (size_t i = 0; i < POT8TO_DISPLAY_WORDS; i++) {
+      state.dirty_rows |= (uint64_t)(changed[i] != 0) << (i >> word_shift);
+    }
+  }
+
+  memset(state.decoded_valid, 0, sizeof(state.decoded_valid));
+  state.written_pages = ~0ull;
+  state.idle_period = 0;
+}
+
+// Run-length encodes `current` XOR `base` into `out` and returns the encoded
+// size. A control byte below 0x80 is followed by that many plus one literal
+// XOR bytes, 0x80 to 0xFE stand for (byte - 0x7F) zero bytes and 0xFF for as
+// many zero bytes as the 16-bit little-endian count after it.
+static size_t encode_delta(const uint8_t *current, const uint8_t *base,
+                           size_t size, uint8_t *out) {
+  uint8_t *o = out;
+  size_t i = 0;
+  while (i < size) {
+    size_t start = i;
+    // Unchanged bytes, 8 at a time while we can.
+    while (i + 8 <= size && memcmp(current + i, base + i, 8) == 0) {
+      i += 8;
+    }
+    while (i < size && current[i] == base[i]) {
+      i++;
+    }
+    for (size_t run = i - start; run > 0;) {
+      size_t n = run > 0xFFFF ? 0xFFFF : run;
+      if (n < 0x80) {
+        *o++ = (uint8_t)(0x7F + n);
+      } else {
+        *o++ = 0xFF;
+        put_le(o, n, 2);
+      }
+      run -= n;
+    }
+
+    // Changed bytes. A single unchanged byte costs the same as a literal, so
+    // only two in a row end the literal run.
+    start = i;
+    while (i < size && i - start < 128 &&
+           (current[i] != base[i] ||
+            (i + 1 < size && current[i + 1] != base[i + 1]))) {
+      i++;
+    }
+    if (i > start) {
+      *o++ = (uint8_t)(i - start - 1);
+      for (size_t j = start; j < i; j++) {
+        *o++ = current[j] ^ base[j];
+      }
+    }
+  }
+  return o - out;
+}
+
+// XORs a delta from `encode_delta` into `image` in place. Returns false if the
+// delta is malformed or doesn't cover exactly `size` bytes.
+static bool apply_delta(uint8_t *image, size_t size, const uint8_t *delta,
+                        size_t delta_size) {
+  size_t i = 0;
+  const uint8_t *end = delta + delta_size;
+  while (delta < end) {
+    uint8_t control = *delta++;
+    if (control == 0xFF) {
+      if (end - delta < 2) {
+        return false;
+      }
+      i += get_le(delta, 2);
+      if (i > size) {
+        return false;
+      }
+      continue;
+    }
+    if (control >= 0x80) {
+      i += control - 0x7F;
+      if (i > size) {
+        return false;
+      }
+      continue;
+    }
+    size_t n = control + 1;
+    if (i + n > size || (size_t)(end - delta) < n) {
+      return false;
+    }
+    for (size_t j = 0; j < n; j++) {
+      image[i + j] ^= delta[j];
+    }
+    i += n;
+    delta += n;
+  }
+  return i == size;
+}
+
+// Writes a save state into `out` and returns its size, or 0 if it doesn't fit
+// in `capacity`. `POT8TO_SAVE_STATE_MAX_SIZE` bytes always fit.
+size_t save_state(const State &state, uint8_t *out, size_t capacity) {
+  static const uint8_t zeroes[POT8TO_SNAPSHOT_SIZE] = {};
+  uint8_t image[POT8TO_SNAPSHOT_SIZE];
+  uint8_t payload[POT8TO_DELTA_MAX_SIZE];
+  pack_snapshot(state, image);
+  size_t payload_size =
+      encode_delta(image, zeroes, POT8TO_SNAPSHOT_SIZE, payload);
+  if (POT8TO_SAVE_STATE_HEADER_SIZE + payload_size > capacity) {
+    return 0;
+  }
+
+  uint8_t *p = out;
+  memcpy(p, "P8TO", 4);
+  p += 4;
+  put_le(p, POT8TO_SAVE_STATE_VERSION, 2);
+  put_le(p, payload_size, 4);
+  memcpy(p, payload, payload_size);
+  return POT8TO_SAVE_STATE_HEADER_SIZE + payload_size;
+}
+
+// Restores a save state written by `save_state`. Leaves `state` untouched and
+// returns false if the data is not a save state of this version.
+bool load_state(State &state, const uint8_t *data, size_t size) {
+  if (size < POT8TO_SAVE_STATE_HEADER_SIZE || memcmp(data, "P8TO", 4) != 0) {
+    return false;
+  }
+  const uint8_t *p = data + 4;
+  uint16_t version = (uint16_t)get_le(p, 2);
+  size_t payload_size = (size_t)get_le(p, 4);
+  if (version != POT8TO_SAVE_STATE_VERSION ||
+      payload_size != size - POT8TO_SAVE_STATE_HEADER_SIZE) {
+    return false;
+  }
+
+  uint8_t image[POT8TO_SNAPSHOT_SIZE] = {};
+  if (!apply_delta(image, POT8TO_SNAPSHOT_SIZE, p, payload_size)) {
+    return false;
+  }
+  unpack_snapshot(image, state);
+  return true;
+}
+
+// Per-frame history to step back through. The newest snapshot is kept whole,
+// every older one only as its delta to the one after it, which XOR makes
+// the same as the delta back. Entries live back to back in a circular arena
+// and the oldest are dropped once it or the entry ring is full.
+struct Rewind {
+  struct Entry {
+    size_t offset;
+    size_t size;
+  };
+  uint8_t *arena;
+  size_t arena_size;
+  // Ring of deltas, oldest at `first`.
+  Entry *entries;
+  size_t capacity;
+  size_t first;
+  size_t count;
+  // Where the next delta goes in `arena`.
+  size_t head;
+  uint8_t latest[POT8TO_SNAPSHOT_SIZE];
+  bool has_latest;
+};
+
+void rewind_reset(Rewind &rewind) {
+  rewind.first = 0;
+  rewind.count = 0;
+  rewind.head = 0;
+  rewind.has_latest = false;
+}
+
+// Keeps up to `frames` steps of history in at most `arena_size` bytes, which
+// must be at least `POT8TO_DELTA_MAX_SIZE`.
+bool rewind_create(Rewind &rewind, size_t frames, size_t arena_size) {
+  if (frames == 0 || arena_size < POT8TO_DELTA_MAX_SIZE) {
+    return false;
+  }
+  rewind.arena = new uint8_t[arena_size];
+  rewind.arena_size = arena_size;
+  rewind.entries = new Rewind::Entry[frames];
+  rewind.capacity = frames;
+  rewind_reset(rewind);
+  return true;
+}
+
+void rewind_destroy(Rewind &rewind) {
+  delete[] rewind.arena;
+  delete[] rewind.entries;
+  rewind.arena = NULL;
+  rewind.entries = NULL;
+}
+
+static void rewind_drop_oldest(Rewind &rewind) {
+  rewind.first = (rewind.first + 1) % rewind.capacity;
+  rewind.count--;
+}
+
+// Records `state` as the newest frame. Call once per frame.
+void rewind_push(Rewind &rewind, const State &state) {
+  uint8_t current[POT8TO_SNAPSHOT_SIZE];
+  pack_snapshot(state, current);
+  if (!rewind.has_latest) {
+    memcpy(rewind.latest, current, POT8TO_SNAPSHOT_SIZE);
+    rewind.has_latest = true;
+    return;
+  }
+
+  if (rewind.count == rewind.capacity) {
+    rewind_drop_oldest(rewind);
+  }
+  // Make room for the worst case right at `head`. Everything between `head`
+  // and the oldest entry is free, so wrapping first drops whatever is left
+  // past `head`.
+  if (rewind.head + POT8TO_DELTA_MAX_SIZE > rewind.arena_size) {
+    while (rewind.count > 0 &&
+           rewind.entries[rewind.first].offset >= rewind.head) {
+      rewind_drop_oldest(rewind);
+    }
+    rewind.head = 0;
+  }
+  while (rewind.count > 0 &&
+         rewind.entries[rewind.first].offset >= rewind.head &&
+         rewind.entries[rewind.first].offset <
+             rewind.head + POT8TO_DELTA_MAX_SIZE) {
+    rewind_drop_oldest(rewind);
+  }
+
+  Rewind::Entry &entry =
+      rewind.entries[(rewind.first + rewind.count) % rewind.capacity];
+  entry.offset = rewind.head;
+  entry.size = encode_delta(current, rewind.latest, POT8TO_SNAPSHOT_SIZE,
+                            rewind.arena + rewind.head);
+  rewind.head += entry.size;
+  rewind.count++;
+  memcpy(rewind.latest, current, POT8TO_SNAPSHOT_SIZE);
+}
+
+// Restores the frame pushed before the newest one and makes it the newest.
+// Returns false when there is no history left.
+bool rewind_step_back(Rewind &rewind, State &state) {
+  if (rewind.count == 0) {
+    return false;
+  }
+  Rewind::Entry &entry =
+      rewind.entries[(rewind.first + rewind.count - 1) % rewind.capacity];
+  apply_delta(rewind.latest, POT8TO_SNAPSHOT_SIZE, rewind.arena + entry.offset,
+              entry.size);
+  rewind.head = entry.offset;
+  rewind.count--;
+  unpack_snapshot(rewind.latest, state);
+  return true;
+}
+
+// Steps `rewind_step_back` can still go.
+size_t rewind_frames(const Rewind &rewind) { return rewind.count; }
+
+// Bytes of arena the history currently takes up.
+size_t rewind_bytes(const Rewind &rewind) {
+  size_t bytes = 0;
+  for (size_t i = 0; i < rewind.count; i++) {
+    bytes += rewind.entries[(rewind.first + i) % rewind.capacity].size;
+  }
+  return bytes;
+}
+
+} // namespace Pot8to
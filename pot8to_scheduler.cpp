@@ -0,0 +1,100 @@
+#pragma once
+// Paces an interactive host: turns an instructions-per-second target and a
+// frame rate (the 60 Hz the timers tick at) into whole frames of work per
+// wakeup, and says how long to sleep before the next one is due.
+//
+// Deadlines are computed from the start time and a frame count, never
+// accumulated, so they don't drift. A host that falls behind (a stall, a
+// dragged window, a debugger) runs the late frames back to back, but at most
+// `max_catch_up_frames` of them; older ones are given up and the schedule
+// restarts from the current time. Emulated time only slows down then, no
+// frame of emulation is ever skipped.
+//
+// The clock is pluggable so the arithmetic can be driven by a simulated
+// clock instead of a real one.
+#include <cstddef>
+#include <cstdint>
+
+namespace Pot8to {
+
+struct Clock {
+  // Seconds since any fixed point, never going backwards.
+  double (*now)(void *context);
+  // Waits for about `seconds`. Waking early, e.g. because input arrived, is
+  // fine. May be null if the host never calls `scheduler_wait`.
+  void (*sleep)(void *context, double seconds);
+  void *context;
+};
+
+struct SchedulerConfig {
+  uint32_t instructions_per_second;
+  // Also how often the host calls `decrement_timers`, so normally 60.
+  uint32_t frames_per_second;
+  // At least 1.
+  uint32_t max_catch_up_frames;
+};
+
+struct Scheduler {
+  SchedulerConfig config;
+  Clock clock;
+  // When frame slot 0 was due. Slot n is due `n / frames_per_second` later.
+  double start;
+  // Frames handed out by `scheduler_next_frame`, and slots given up after
+  // falling behind. The next frame takes slot `frames + dropped`.
+  uint64_t frames;
+  uint64_t dropped;
+};
+
+// Starts the schedule now, the first frame is due immediately.
+void scheduler_start(Scheduler &scheduler, const SchedulerConfig &config,
+                     const Clock &clock) {
+  scheduler.config = config;
+  scheduler.clock = clock;
+  scheduler.start = clock.now(clock.context);
+  scheduler.frames = 0;
+  scheduler.dropped = 0;
+}
+
+// Time the next frame is due, on the scheduler's clock.
+double scheduler_deadline(const Scheduler &scheduler) {
+  return scheduler.start + (double)(scheduler.frames + scheduler.dropped) /
+                               scheduler.config.frames_per_second;
+}
+
+// Number of frames due by now, at most `max_catch_up_frames`. The host runs
+// that many frames, calling `scheduler_next_frame` for each.
+uint64_t scheduler_due_frames(Scheduler &scheduler) {
+  double behind = (scheduler.clock.now(scheduler.clock.context) -
+                   scheduler_deadline(scheduler)) *
+                  scheduler.config.frames_per_second;
+  if (behind < 0) {
+    return 0;
+  }
+  uint64_t due = (uint64_t)behind + 1;
+  if (due > scheduler.config.max_catch_up_frames) {
+    scheduler.dropped += due - scheduler.config.max_catch_up_frames;
+    due = scheduler.config.max_catch_up_frames;
+  }
+  return due;
+}
+
+// Counts the next frame as run and returns how many instructions it gets.
+// Rates that don't divide evenly alternate between the two nearest whole
+// numbers so every second runs exactly `instructions_per_second`.
+size_t scheduler_next_frame(Scheduler &scheduler) {
+  uint64_t rate = scheduler.config.instructions_per_second;
+  uint64_t fps = scheduler.config.frames_per_second;
+  uint64_t frame = scheduler.frames++;
+  return (size_t)((frame + 1) * rate / fps - frame * rate / fps);
+}
+
+// Sleeps until the next frame is due, or returns at once if it already is.
+void scheduler_wait(Scheduler &scheduler) {
+  double left = scheduler_deadline(scheduler) -
+                scheduler.clock.now(scheduler.clock.context);
+  if (left > 0) {
+    scheduler.clock.sleep(scheduler.clock.context, left);
+  }
+}
+
+} // namespace Pot8to
@@ -0,0 +1,231 @@
+#pragma once
+// Spectators: any number of local viewers watching a run through a Unix
+// domain socket, each getting the stream described in pot8to_stream.cpp.
+// POSIX only.
+//
+// All the work happens in `spectate_publish`, on the thread that finishes
+// the frames: it takes in new viewers and hands every one of them the
+// frame, never waiting on any. A viewer whose socket is still full from an
+// earlier message just misses the frame and gets a keyframe once it has
+// caught up, so a slow viewer costs the emulator one failed send.
+#include "pot8to_stream.cpp"
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <vector>
+
+namespace Pot8to {
+
+// New viewers are let in every this many frames, checking costs a system
+// call.
+constexpr uint64_t POT8TO_SPECTATE_ACCEPT_INTERVAL = 8;
+
+struct Spectator {
+  int socket;
+  // The part of the last message the socket didn't take. Nothing else
+  // goes out until it has.
+  std::vector<uint8_t> pending;
+  // New, or missed a frame: deltas are no use to it until a keyframe.
+  bool needs_keyframe;
+};
+
+struct SpectateServer {
+  int listener;
+  sockaddr_un address;
+  std::vector<Spectator> spectators;
+  // Every viewer gets a keyframe at least this often.
+  uint64_t keyframe_interval;
+  uint64_t since_keyframe;
+  uint64_t published;
+  // Image of the last frame published, the next delta's base.
+  uint8_t last[POT8TO_STREAM_IMAGE_SIZE];
+  // Viewers taken in and frames some viewer missed, over the whole run.
+  uint64_t connections;
+  uint64_t dropped;
+};
+
+static bool set_nonblocking(int socket) {
+  int flags = fcntl(socket, F_GETFL);
+  return flags >= 0 && fcntl(socket, F_SETFL, flags | O_NONBLOCK) == 0;
+}
+
+// Sends and stores whatever the socket doesn't take in `pending`. False
+// once the viewer has gone.
+static bool spectator_send(Spectator &spectator, const uint8_t *data,
+                           size_t size) {
+#ifdef MSG_NOSIGNAL
+  const int flags = MSG_NOSIGNAL;
+#else
+  const int flags = 0;
+#endif
+  while (size > 0) {
+    ssize_t sent = send(spectator.socket, data, size, flags);
+    if (sent < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno != EAGAIN && errno != EWOULDBLOCK) {
+        return false;
+      }
+      break;
+    }
+    data += sent;
+    size -= (size_t)sent;
+  }
+  spectator.pending.assign(data, data + size);
+  return true;
+}
+
+// Sends what is left of the last message. False once the viewer has gone.
+static bool spectator_flush(Spectator &spectator) {
+  if (spectator.pending.empty()) {
+    return true;
+  }
+  std::vector<uint8_t> rest;
+  rest.swap(spectator.pending);
+  return spectator_send(spectator, rest.data(), rest.size());
+}
+
+static void spectate_accept(SpectateServer &server) {
+  while (true) {
+    int socket = accept(server.listener, NULL, NULL);
+    if (socket < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return;
+    }
+#ifdef SO_NOSIGPIPE
+    int on = 1;
+    setsockopt(socket, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#endif
+    Spectator spectator;
+    spectator.socket = socket;
+    spectator.needs_keyframe = true;
+    uint8_t header[POT8TO_STREAM_HEADER_SIZE];
+    stream_header(header);
+    if (!set_nonblocking(socket) ||
+        !spectator_send(spectator, header, sizeof(header))) {
+      close(socket);
+      continue;
+    }
+    server.spectators.push_back(spectator);
+    server.connections++;
+  }
+}
+
+// Listens on a new socket at `path`, replacing a stale one left there. Every
+// viewer gets a keyframe at least every `keyframe_interval` frames.
+bool spectate_open(SpectateServer &server, const char *path,
+                   uint64_t keyframe_interval) {
+  server.listener = -1;
+  server.spectators.clear();
+  server.keyframe_interval = keyframe_interval > 0 ? keyframe_interval : 1;
+  server.since_keyframe = 0;
+  server.published = 0;
+  memset(server.last, 0, sizeof(server.last));
+  server.connections = 0;
+  server.dropped = 0;
+
+  sockaddr_un &address = server.address;
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof(address.sun_path)) {
+    return false;
+  }
+  strcpy(address.sun_path, path);
+  struct stat info;
+  if (stat(path, &info) == 0 && S_ISSOCK(info.st_mode)) {
+    unlink(path);
+  }
+  int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (listener < 0) {
+    return false;
+  }
+  if (!set_nonblocking(listener) ||
+      bind(listener, (sockaddr *)&address, sizeof(address)) != 0 ||
+      listen(listener, 16) != 0) {
+    close(listener);
+    return false;
+  }
+  server.listener = listener;
+  return true;
+}
+
+// Sends the frame that just finished to every viewer, now and then taking
+// in new ones first. `frame` numbers it for them, frames never published
+// show up as gaps.
+void spectate_publish(SpectateServer &server,
+                      const uint64_t display[POT8TO_DISPLAY_PLANES]
+                                            [POT8TO_DISPLAY_WORDS],
+                      bool hires, uint64_t frame) {
+  if (server.published++ % POT8TO_SPECTATE_ACCEPT_INTERVAL == 0) {
+    spectate_accept(server);
+  }
+  if (server.spectators.empty()) {
+    // Whoever connects next starts from a keyframe anyway.
+    return;
+  }
+  uint8_t image[POT8TO_STREAM_IMAGE_SIZE];
+  pack_display_image(display, image);
+  bool keyframe_due = ++server.since_keyframe >= server.keyframe_interval;
+  if (keyframe_due) {
+    server.since_keyframe = 0;
+  }
+
+  // Each kind is encoded once, the first time a viewer needs it.
+  uint8_t keyframe[POT8TO_STREAM_MAX_MESSAGE_SIZE];
+  uint8_t delta[POT8TO_STREAM_MAX_MESSAGE_SIZE];
+  size_t keyframe_size = 0;
+  size_t delta_size = 0;
+  size_t kept = 0;
+  for (size_t i = 0; i < server.spectators.size(); i++) {
+    Spectator &spectator = server.spectators[i];
+    bool alive = spectator_flush(spectator);
+    if (alive && !spectator.pending.empty()) {
+      server.dropped++;
+      spectator.needs_keyframe = true;
+    } else if (alive && (keyframe_due || spectator.needs_keyframe)) {
+      if (keyframe_size == 0) {
+        keyframe_size = stream_encode(STREAM_KEYFRAME, hires, frame, image,
+                                      server.last, keyframe);
+      }
+      alive = spectator_send(spectator, keyframe, keyframe_size);
+      spectator.needs_keyframe = false;
+    } else if (alive) {
+      if (delta_size == 0) {
+        delta_size = stream_encode(STREAM_DELTA, hires, frame, image,
+                                   server.last, delta);
+      }
+      alive = spectator_send(spectator, delta, delta_size);
+    }
+    if (!alive) {
+      close(spectator.socket);
+      continue;
+    }
+    if (kept != i) {
+      server.spectators[kept] = server.spectators[i];
+    }
+    kept++;
+  }
+  server.spectators.resize(kept);
+  memcpy(server.last, image, sizeof(image));
+}
+
+// Disconnects every viewer, stops listening and removes the socket.
+void spectate_close(SpectateServer &server) {
+  for (size_t i = 0; i < server.spectators.size(); i++) {
+    close(server.spectators[i].socket);
+  }
+  server.spectators.clear();
+  if (server.listener >= 0) {
+    close(server.listener);
+    unlink(server.address.sun_path);
+    server.listener = -1;
+  }
+}
+
+} // namespace Pot8to
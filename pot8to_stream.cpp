@@ -0,0 +1,145 @@
+#pragma once
+// Display streams: a run's frames as a sequence of messages small enough to
+// send every frame, for spectators and recordings of headless instances.
+//
+// A stream starts with "P8TS" and a u16 version. Every message after that
+// is a 14-byte header, then the payload: u8 kind, u8 hires, u64 frame
+// number and u32 payload size, little-endian. The payload is the frame's
+// display image, both planes' words packed little-endian like a snapshot's,
+// XOR-ed against a base and run-length encoded with `encode_delta`. A
+// keyframe's base is all zeroes, a delta's is the image of the message
+// right before it. Decoders start at a keyframe and go back to waiting for
+// one after any gap.
+#include "pot8to.cpp"
+#include "pot8to_savestate.cpp"
+
+namespace Pot8to {
+
+// Bump whenever the message layout changes.
+constexpr uint16_t POT8TO_STREAM_VERSION = 1;
+constexpr size_t POT8TO_STREAM_HEADER_SIZE = 4 + 2;
+constexpr size_t POT8TO_STREAM_MESSAGE_HEADER_SIZE = 1 + 1 + 8 + 4;
+constexpr size_t POT8TO_STREAM_IMAGE_SIZE =
+    POT8TO_DISPLAY_PLANES * POT8TO_DISPLAY_WORDS * 8;
+// Worst case of `encode_delta` over an image, see POT8TO_DELTA_MAX_SIZE.
+constexpr size_t POT8TO_STREAM_MAX_MESSAGE_SIZE =
+    POT8TO_STREAM_MESSAGE_HEADER_SIZE + POT8TO_STREAM_IMAGE_SIZE +
+    (POT8TO_STREAM_IMAGE_SIZE + 127) / 128;
+
+enum StreamMessageKind : uint8_t {
+  STREAM_KEYFRAME = 1,
+  STREAM_DELTA = 2
+};
+
+// Writes the stream header, POT8TO_STREAM_HEADER_SIZE bytes.
+void stream_header(uint8_t out[POT8TO_STREAM_HEADER_SIZE]) {
+  memcpy(out, "P8TS", 4);
+  uint8_t *p = out + 4;
+  put_le(p, POT8TO_STREAM_VERSION, 2);
+}
+
+bool stream_header_valid(const uint8_t header[POT8TO_STREAM_HEADER_SIZE]) {
+  const uint8_t *p = header + 4;
+  return memcmp(header, "P8TS", 4) == 0 &&
+         get_le(p, 2) == POT8TO_STREAM_VERSION;
+}
+
+void pack_display_image(const uint64_t display[POT8TO_DISPLAY_PLANES]
+                                              [POT8TO_DISPLAY_WORDS],
+                        uint8_t image[POT8TO_STREAM_IMAGE_SIZE]) {
+  uint8_t *p = image;
+  for (size_t plane = 0; plane < POT8TO_DISPLAY_PLANES; plane++) {
+    for (size_t i = 0; i < POT8TO_DISPLAY_WORDS; i++) {
+      put_le(p, display[plane][i], 8);
+    }
+  }
+}
+
+void unpack_display_image(const uint8_t image[POT8TO_STREAM_IMAGE_SIZE],
+                          uint64_t display[POT8TO_DISPLAY_PLANES]
+                                          [POT8TO_DISPLAY_WORDS]) {
+  const uint8_t *p = image;
+  for (size_t plane = 0; plane < POT8TO_DISPLAY_PLANES; plane++) {
+    for (size_t i = 0; i < POT8TO_DISPLAY_WORDS; i++) {
+      display[plane][i] = get_le(p, 8);
+    }
+  }
+}
+
+// Writes one message for the frame in `image` and returns its size, at
+// most POT8TO_STREAM_MAX_MESSAGE_SIZE. `base` is the previous message's
+// image for a delta and ignored for a keyframe.
+size_t stream_encode(StreamMessageKind kind, bool hires, uint64_t frame,
+                     const uint8_t image[POT8TO_STREAM_IMAGE_SIZE],
+                     const uint8_t base[POT8TO_STREAM_IMAGE_SIZE],
+                     uint8_t *out) {
+  static const uint8_t zeroes[POT8TO_STREAM_IMAGE_SIZE] = {};
+  size_t payload_size =
+      encode_delta(image, kind == STREAM_KEYFRAME ? zeroes : base,
+                   POT8TO_STREAM_IMAGE_SIZE,
+                   out + POT8TO_STREAM_MESSAGE_HEADER_SIZE);
+  uint8_t *p = out;
+  *p++ = kind;
+  *p++ = hires;
+  put_le(p, frame, 8);
+  put_le(p, payload_size, 4);
+  return POT8TO_STREAM_MESSAGE_HEADER_SIZE + payload_size;
+}
+
+struct StreamMessage {
+  StreamMessageKind kind;
+  bool hires;
+  uint64_t frame;
+  uint32_t payload_size;
+};
+
+// Reads a message header. False if it can't be from this version.
+bool stream_read_message_header(
+    const uint8_t header[POT8TO_STREAM_MESSAGE_HEADER_SIZE],
+    StreamMessage &message) {
+  const uint8_t *p = header;
+  uint8_t kind = *p++;
+  uint8_t hires = *p++;
+  message.kind = (StreamMessageKind)kind;
+  message.hires = hires != 0;
+  message.frame = get_le(p, 8);
+  message.payload_size = (uint32_t)get_le(p, 4);
+  return (kind == STREAM_KEYFRAME || kind == STREAM_DELTA) && hires <= 1 &&
+         message.payload_size <=
+             POT8TO_STREAM_MAX_MESSAGE_SIZE - POT8TO_STREAM_MESSAGE_HEADER_SIZE;
+}
+
+// The receiving end: the last frame decoded.
+struct StreamDecoder {
+  uint8_t image[POT8TO_STREAM_IMAGE_SIZE];
+  bool hires;
+  uint64_t frame;
+  // Clear until the first keyframe, deltas can't be decoded before it.
+  bool synced;
+};
+
+void stream_decoder_reset(StreamDecoder &decoder) {
+  memset(decoder.image, 0, sizeof(decoder.image));
+  decoder.hires = false;
+  decoder.frame = 0;
+  decoder.synced = false;
+}
+
+// Applies one message's payload. Returns false if the decoder doesn't have
+// the frame before a delta or the payload is malformed, the decoder then
+// waits for the next keyframe.
+bool stream_decode(StreamDecoder &decoder, const StreamMessage &message,
+                   const uint8_t *payload) {
+  if (message.kind == STREAM_KEYFRAME) {
+    memset(decoder.image, 0, sizeof(decoder.image));
+  } else if (!decoder.synced) {
+    return false;
+  }
+  decoder.synced = apply_delta(decoder.image, POT8TO_STREAM_IMAGE_SIZE,
+                               payload, message.payload_size);
+  decoder.hires = message.hires;
+  decoder.frame = message.frame;
+  return decoder.synced;
+}
+
+} // namespace Pot8to
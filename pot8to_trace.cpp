@@ -0,0 +1,178 @@
+#pragma once
+// Execution traces: every instruction a `State` runs, as the 16-byte
+// `TraceRecord` the cores fill in when built with POT8TO_TRACE. The thread
+// running the state only copies records into its `TraceRing`, a thread of
+// the trace's own writes them out. Without the flag this file is empty.
+//
+// A trace file starts with "P8TR", a u16 version and a u16 record size.
+// Then comes one record per instruction in the order they ran: u16 pc,
+// opcode, I, address and written_sum, then u8 x, vx, vf, SP, written and a
+// zero byte, all little-endian. tracediff_linux finds where two of them
+// part ways, so anything that can write this format can be compared with
+// us.
+#include "pot8to.cpp"
+#include "pot8to_savestate.cpp"
+
+#ifdef POT8TO_TRACE
+#include <chrono>
+#include <functional>
+#include <stdio.h>
+#include <vector>
+
+namespace Pot8to {
+
+// Bump whenever the record layout changes.
+constexpr uint16_t POT8TO_TRACE_VERSION = 1;
+constexpr size_t POT8TO_TRACE_HEADER_SIZE = 4 + 2 + 2;
+constexpr size_t POT8TO_TRACE_RECORD_SIZE = 16;
+// Records the ring holds by default, 4 MB. The state only waits for the disk
+// when the flush thread falls this far behind.
+constexpr size_t POT8TO_TRACE_RING_RECORDS = 1 << 18;
+
+void trace_header(uint8_t out[POT8TO_TRACE_HEADER_SIZE]) {
+  memcpy(out, "P8TR", 4);
+  uint8_t *p = out + 4;
+  put_le(p, POT8TO_TRACE_VERSION, 2);
+  put_le(p, POT8TO_TRACE_RECORD_SIZE, 2);
+}
+
+bool trace_header_valid(const uint8_t header[POT8TO_TRACE_HEADER_SIZE]) {
+  const uint8_t *p = header + 4;
+  return memcmp(header, "P8TR", 4) == 0 &&
+         get_le(p, 2) == POT8TO_TRACE_VERSION &&
+         get_le(p, 2) == POT8TO_TRACE_RECORD_SIZE;
+}
+
+void trace_encode(const TraceRecord &record,
+                  uint8_t out[POT8TO_TRACE_RECORD_SIZE]) {
+  uint8_t *p = out;
+  put_le(p, record.pc, 2);
+  put_le(p, record.opcode, 2);
+  put_le(p, record.I, 2);
+  put_le(p, record.address, 2);
+  put_le(p, record.written_sum, 2);
+  *p++ = record.x;
+  *p++ = record.vx;
+  *p++ = record.vf;
+  *p++ = record.SP;
+  *p++ = record.written;
+  *p++ = 0;
+}
+
+void trace_decode(const uint8_t in[POT8TO_TRACE_RECORD_SIZE],
+                  TraceRecord &record) {
+  const uint8_t *p = in;
+  record.pc = (uint16_t)get_le(p, 2);
+  record.opcode = (uint16_t)get_le(p, 2);
+  record.I = (uint16_t)get_le(p, 2);
+  record.address = (uint16_t)get_le(p, 2);
+  record.written_sum = (uint16_t)get_le(p, 2);
+  record.x = *p++;
+  record.vx = *p++;
+  record.vf = *p++;
+  record.SP = *p++;
+  record.written = *p++;
+  record.reserved = *p++;
+}
+
+// A trace being written: the ring a state fills and the flush thread
+// emptying it into the file.
+struct Trace {
+  TraceRing ring;
+  std::vector<TraceRecord> records;
+  FILE *file;
+  std::thread flusher;
+  // Set once the state is done, the flusher drains the ring and exits.
+  std::atomic<bool> stopping;
+  // Set by the flusher when the file couldn't take a write.
+  bool failed;
+};
+
+// The flush thread: sleeps while the ring is empty, otherwise writes what is
+// there in chunks and frees it.
+static void trace_flush(Trace &trace) {
+  TraceRing &ring = trace.ring;
+  const size_t chunk = 4096;
+  std::vector<uint8_t> buffer(chunk * POT8TO_TRACE_RECORD_SIZE);
+  while (true) {
+    // Read before `head`, so nothing recorded before the stop is missed.
+    bool stopping = trace.stopping.load(std::memory_order_acquire);
+    uint64_t head = ring.head.load(std::memory_order_acquire);
+    uint64_t tail = ring.tail.load(std::memory_order_relaxed);
+    if (head == tail) {
+      if (stopping) {
+        return;
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      continue;
+    }
+    size_t count = head - tail < chunk ? (size_t)(head - tail) : chunk;
+    for (size_t i = 0; i < count; i++) {
+      trace_encode(ring.records[(tail + i) & ring.mask],
+                   &buffer[i * POT8TO_TRACE_RECORD_SIZE]);
+    }
+    if (!trace.failed && fwrite(buffer.data(), POT8TO_TRACE_RECORD_SIZE,
+                                count, trace.file) != count) {
+      // Keep draining, the state mustn't wait on a dead file.
+      trace.failed = true;
+    }
+    ring.tail.store(tail + count, std::memory_order_release);
+  }
+}
+
+// Creates the file at `path`, starts the flush thread and attaches the trace
+// to `state`, which records every instruction it runs from then on.
+// `records` is the ring's capacity, rounded up to a power of two.
+bool trace_start(Trace &trace, State &state, const char *path,
+                 size_t records = POT8TO_TRACE_RING_RECORDS) {
+  trace.file = fopen(path, "wb");
+  if (trace.file == NULL) {
+    return false;
+  }
+  uint8_t header[POT8TO_TRACE_HEADER_SIZE];
+  trace_header(header);
+  trace.failed = fwrite(header, 1, sizeof(header), trace.file) !=
+                 sizeof(header);
+  size_t capacity = 1;
+  while (capacity < records) {
+    capacity *= 2;
+  }
+  trace.records.assign(capacity, TraceRecord{});
+  TraceRing &ring = trace.ring;
+  ring.records = trace.records.data();
+  ring.mask = capacity - 1;
+  ring.head.store(0, std::memory_order_relaxed);
+  ring.tail.store(0, std::memory_order_relaxed);
+  ring.seen_tail = 0;
+  ring.stalls = 0;
+  ring.has_pending = false;
+  trace.stopping.store(false, std::memory_order_relaxed);
+  trace.flusher = std::thread(trace_flush, std::ref(trace));
+  state.trace = &ring;
+  return true;
+}
+
+// Records the instruction `state` ran last, detaches the trace and waits for
+// every record to reach the file. False if any write failed.
+bool trace_stop(Trace &trace, State &state) {
+  if (trace.ring.has_pending) {
+    trace_finish(state, trace.ring);
+  }
+  state.trace = nullptr;
+  trace.stopping.store(true, std::memory_order_release);
+  trace.flusher.join();
+  bool written = !trace.failed;
+  if (fclose(trace.file) != 0) {
+    written = false;
+  }
+  trace.records.clear();
+  return written;
+}
+
+// Records the state has handed over so far.
+uint64_t trace_records(const Trace &trace) {
+  return trace.ring.head.load(std::memory_order_relaxed);
+}
+
+} // namespace Pot8to
+#endif
@@ -0,0 +1,117 @@
+// Drives the scheduler (see pot8to_scheduler.cpp) with a simulated clock and
+// checks what interactive hosts rely on:
+//   - 700 instructions per second over 600 frames is exactly 7000
+//     instructions, odd rates spread over the frames without rounding away
+//   - after a 1 s stall only `max_catch_up_frames` late frames run, the rest
+//     are dropped and the schedule goes on from there
+//   - deadlines don't drift, however late each sleep wakes up
+// Prints a line per check and exits non-zero if any fails.
+#include "pot8to_scheduler.cpp"
+#include <stdio.h>
+
+// Time only moves when the scheduler sleeps, by what it asked for plus
+// `oversleep`, or when a check moves it.
+struct SimulatedClock {
+  double time;
+  double oversleep;
+  // xorshift32 state, oversleeps are random up to `oversleep` when set.
+  uint32_t jitter;
+};
+
+static double simulated_now(void *context) {
+  return ((SimulatedClock *)context)->time;
+}
+
+static void simulated_sleep(void *context, double seconds) {
+  SimulatedClock &clock = *(SimulatedClock *)context;
+  double late = clock.oversleep;
+  if (clock.jitter != 0) {
+    clock.jitter ^= clock.jitter << 13;
+    clock.jitter ^= clock.jitter >> 17;
+    clock.jitter ^= clock.jitter << 5;
+    late *= (clock.jitter % 1000) / 1000.0;
+  }
+  clock.time += seconds + late;
+}
+
+static Pot8to::Scheduler start(SimulatedClock &clock,
+                               const Pot8to::SchedulerConfig &config) {
+  Pot8to::Clock hooks = {simulated_now, simulated_sleep, &clock};
+  Pot8to::Scheduler scheduler;
+  Pot8to::scheduler_start(scheduler, config, hooks);
+  return scheduler;
+}
+
+// Runs `frames` frames the way the hosts do and returns their instructions.
+static uint64_t run_frames(Pot8to::Scheduler &scheduler, uint64_t frames) {
+  uint64_t instructions = 0;
+  while (scheduler.frames < frames) {
+    Pot8to::scheduler_wait(scheduler);
+    for (uint64_t due = Pot8to::scheduler_due_frames(scheduler);
+         due > 0 && scheduler.frames < frames; due--) {
+      instructions += Pot8to::scheduler_next_frame(scheduler);
+    }
+  }
+  return instructions;
+}
+
+static int failures = 0;
+
+static void check(bool passed, const char *what) {
+  printf("%s: %s\n", passed ? "ok" : "FAILED", what);
+  if (!passed) {
+    failures++;
+  }
+}
+
+static void check_rate() {
+  SimulatedClock clock = {100.0, 0.0, 0};
+  Pot8to::Scheduler scheduler = start(clock, {700, 60, 4});
+  uint64_t instructions = run_frames(scheduler, 600);
+  printf("  %llu instructions in %.3f s\n", (unsigned long long)instructions,
+         clock.time - 100.0);
+  check(instructions == 7000 && scheduler.dropped == 0,
+        "700 instructions/s over 600 frames is 7000 instructions");
+}
+
+static void check_stall() {
+  SimulatedClock clock = {0.0, 0.0, 0};
+  Pot8to::Scheduler scheduler = start(clock, {660, 60, 4});
+  run_frames(scheduler, 60);
+  // The host hangs for a second between two wakeups.
+  clock.time += 1.0;
+  uint64_t due = Pot8to::scheduler_due_frames(scheduler);
+  uint64_t dropped = scheduler.dropped;
+  for (uint64_t i = 0; i < due; i++) {
+    Pot8to::scheduler_next_frame(scheduler);
+  }
+  uint64_t due_after = Pot8to::scheduler_due_frames(scheduler);
+  printf("  %llu frames caught up, %llu dropped\n", (unsigned long long)due,
+         (unsigned long long)dropped);
+  check(due == 4 && dropped > 0 && due_after == 0,
+        "a 1 s stall catches up max_catch_up_frames and drops the rest");
+}
+
+static void check_drift() {
+  // Every sleep wakes up to 3 ms late, about a fifth of a frame.
+  SimulatedClock clock = {0.0, 0.003, 0x2545F491};
+  Pot8to::Scheduler scheduler = start(clock, {660, 60, 4});
+  const uint64_t frames = 60 * 60 * 10;
+  run_frames(scheduler, frames);
+  double expected = (double)frames / 60;
+  double error = Pot8to::scheduler_deadline(scheduler) - expected;
+  double lag = clock.time - (expected - 1.0 / 60);
+  printf("  after %llu frames: deadline off by %.3g s, clock %.6f s behind "
+         "the last frame's deadline\n",
+         (unsigned long long)frames, error, lag);
+  check(scheduler.dropped == 0 && error < 1e-9 && error > -1e-9 &&
+            lag >= 0 && lag < 0.003 + 1e-9,
+        "deadlines don't drift over 10 minutes of late wakeups");
+}
+
+int main() {
+  check_rate();
+  check_stall();
+  check_drift();
+  return failures == 0 ? 0 : 1;
+}
@@ -1,8 +1,22 @@
 #pragma once
 #include <cstddef>
+#include <cstdint>
 
 constexpr size_t POT8TO_MAX_MEMORY = 4096;
 constexpr size_t POT8TO_PROGRAM_MEMORY_INITIAL_POSITION = 0x200;
 constexpr size_t POT8TO_PROGRAM_MEMORY = POT8TO_MAX_MEMORY - POT8TO_PROGRAM_MEMORY_INITIAL_POSITION;
 constexpr size_t POT8TO_DISPLAY_WIDTH = 64;
 constexpr size_t POT8TO_DISPLAY_HEIGHT = 32;
+// SUPER-CHIP's high resolution mode, the largest the display gets.
+constexpr size_t POT8TO_HIRES_DISPLAY_WIDTH = 128;
+constexpr size_t POT8TO_HIRES_DISPLAY_HEIGHT = 64;
+// XO-CHIP bitplanes, plain CHIP-8 and SUPER-CHIP only draw on the first.
+constexpr size_t POT8TO_DISPLAY_PLANES = 2;
+// 64-pixel words in one plane at the largest resolution.
+constexpr size_t POT8TO_DISPLAY_WORDS =
+    POT8TO_HIRES_DISPLAY_WIDTH * POT8TO_HIRES_DISPLAY_HEIGHT / 64;
+// Granularity at which memory writes invalidate translated code.
+constexpr size_t POT8TO_CODE_PAGE_SIZE = 64;
+// CXNN's seed for every new state, so runs are reproducible unless the host
+// picks another one.
+constexpr uint32_t POT8TO_DEFAULT_SEED = 0x2545F491;
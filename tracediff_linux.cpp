@@ -0,0 +1,190 @@
+// Compares two execution traces (see pot8to_trace.cpp) and reports the first
+// instruction where they part ways, with the instructions leading up to it.
+//   pot8to_trace_linux rom.ch8 --trace ours.p8tr
+//   tracediff_linux ours.p8tr reference.p8tr --context 16
+// Exits with 0 if the traces match, 1 at a difference and 2 on bad input.
+#ifndef POT8TO_TRACE
+// The record format only exists in tracing builds.
+#define POT8TO_TRACE
+#endif
+#include "platform.h"
+#include "platform_linux.cpp"
+#include "pot8to.cpp"
+#include "pot8to_trace.cpp"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+static void print_usage(const char *program) {
+  fprintf(stderr,
+          "usage: %s <a.p8tr> <b.p8tr> [options]\n"
+          "  --context N  instructions to show before the difference\n"
+          "               (default 8)\n",
+          program);
+}
+
+// A trace being read a chunk of records at a time.
+struct TraceFile {
+  FILE *file;
+  std::vector<uint8_t> buffer;
+  size_t size;
+  size_t at;
+};
+
+static bool trace_file_open(TraceFile &trace, const char *path) {
+  trace.file = fopen(path, "rb");
+  if (trace.file == NULL) {
+    fprintf(stderr, "Could not open '%s'\n", path);
+    return false;
+  }
+  uint8_t header[Pot8to::POT8TO_TRACE_HEADER_SIZE];
+  if (fread(header, 1, sizeof(header), trace.file) != sizeof(header) ||
+      !Pot8to::trace_header_valid(header)) {
+    fprintf(stderr, "'%s' is not a trace of version %u\n", path,
+            (unsigned)Pot8to::POT8TO_TRACE_VERSION);
+    return false;
+  }
+  trace.buffer.resize(4096 * Pot8to::POT8TO_TRACE_RECORD_SIZE);
+  trace.size = 0;
+  trace.at = 0;
+  return true;
+}
+
+// Reads the next record, false at the end of the file.
+static bool trace_file_next(TraceFile &trace, Pot8to::TraceRecord &record) {
+  if (trace.at == trace.size) {
+    trace.size = fread(trace.buffer.data(), Pot8to::POT8TO_TRACE_RECORD_SIZE,
+                       trace.buffer.size() / Pot8to::POT8TO_TRACE_RECORD_SIZE,
+                       trace.file);
+    trace.at = 0;
+    if (trace.size == 0) {
+      return false;
+    }
+  }
+  Pot8to::trace_decode(&trace.buffer[trace.at++ *
+                                     Pot8to::POT8TO_TRACE_RECORD_SIZE],
+                       record);
+  return true;
+}
+
+static void print_record(const char *label, uint64_t index,
+                         const Pot8to::TraceRecord &record) {
+  printf("%s %llu: %03X %04X I=%03X", label, (unsigned long long)index,
+         record.pc, record.opcode, record.I);
+  if (record.x != Pot8to::POT8TO_TRACE_NO_REGISTER) {
+    printf(" V%X=%02X", record.x & 0xF, record.vx);
+  }
+  printf(" VF=%02X SP=%u", record.vf, record.SP);
+  if (record.written != 0) {
+    printf(" wrote %u at %03X sum %04X", record.written, record.address,
+           record.written_sum);
+  }
+  printf("\n");
+}
+
+// The names of the fields `a` and `b` disagree on.
+static void print_differences(const Pot8to::TraceRecord &a,
+                              const Pot8to::TraceRecord &b) {
+  printf("differs in:");
+  if (a.pc != b.pc) {
+    printf(" pc");
+  }
+  if (a.opcode != b.opcode) {
+    printf(" opcode");
+  }
+  if (a.I != b.I) {
+    printf(" I");
+  }
+  if (a.x != b.x || a.vx != b.vx) {
+    printf(" register");
+  }
+  if (a.vf != b.vf) {
+    printf(" VF");
+  }
+  if (a.SP != b.SP) {
+    printf(" SP");
+  }
+  if (a.written != b.written || a.address != b.address ||
+      a.written_sum != b.written_sum) {
+    printf(" memory");
+  }
+  printf("\n");
+}
+
+static bool same_record(const Pot8to::TraceRecord &a,
+                        const Pot8to::TraceRecord &b) {
+  return a.pc == b.pc && a.opcode == b.opcode && a.I == b.I && a.x == b.x &&
+         a.vx == b.vx && a.vf == b.vf && a.SP == b.SP &&
+         a.written == b.written && a.address == b.address &&
+         a.written_sum == b.written_sum;
+}
+
+int main(int argc, char **argv) {
+  const char *paths[2] = {NULL, NULL};
+  size_t context = 8;
+  for (int i = 1; i < argc; i++) {
+    bool has_value = i + 1 < argc;
+    if (strcmp(argv[i], "--context") == 0 && has_value) {
+      context = (size_t)strtoull(argv[++i], NULL, 10);
+    } else if (argv[i][0] != '-' && paths[0] == NULL) {
+      paths[0] = argv[i];
+    } else if (argv[i][0] != '-' && paths[1] == NULL) {
+      paths[1] = argv[i];
+    } else {
+      print_usage(argv[0]);
+      return 2;
+    }
+  }
+  if (paths[1] == NULL) {
+    print_usage(argv[0]);
+    return 2;
+  }
+  TraceFile a;
+  TraceFile b;
+  if (!trace_file_open(a, paths[0]) || !trace_file_open(b, paths[1])) {
+    return 2;
+  }
+
+  // The last `context` records both agreed on.
+  std::vector<Pot8to::TraceRecord> history(context);
+  uint64_t index = 0;
+  while (true) {
+    Pot8to::TraceRecord ra;
+    Pot8to::TraceRecord rb;
+    bool more_a = trace_file_next(a, ra);
+    bool more_b = trace_file_next(b, rb);
+    if (!more_a && !more_b) {
+      printf("traces match, %llu instructions\n", (unsigned long long)index);
+      return 0;
+    }
+    if (more_a && more_b && same_record(ra, rb)) {
+      if (context > 0) {
+        history[index % context] = ra;
+      }
+      index++;
+      continue;
+    }
+
+    printf("first difference at instruction %llu\n",
+           (unsigned long long)index);
+    uint64_t first = index > context ? index - context : 0;
+    for (uint64_t i = first; i < index; i++) {
+      print_record(" ", i, history[i % context]);
+    }
+    if (more_a) {
+      print_record("a", index, ra);
+    } else {
+      printf("a ends after %llu instructions\n", (unsigned long long)index);
+    }
+    if (more_b) {
+      print_record("b", index, rb);
+    } else {
+      printf("b ends after %llu instructions\n", (unsigned long long)index);
+    }
+    if (more_a && more_b) {
+      print_differences(ra, rb);
+    }
+    return 1;
+  }
+}
@@ -0,0 +1,195 @@
+// Watches a run served with pot8to_linux --spectate, or a stream recorded
+// from one, and decodes it frame by frame (see pot8to_stream.cpp).
+//   viewer_linux /tmp/pot8to.sock --record run.p8ts
+//   viewer_linux --file run.p8ts --frames
+// Reads until the stream ends, then prints what it got and a checksum of
+// the last frame that matches the host's display_checksum.
+#include "platform.h"
+#include "platform_linux.cpp"
+#include "pot8to.cpp"
+#include "pot8to_stream.cpp"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+static void print_usage(const char *program) {
+  fprintf(stderr,
+          "usage: %s <socket> [options]\n"
+          "       %s --file FILE [options]\n"
+          "  --record FILE  also write the stream as received to FILE\n"
+          "  --frames       print every decoded frame's number and checksum\n"
+          "  --dump         print the last frame\n",
+          program, program);
+}
+
+static int connect_to(const char *path) {
+  sockaddr_un address = {};
+  address.sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof(address.sun_path)) {
+    fprintf(stderr, "Socket path '%s' is too long\n", path);
+    return -1;
+  }
+  strcpy(address.sun_path, path);
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0 || connect(fd, (sockaddr *)&address, sizeof(address)) != 0) {
+    fprintf(stderr, "Could not connect to '%s'\n", path);
+    if (fd >= 0) {
+      close(fd);
+    }
+    return -1;
+  }
+  return fd;
+}
+
+// Reads exactly `size` bytes, copying them to `record` unless null. False
+// at the end of the stream.
+static bool read_exact(int fd, uint8_t *data, size_t size, FILE *record) {
+  uint8_t *at = data;
+  for (size_t left = size; left > 0;) {
+    ssize_t n = read(fd, at, left);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    at += n;
+    left -= (size_t)n;
+  }
+  if (record != NULL) {
+    fwrite(data, 1, size, record);
+  }
+  return true;
+}
+
+int main(int argc, char **argv) {
+  const char *socket_path = NULL;
+  const char *file_path = NULL;
+  const char *record_path = NULL;
+  bool print_frames = false;
+  bool dump = false;
+  for (int i = 1; i < argc; i++) {
+    bool has_value = i + 1 < argc;
+    if (strcmp(argv[i], "--file") == 0 && has_value) {
+      file_path = argv[++i];
+    } else if (strcmp(argv[i], "--record") == 0 && has_value) {
+      record_path = argv[++i];
+    } else if (strcmp(argv[i], "--frames") == 0) {
+      print_frames = true;
+    } else if (strcmp(argv[i], "--dump") == 0) {
+      dump = true;
+    } else if (argv[i][0] != '-' && socket_path == NULL) {
+      socket_path = argv[i];
+    } else {
+      print_usage(argv[0]);
+      return 1;
+    }
+  }
+  if ((socket_path == NULL) == (file_path == NULL)) {
+    print_usage(argv[0]);
+    return 1;
+  }
+
+  int fd;
+  if (file_path != NULL) {
+    fd = open(file_path, O_RDONLY);
+    if (fd < 0) {
+      fprintf(stderr, "Could not open '%s'\n", file_path);
+      return 1;
+    }
+  } else {
+    fd = connect_to(socket_path);
+    if (fd < 0) {
+      return 1;
+    }
+  }
+  FILE *record = NULL;
+  if (record_path != NULL) {
+    record = fopen(record_path, "wb");
+    if (record == NULL) {
+      fprintf(stderr, "Could not open '%s'\n", record_path);
+      return 1;
+    }
+  }
+
+  uint8_t header[Pot8to::POT8TO_STREAM_HEADER_SIZE];
+  if (!read_exact(fd, header, sizeof(header), record) ||
+      !Pot8to::stream_header_valid(header)) {
+    fprintf(stderr, "Not a stream of version %u\n",
+            (unsigned)Pot8to::POT8TO_STREAM_VERSION);
+    return 1;
+  }
+
+  // Frames go into a state's display so they hash like the host's.
+  static Pot8to::State view;
+  static Pot8to::StreamDecoder decoder;
+  Pot8to::stream_decoder_reset(decoder);
+  static uint8_t payload[Pot8to::POT8TO_STREAM_MAX_MESSAGE_SIZE];
+  uint64_t keyframes = 0;
+  uint64_t deltas = 0;
+  uint64_t skipped = 0;
+  uint64_t bytes = sizeof(header);
+  uint64_t decoded = 0;
+  uint8_t message_header[Pot8to::POT8TO_STREAM_MESSAGE_HEADER_SIZE];
+  while (read_exact(fd, message_header, sizeof(message_header), record)) {
+    Pot8to::StreamMessage message;
+    if (!Pot8to::stream_read_message_header(message_header, message)) {
+      fprintf(stderr, "Malformed message after %llu bytes\n",
+              (unsigned long long)bytes);
+      return 1;
+    }
+    if (!read_exact(fd, payload, message.payload_size, record)) {
+      break;
+    }
+    bytes += sizeof(message_header) + message.payload_size;
+    if (message.kind == Pot8to::STREAM_KEYFRAME) {
+      keyframes++;
+    } else {
+      deltas++;
+    }
+    if (!Pot8to::stream_decode(decoder, message, payload)) {
+      skipped++;
+      continue;
+    }
+    decoded++;
+    if (print_frames) {
+      Pot8to::unpack_display_image(decoder.image, view.display);
+      view.hires = decoder.hires;
+      printf("frame %llu: %016llx\n", (unsigned long long)decoder.frame,
+             (unsigned long long)Pot8to::display_hash(view));
+    }
+  }
+  close(fd);
+  if (record != NULL) {
+    fclose(record);
+  }
+
+  Pot8to::unpack_display_image(decoder.image, view.display);
+  view.hires = decoder.hires;
+  if (dump) {
+    static uint8_t pixels[POT8TO_HIRES_DISPLAY_WIDTH *
+                          POT8TO_HIRES_DISPLAY_HEIGHT];
+    Pot8to::unpack_display(view, pixels);
+    size_t width = Pot8to::display_width(view);
+    for (size_t y = 0; y < Pot8to::display_height(view); y++) {
+      for (size_t x = 0; x < width; x++) {
+        putchar(".#+@"[pixels[y * width + x]]);
+      }
+      putchar('\n');
+    }
+  }
+  printf("bytes: %llu\n", (unsigned long long)bytes);
+  printf("keyframes: %llu\n", (unsigned long long)keyframes);
+  printf("deltas: %llu\n", (unsigned long long)deltas);
+  printf("frames_decoded: %llu\n", (unsigned long long)decoded);
+  printf("messages_skipped: %llu\n", (unsigned long long)skipped);
+  printf("last_frame: %llu\n", (unsigned long long)decoder.frame);
+  printf("display_checksum: %016llx\n",
+         (unsigned long long)Pot8to::display_hash(view));
+  return 0;
+}